@@ -1,14 +1,56 @@
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <iomanip>
 #include <iostream>
+#include <new>
+#include <numeric>
 #include <random>
 #include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #include <DictionarySGL.hpp>
 #include <DictionaryMLT.hpp>
+#include <CachedDictionary.hpp>
+#include <PreadReader.hpp>
+#include <PrefixAnalyzer.hpp>
+#include <ReplicatedDictionary.hpp>
 
 using namespace ddd;
 
+#ifdef DDD_COUNT_HEAP // by the CMake option, replacing the global allocation
+
+namespace {
+
+std::atomic<size_t> num_heap_allocs{0}; // calls of the global operator new
+
+} // namespace
+
+#ifdef __GNUC__ // both out of line, or GCC takes the pairing of malloc and new as a mismatch
+#define DDD_HEAP_NOINLINE __attribute__((noinline))
+#else
+#define DDD_HEAP_NOINLINE
+#endif
+
+DDD_HEAP_NOINLINE void* operator new(std::size_t size) {
+  num_heap_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (auto ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+DDD_HEAP_NOINLINE void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+#endif // DDD_COUNT_HEAP
+
 namespace {
 
 enum class Times {
@@ -95,6 +137,14 @@ std::unique_ptr<Dictionary> create_dic(const std::string dic_type) {
     return make_unique<DictionaryMLT<true, false>>();
   } else if (dic_type == "MLT_NL_BL") {
     return make_unique<DictionaryMLT<true, true>>();
+  } else if (dic_type == "SGL_BL_W") {
+    return make_unique<DictionarySGL<true, false, true>>();
+  } else if (dic_type == "MLT_BL_W") {
+    return make_unique<DictionaryMLT<true, false, true>>();
+  } else if (dic_type == "SGL_SET") {
+    return make_unique<DictionarySGL<false, false, false, void>>();
+  } else if (dic_type == "MLT_SET") {
+    return make_unique<DictionaryMLT<false, false, false, void>>();
   }
   return nullptr;
 }
@@ -109,42 +159,58 @@ std::unique_ptr<Dictionary> create_dic(const std::string dic_type,
     return make_unique<DictionaryMLT<true, false>>(prefixes);
   } else if (dic_type == "MLT_NL_BL") {
     return make_unique<DictionaryMLT<true, true>>(prefixes);
+  } else if (dic_type == "MLT_BL_W") {
+    return make_unique<DictionaryMLT<true, false, true>>(prefixes);
+  } else if (dic_type == "MLT_SET") {
+    return make_unique<DictionaryMLT<false, false, false, void>>(prefixes);
   }
   return create_dic(dic_type);
 }
 
-std::unique_ptr<Dictionary> read_dic(const std::string dic_name) {
-  std::string dic_type{dic_name.substr(dic_name.find_last_of(".") + 1)};
-
-  std::cout << "read dic from " << dic_name << std::endl;
-  std::ifstream ifs{dic_name};
-  if (!ifs) {
-    std::cerr << "failed to open " << dic_name << std::endl;
-    return nullptr;
-  }
-
+// reads a dictionary of the type given by the extension <dic_type>
+std::unique_ptr<Dictionary> read_dic(const std::string& dic_type, std::istream& is) {
   if (dic_type == "SGL") {
-    return make_unique<DictionarySGL<false, false>>(ifs);
+    return make_unique<DictionarySGL<false, false>>(is);
   } else if (dic_type == "SGL_NL") {
-    return make_unique<DictionarySGL<false, true>>(ifs);
+    return make_unique<DictionarySGL<false, true>>(is);
   } else if (dic_type == "SGL_BL") {
-    return make_unique<DictionarySGL<true, false>>(ifs);
+    return make_unique<DictionarySGL<true, false>>(is);
   } else if (dic_type == "SGL_NL_BL") {
-    return make_unique<DictionarySGL<true, true>>(ifs);
+    return make_unique<DictionarySGL<true, true>>(is);
   } else if (dic_type == "MLT") {
-    return make_unique<DictionaryMLT<false, false>>(ifs);
+    return make_unique<DictionaryMLT<false, false>>(is);
   } else if (dic_type == "MLT_NL") {
-    return make_unique<DictionaryMLT<false, true>>(ifs);
+    return make_unique<DictionaryMLT<false, true>>(is);
   } else if (dic_type == "MLT_BL") {
-    return make_unique<DictionaryMLT<true, false>>(ifs);
+    return make_unique<DictionaryMLT<true, false>>(is);
   } else if (dic_type == "MLT_NL_BL") {
-    return make_unique<DictionaryMLT<true, true>>(ifs);
+    return make_unique<DictionaryMLT<true, true>>(is);
+  } else if (dic_type == "SGL_BL_W") {
+    return make_unique<DictionarySGL<true, false, true>>(is);
+  } else if (dic_type == "MLT_BL_W") {
+    return make_unique<DictionaryMLT<true, false, true>>(is);
+  } else if (dic_type == "SGL_SET") {
+    return make_unique<DictionarySGL<false, false, false, void>>(is);
+  } else if (dic_type == "MLT_SET") {
+    return make_unique<DictionaryMLT<false, false, false, void>>(is);
   }
 
   std::cerr << "invalid extension " << dic_type << std::endl;
   return nullptr;
 }
 
+std::unique_ptr<Dictionary> read_dic(const std::string dic_name) {
+  std::string dic_type{dic_name.substr(dic_name.find_last_of(".") + 1)};
+
+  std::cout << "read dic from " << dic_name << std::endl;
+  std::ifstream ifs{dic_name};
+  if (!ifs) {
+    std::cerr << "failed to open " << dic_name << std::endl;
+    return nullptr;
+  }
+  return read_dic(dic_type, ifs);
+}
+
 void show_stat(std::ostream& os, const std::unique_ptr<Dictionary>& dic, bool need_singles) {
   Stat stat{};
   dic->stat(stat);
@@ -163,6 +229,11 @@ void show_stat(std::ostream& os, const std::unique_ptr<Dictionary>& dic, bool ne
   os << "- tail emps       : " << stat.tail_emps << std::endl;
   os << "- tail load factor: " << double(stat.tail_size - stat.tail_emps) / stat.tail_size
      << std::endl;
+  os << "- tail holes      : " << stat.tail_holes << std::endl;
+  os << "- tail saved      : " << stat.tail_saved << std::endl;
+  os << "- label size      : " << stat.label_size << std::endl;
+  os << "- filter size     : " << stat.filter_size << std::endl;
+  os << "- hole size       : " << stat.hole_size << std::endl;
   os << "- size in bytes   : " << stat.size_in_bytes << std::endl;
   if (!need_singles) {
     return;
@@ -170,6 +241,33 @@ void show_stat(std::ostream& os, const std::unique_ptr<Dictionary>& dic, bool ne
   os << "- ratio singles   : " << dic->ratio_singles() << std::endl;
 }
 
+class HeapWatch { // heap allocations with DDD_COUNT_HEAP and the peak RSS during its lifetime
+public:
+#ifdef DDD_COUNT_HEAP
+  HeapWatch() : num_allocs_(num_heap_allocs.load()) {}
+#else
+  HeapWatch() {}
+#endif
+  ~HeapWatch() {}
+
+  void show(std::ostream& os) const {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef DDD_COUNT_HEAP
+    os << "- heap allocations: " << num_heap_allocs.load() - num_allocs_ << std::endl;
+#endif
+    os << "- max RSS         : " << usage.ru_maxrss / 1024.0 << " MiB" << std::endl;
+  }
+
+  HeapWatch(const HeapWatch&) = delete;
+  HeapWatch& operator=(const HeapWatch&) = delete;
+
+#ifdef DDD_COUNT_HEAP
+private:
+  size_t num_allocs_;
+#endif
+};
+
 void show_usage(std::ostream& os) {
   os << "Benchmark 1 <type> <dic> <key> <pfxs...>" << std::endl;
   os << "- insert <key> and write the dictionary to <dic>" << std::endl;
@@ -183,18 +281,47 @@ void show_usage(std::ostream& os) {
   os << "    MLT_NL   : With node-link" << std::endl;
   os << "    MLT_BL   : With block-link" << std::endl;
   os << "    MLT_NL_BL: With node- and block-links" << std::endl;
+  os << "    SGL_BL_W : SGL_BL with wide (47-bit) indices" << std::endl;
+  os << "    MLT_BL_W : MLT_BL with wide (47-bit) indices" << std::endl;
+  os << "    SGL_SET  : SGL without values" << std::endl;
+  os << "    MLT_SET  : MLT without values" << std::endl;
   os << "Benchmark 2 <dic1> <dic2> <key>" << std::endl;
   os << "- delete <key> from <dic1> and write the dictionary to <dic2>" << std::endl;
-  os << "Benchmark 3 <dic> <key>" << std::endl;
+  os << "Benchmark 3 <dic> <key> <zipf> <ent> <prf> <thr>" << std::endl;
   os << "- search <key> for <dic>" << std::endl;
+  os << "- given nonzero <zipf>, search 10 times as many keys drawn from <key> by" << std::endl;
+  os << "  Zipf's law of exponent <zipf>, the first key being the hottest (optional)" << std::endl;
+  os << "- given nonzero <ent>, search through a cache of <ent> entries (optional)" << std::endl;
+  os << "- given nonzero <prf>, search once counting the nodes visited by every" << std::endl;
+  os << "  <prf>-th search, rebuild by the counts and then measure (optional)" << std::endl;
+  os << "- given nonzero <thr>, search by <thr> threads bound to each NUMA node and" << std::endl;
+  os << "  show the throughput of each node, with the dictionary as read and then" << std::endl;
+  os << "  with a replica on each node (optional, without <ent>)" << std::endl;
   os << "Benchmark 4 <rear> <dic1> <dic2>" << std::endl;
   os << "- rearrange <dic1> using <rear> and write the dictionary to <dic2>" << std::endl;
   os << "- <rear>: Rearrangement mode" << std::endl;
   os << "    1: pack()" << std::endl;
   os << "    2: rebuild()" << std::endl;
+  os << "    3: rebuild() with suffix sharing in TAIL" << std::endl;
+  os << "    4: rebuild() in BFS order" << std::endl;
+  os << "    5: rebuild() in van Emde Boas order" << std::endl;
+  os << "    6: rebuild() with compressed edges" << std::endl;
   os << "Benchmark 5 <dic> <key> <pat>" << std::endl;
   os << "- generate a random key set registered in <dic> to <key>" << std::endl;
   os << "- given <pat>, generate the patterns of random sub key sets (optional)" << std::endl;
+  os << "Benchmark 6 <src> <max> <smp>" << std::endl;
+  os << "- choose MLT prefixes for the keys of <src>, a key file or dic, such that" << std::endl;
+  os << "  each subtrie has at most <max> keys, and show the predicted subtrie sizes" << std::endl;
+  os << "- given <smp>, sample <smp> keys instead of 65536 (optional)" << std::endl;
+  os << "Benchmark 7 <dic> <key>" << std::endl;
+  os << "- rebuild <dic> in each node order and show the distinct cache lines and pages" << std::endl;
+  os << "  read by searching <key>" << std::endl;
+  os << "Benchmark 8 <dic> <thr>" << std::endl;
+  os << "- read the MLT <dic> by 1, 2, 4, ... and <thr> threads and show the read times," << std::endl;
+  os << "  with the file evicted from the page cache (cold) and then kept (warm)" << std::endl;
+  os << "Benchmark 9 <dic1> <dic2>" << std::endl;
+  os << "- write <dic1> compressed to <dic2> and show the compression ratio and the" << std::endl;
+  os << "  times to write and read it" << std::endl;
 }
 
 int run_insertion(int argc, const char* argv[]) {
@@ -227,6 +354,7 @@ int run_insertion(int argc, const char* argv[]) {
       return 1;
     }
 
+    HeapWatch hw;
     StopWatch sw;
     uint32_t N = 0;
 
@@ -237,6 +365,7 @@ int run_insertion(int argc, const char* argv[]) {
       }
     }
     std::cout << "- insertion time: " << sw(Times::micro) / N << " us / key" << std::endl;
+    hw.show(std::cout);
   }
 
   show_stat(std::cout, dic, true);
@@ -279,6 +408,7 @@ int run_deletion(int argc, const char* argv[]) {
     }
 
     uint32_t N = 0;
+    HeapWatch hw;
     StopWatch sw;
 
     while (auto key = reader.next()) {
@@ -290,6 +420,7 @@ int run_deletion(int argc, const char* argv[]) {
     }
 
     std::cout << "- deletion time: " << sw(Times::micro) / N << " us / key" << std::endl;
+    hw.show(std::cout);
   }
 
   show_stat(std::cout, dic, true);
@@ -311,6 +442,84 @@ int run_deletion(int argc, const char* argv[]) {
   return 0;
 }
 
+// draws 10 times as many queries as keys, the i-th key in proportion to 1/(i+1)^s
+void make_zipf_queries(const std::vector<std::string>& keys, double s,
+                       std::vector<const char*>& queries) {
+  std::vector<double> cdf(keys.size());
+  double sum = 0.0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    sum += 1.0 / std::pow(i + 1.0, s);
+    cdf[i] = sum;
+  }
+
+  std::mt19937 engine;
+  std::uniform_real_distribution<double> dist{0.0, sum};
+  queries.resize(keys.size() * 10);
+  for (auto& query : queries) {
+    auto it = std::upper_bound(cdf.begin(), cdf.end(), dist(engine));
+    if (it == cdf.end()) {
+      --it;
+    }
+    query = keys[it - cdf.begin()].c_str();
+  }
+}
+
+// searches the queries N times by num_threads threads bound to each node,
+// given as lists of CPUs, and shows the throughput of each node
+bool search_on_nodes(const Dictionary& dic, const std::vector<const char*>& queries, int N,
+                     const std::vector<std::vector<uint32_t>>& nodes, uint32_t num_threads) {
+  const auto num_all = nodes.size() * num_threads;
+  std::vector<double> secs(num_all);
+  std::atomic<size_t> num_ready{0};
+  std::atomic<bool> is_failed{false};
+
+  std::vector<std::thread> threads;
+  for (size_t n = 0; n < nodes.size(); ++n) {
+    for (uint32_t t = 0; t < num_threads; ++t) {
+      auto id = n * num_threads + t;
+      threads.emplace_back([&, n, id] {
+        utils::bind_thread(nodes[n]);
+        ++num_ready;
+        while (num_ready.load() < num_all) { // starts together
+          std::this_thread::yield();
+        }
+        auto begin = id * queries.size() / num_all; // not in lockstep with the others
+        StopWatch sw;
+        for (int r = 0; r < N; ++r) {
+          for (size_t i = 0; i < queries.size(); ++i) {
+            auto query = queries[(begin + i) % queries.size()];
+            if (dic.search_key(query) == NOT_FOUND) {
+              is_failed = true;
+              return;
+            }
+          }
+        }
+        secs[id] = sw(Times::sec);
+      });
+    }
+  }
+  for (auto& th : threads) {
+    th.join();
+  }
+  if (is_failed) {
+    std::cerr << "failed to search" << std::endl;
+    return false;
+  }
+
+  double total = 0.0;
+  for (size_t n = 0; n < nodes.size(); ++n) {
+    double node_total = 0.0;
+    for (uint32_t t = 0; t < num_threads; ++t) {
+      node_total += double(queries.size()) * N / secs[n * num_threads + t];
+    }
+    std::cout << "  - node " << n << " throughput: " << node_total / 1e6 << " M keys / sec"
+              << std::endl;
+    total += node_total;
+  }
+  std::cout << "  - total throughput : " << total / 1e6 << " M keys / sec" << std::endl;
+  return true;
+}
+
 int run_search(int argc, const char* argv[]) {
   std::cout << "run search" << std::endl;
 
@@ -342,21 +551,100 @@ int run_search(int argc, const char* argv[]) {
     }
   }
 
-  const auto N = 10;
+  {
+    LeafStat stat{};
+    dic->leaf_stat(stat);
+    auto num_leaves = double(stat.num_terminals + stat.num_inlines + stat.num_tails);
+    std::cout << "- leaves with values in BC     : " << stat.num_terminals / num_leaves
+              << std::endl;
+    std::cout << "- leaves with suffixes in BC   : " << stat.num_inlines / num_leaves
+              << std::endl;
+    std::cout << "- leaves with suffixes in TAIL : " << stat.num_tails / num_leaves
+              << std::endl;
+    std::cout << "- TAIL accesses avoided        : "
+              << (stat.num_terminals + stat.num_inlines) / num_leaves << std::endl;
+  }
+
+  auto N = 10;
+  std::vector<const char*> queries;
+  if (argc < 5 || std::stod(argv[4]) == 0.0) {
+    for (auto& key : keys) {
+      queries.push_back(key.c_str());
+    }
+  } else {
+    N = 1;
+    make_zipf_queries(keys, std::stod(argv[4]), queries);
+  }
+
+  // records a profile with the same queries and rebuilds by it
+  if (6 < argc && std::stoul(argv[6]) != 0) {
+    dic->set_profiling(static_cast<uint32_t>(std::stoul(argv[6])));
+    for (auto query : queries) {
+      dic->search_key(query);
+    }
+    dic->set_profiling(0);
+
+    StopWatch sw;
+    dic->rebuild();
+    std::cout << "- profiled rebuild time: " << sw(Times::sec) << " sec" << std::endl;
+  }
+
+  if (7 < argc && std::stoul(argv[7]) != 0) { // the multi-threaded mode
+    if (5 < argc && std::stoul(argv[5]) != 0) {
+      std::cerr << "a cache is not measured with threads" << std::endl;
+      return 1;
+    }
+    auto num_threads = static_cast<uint32_t>(std::stoul(argv[7]));
+    std::vector<std::vector<uint32_t>> nodes;
+    utils::numa_nodes(nodes);
+    std::cout << "- " << num_threads << " threads on each of " << nodes.size() << " nodes ("
+              << N << " runs)" << std::endl;
+
+    std::cout << "- as read by a thread" << std::endl;
+    if (!search_on_nodes(*dic, queries, N, nodes, num_threads)) {
+      return 1;
+    }
+
+    auto dic_type = get_ext(argv[2]);
+    auto read = [&](std::istream& is) {
+      return read_dic(dic_type, is);
+    };
+    StopWatch sw;
+    ReplicatedDictionary<uint32_t> rep_dic{std::move(dic), read, nodes};
+    std::cout << "- replicated on each node in " << sw(Times::milli) << " ms" << std::endl;
+    if (!search_on_nodes(rep_dic, queries, N, nodes, num_threads)) {
+      return 1;
+    }
+    return 0;
+  }
+
+  CachedDictionary<uint32_t>* cache = nullptr;
+  if (5 < argc && std::stoul(argv[5]) != 0) {
+    auto cached_dic = make_unique<CachedDictionary<uint32_t>>(std::move(dic), std::stoul(argv[5]));
+    cache = cached_dic.get();
+    dic = std::move(cached_dic);
+  }
+
   StopWatch sw;
 
   for (int r = 0; r < N; ++r) {
-    for (size_t i = 0; i < keys.size(); ++i) {
-      if (dic->search_key(keys[i].c_str()) == NOT_FOUND) {
-        std::cerr << "failed to search " << keys[i] << std::endl;
+    for (auto query : queries) {
+      if (dic->search_key(query) == NOT_FOUND) {
+        std::cerr << "failed to search " << query << std::endl;
         return 1;
       }
     }
   }
 
-  std::cout << "- search time: " << sw(Times::micro) / keys.size() / N
+  std::cout << "- search time: " << sw(Times::micro) / queries.size() / N
             << " us / key (on " << N << " runs)" << std::endl;
 
+  if (cache != nullptr) {
+    std::cout << "- cache hit rate   : " << double(cache->num_hits()) / cache->num_lookups()
+              << std::endl;
+    std::cout << "- cache size       : " << cache->cache_size_in_bytes() << std::endl;
+  }
+
   return 0;
 }
 
@@ -380,19 +668,33 @@ int run_rearrangement(int argc, const char* argv[]) {
     std::cout << "using pack()" << std::endl;
   } else if (rear_mode == '2') {
     std::cout << "using rebuild()" << std::endl;
+  } else if (rear_mode == '3') {
+    std::cout << "using rebuild() with suffix sharing in TAIL" << std::endl;
+    dic->set_shared_tail(true);
+  } else if (rear_mode == '4') {
+    std::cout << "using rebuild() in BFS order" << std::endl;
+    dic->set_layout(Layout::BFS);
+  } else if (rear_mode == '5') {
+    std::cout << "using rebuild() in van Emde Boas order" << std::endl;
+    dic->set_layout(Layout::VEB);
+  } else if (rear_mode == '6') {
+    std::cout << "using rebuild() with compressed edges" << std::endl;
+    dic->set_edge_compression(true);
   } else {
     show_usage(std::cerr);
     return 1;
   }
 
   {
+    HeapWatch hw;
     StopWatch sw;
     if (rear_mode == '1') {
       dic->pack();
     } else {
-      dic->rebuild();
+      dic->rebuild(); // the TAIL is shared during rebuild() in mode 3
     }
     std::cout << "- rearrangement time: " << sw(Times::sec) << " sec" << std::endl;
+    hw.show(std::cout);
   }
 
   show_stat(std::cout, dic, false);
@@ -472,6 +774,304 @@ int generate_keys(int argc, const char* argv[]) {
   return 0;
 }
 
+int analyze_prefixes(int argc, const char* argv[]) {
+  std::cout << "analyze prefixes" << std::endl;
+
+  if (argc < 4) {
+    show_usage(std::cerr);
+    return 1;
+  }
+
+  auto max_keys = std::stoul(argv[3]);
+  auto max_samples = argc < 5 ? size_t{1} << 16 : std::stoul(argv[4]);
+  if (max_keys == 0 || max_samples == 0) {
+    show_usage(std::cerr);
+    return 1;
+  }
+
+  PrefixAnalyzer analyzer{max_keys, max_samples};
+  if (create_dic(get_ext(argv[2]))) {
+    auto dic = read_dic(argv[2]);
+    if (!dic) {
+      return 1;
+    }
+    analyzer.add_keys(*dic);
+  } else {
+    KeyReader reader{argv[2]};
+    if (!reader.is_ready()) {
+      std::cerr << "failed to open " << argv[2] << std::endl;
+      return 1;
+    }
+    while (auto key = reader.next()) {
+      analyzer.add_key(key);
+    }
+  }
+
+  StopWatch sw;
+  analyzer.analyze();
+  std::cout << "- analysis time   : " << sw(Times::milli) << " ms" << std::endl;
+
+  auto& sizes = analyzer.subtrie_sizes();
+  auto prefixes = analyzer.prefixes();
+
+  std::cout << "- num keys        : " << analyzer.num_keys() << std::endl;
+  std::cout << "- num samples     : " << analyzer.num_samples() << std::endl;
+  std::cout << "- num prefixes    : " << prefixes.size() << std::endl;
+  std::cout << "- num subtries    : " << sizes.size() << std::endl;
+  std::cout << "- num terminals   : " << analyzer.num_terminals() << std::endl;
+  if (!sizes.empty()) {
+    auto sum = std::accumulate(sizes.begin(), sizes.end(), size_t{0});
+    std::cout << "- max subtrie     : " << sizes.front() << std::endl;
+    std::cout << "- ave subtrie     : " << double(sum) / sizes.size() << std::endl;
+    std::cout << "- min subtrie     : " << sizes.back() << std::endl;
+  }
+
+  std::cout << "- subtrie sizes   :" << std::endl; // in powers of two
+  size_t bound = 1;
+  for (auto it = sizes.rbegin(); it != sizes.rend();) {
+    size_t num = 0;
+    for (; it != sizes.rend() && *it <= bound; ++it) {
+      ++num;
+    }
+    if (num != 0) {
+      std::cout << "    <= " << std::setw(10) << std::left << bound << ": " << num << std::endl;
+    }
+    bound *= 2;
+  }
+
+  std::cout << "- prefixes        :";
+  for (auto prefix : prefixes) {
+    std::cout << " " << prefix;
+  }
+  std::cout << std::endl;
+
+  return 0;
+}
+
+int trace_locality(int argc, const char* argv[]) {
+  std::cout << "trace locality" << std::endl;
+
+  if (argc < 4) {
+    show_usage(std::cerr);
+    return 1;
+  }
+
+  std::vector<std::string> keys;
+  {
+    KeyReader reader{argv[3]};
+    if (!reader.is_ready()) {
+      std::cerr << "failed to open " << argv[3] << std::endl;
+      return 1;
+    }
+    while (auto key = reader.next()) {
+      keys.push_back(key);
+    }
+  }
+
+  const std::pair<const char*, Layout> layouts[] = {
+    {"as read", Layout::DFS}, {"DFS", Layout::DFS}, {"BFS", Layout::BFS}, {"VEB", Layout::VEB}
+  };
+
+  for (auto& layout : layouts) {
+    auto dic = read_dic(argv[2]);
+    if (!dic) {
+      return 1;
+    }
+    std::cout << layout.first << std::endl;
+
+    if (&layout != layouts) {
+      dic->set_layout(layout.second);
+      StopWatch sw;
+      dic->rebuild();
+      std::cout << "- rebuild time : " << sw(Times::sec) << " sec" << std::endl;
+    }
+
+    size_t num_lines = 0, num_pages = 0;
+    AccessTrace trace;
+    std::vector<uintptr_t> lines, pages;
+    for (auto& key : keys) {
+      trace.clear();
+      dic->trace_key(key.c_str(), trace);
+      lines.clear();
+      pages.clear();
+      for (auto& range : trace) {
+        auto begin = reinterpret_cast<uintptr_t>(range.first);
+        auto end = begin + range.second;
+        for (auto line = begin / 64; line <= (end - 1) / 64; ++line) {
+          lines.push_back(line);
+        }
+        for (auto page = begin / 4096; page <= (end - 1) / 4096; ++page) {
+          pages.push_back(page);
+        }
+      }
+      std::sort(lines.begin(), lines.end());
+      std::sort(pages.begin(), pages.end());
+      num_lines += std::unique(lines.begin(), lines.end()) - lines.begin();
+      num_pages += std::unique(pages.begin(), pages.end()) - pages.begin();
+    }
+
+    StopWatch sw;
+    for (auto& key : keys) {
+      if (dic->search_key(key.c_str()) == NOT_FOUND) {
+        std::cerr << "failed to search " << key << std::endl;
+        return 1;
+      }
+    }
+    std::cout << "- search time  : " << sw(Times::micro) / keys.size() << " us / key" << std::endl;
+    std::cout << "- cache lines  : " << double(num_lines) / keys.size() << " / key" << std::endl;
+    std::cout << "- pages        : " << double(num_pages) / keys.size() << " / key" << std::endl;
+  }
+
+  return 0;
+}
+
+template<class T>
+std::unique_ptr<Dictionary> read_mlt(const std::string& dic_name, uint32_t num_threads) {
+  std::ifstream ifs{dic_name};
+  auto fd = ::open(dic_name.c_str(), O_RDONLY);
+  if (!ifs || fd == -1) {
+    std::cerr << "failed to open " << dic_name << std::endl;
+    if (fd != -1) {
+      ::close(fd);
+    }
+    return nullptr;
+  }
+  auto dic = make_unique<T>(ifs, PreadReader{fd}, num_threads);
+  ::close(fd);
+  if (!ifs) {
+    std::cerr << "failed to read " << dic_name << std::endl;
+    return nullptr;
+  }
+  return std::move(dic);
+}
+
+std::unique_ptr<Dictionary> read_mlt(const std::string& dic_name, uint32_t num_threads) {
+  auto dic_type = get_ext(dic_name);
+  if (dic_type == "MLT") {
+    return read_mlt<DictionaryMLT<false, false>>(dic_name, num_threads);
+  } else if (dic_type == "MLT_NL") {
+    return read_mlt<DictionaryMLT<false, true>>(dic_name, num_threads);
+  } else if (dic_type == "MLT_BL") {
+    return read_mlt<DictionaryMLT<true, false>>(dic_name, num_threads);
+  } else if (dic_type == "MLT_NL_BL") {
+    return read_mlt<DictionaryMLT<true, true>>(dic_name, num_threads);
+  } else if (dic_type == "MLT_BL_W") {
+    return read_mlt<DictionaryMLT<true, false, true>>(dic_name, num_threads);
+  } else if (dic_type == "MLT_SET") {
+    return read_mlt<DictionaryMLT<false, false, false, void>>(dic_name, num_threads);
+  }
+
+  std::cerr << "invalid extension " << dic_type << std::endl;
+  return nullptr;
+}
+
+void evict_file(const std::string& file_name) { // from the page cache
+  auto fd = ::open(file_name.c_str(), O_RDONLY);
+  if (fd != -1) {
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+  }
+}
+
+int measure_reading(int argc, const char* argv[]) {
+  std::cout << "measure reading" << std::endl;
+
+  if (argc < 4 || std::stoul(argv[3]) == 0) {
+    show_usage(std::cerr);
+    return 1;
+  }
+
+  const std::string dic_name{argv[2]};
+  const auto max_threads = static_cast<uint32_t>(std::stoul(argv[3]));
+  std::cout << "read dic from " << dic_name << std::endl;
+
+  size_t num_keys = 0;
+  for (uint32_t num_threads = 1;; num_threads *= 2) {
+    num_threads = std::min(num_threads, max_threads);
+    for (auto is_cold : {true, false}) {
+      if (is_cold) {
+        evict_file(dic_name);
+      }
+      StopWatch sw;
+      auto dic = read_mlt(dic_name, num_threads);
+      auto time = sw(Times::milli);
+      if (!dic) {
+        return 1;
+      }
+      Stat stat{};
+      dic->stat(stat);
+      if (num_keys != 0 && num_keys != stat.num_keys) {
+        std::cerr << "failed to read the same keys" << std::endl;
+        return 1;
+      }
+      num_keys = stat.num_keys;
+      std::cout << "- " << std::setw(3) << num_threads << " threads, " << (is_cold ? "cold" : "warm")
+                << " : " << time << " ms" << std::endl;
+    }
+    if (num_threads == max_threads) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+int run_compression(int argc, const char* argv[]) {
+  std::cout << "run compression" << std::endl;
+
+  if (argc < 4) {
+    show_usage(std::cerr);
+    return 1;
+  }
+
+  auto dic = read_dic(argv[2]);
+  if (!dic) {
+    return 1;
+  }
+  Stat stat{};
+  dic->stat(stat);
+  dic->set_edge_compression(true); // smaller archives
+
+  std::string dic_name{argv[3]};
+  dic_name += ".";
+  dic_name += get_ext(argv[2]);
+
+  {
+    std::ofstream ofs{dic_name};
+    if (!ofs) {
+      std::cerr << "failed to open " << dic_name << std::endl;
+      return 1;
+    }
+    StopWatch sw;
+    dic->write_compressed(ofs);
+    ofs.flush();
+    std::cout << "- write time     : " << sw(Times::milli) << " ms" << std::endl;
+  }
+  std::cout << "write dic to " << dic_name << std::endl;
+
+  std::ifstream ifs{dic_name};
+  auto file_size = static_cast<size_t>(ifs.seekg(0, std::ios::end).tellg());
+  std::cout << "- file size      : " << stat.size_in_bytes / (1024.0 * 1024.0) << " MiB -> "
+            << file_size / (1024.0 * 1024.0) << " MiB" << std::endl;
+  std::cout << "- ratio          : " << double(file_size) / stat.size_in_bytes << std::endl;
+
+  StopWatch sw;
+  auto new_dic = read_dic(dic_name);
+  auto time = sw(Times::milli);
+  if (!new_dic) {
+    return 1;
+  }
+  Stat new_stat{};
+  new_dic->stat(new_stat);
+  if (new_stat.num_keys != stat.num_keys) {
+    std::cerr << "failed to read the same keys" << std::endl;
+    return 1;
+  }
+  std::cout << "- read time      : " << time << " ms" << std::endl;
+
+  return 0;
+}
+
 } // namespace
 
 int main(int argc, const char* argv[]) {
@@ -491,6 +1091,14 @@ int main(int argc, const char* argv[]) {
       return run_rearrangement(argc, argv);
     case '5':
       return generate_keys(argc, argv);
+    case '6':
+      return analyze_prefixes(argc, argv);
+    case '7':
+      return trace_locality(argc, argv);
+    case '8':
+      return measure_reading(argc, argv);
+    case '9':
+      return run_compression(argc, argv);
     default:
       show_usage(std::cerr);
       break;
@@ -2,10 +2,25 @@
 
 #include <cassert>
 #include <iostream>
+#include <numeric>
 #include <random>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <DictionarySGL.hpp>
 #include <DictionaryMLT.hpp>
+#include <CachedDictionary.hpp>
+#include <DeltaChain.hpp>
+#include <LoggedDictionary.hpp>
+#include <PreadReader.hpp>
+#include <PrefixAnalyzer.hpp>
+#include <ReplicatedDictionary.hpp>
+#include <SharedDictionary.hpp>
+#include <SnapshotWriter.hpp>
 
 using namespace ddd;
 
@@ -52,6 +67,81 @@ void make_prefixes(std::vector<std::string>& prefixes) {
   }
 }
 
+// A dictionary of only what every dictionary implements, for the defaults of
+// BasicDictionary
+class PlainDictionary : public Dictionary {
+public:
+  PlainDictionary() {}
+  explicit PlainDictionary(std::istream& is) : dic_{is} {}
+
+  std::string name() const {
+    return "Plain";
+  }
+
+  uint32_t search_key(const char* key) const {
+    return dic_.search_key(key);
+  }
+  bool insert_key(const char* key, uint32_t value) {
+    return dic_.insert_key(key, value);
+  }
+  uint32_t delete_key(const char* key) {
+    return dic_.delete_key(key);
+  }
+  void enumerate(std::vector<KvPair>& kvs) const {
+    dic_.enumerate(kvs);
+  }
+
+  void pack() {
+    dic_.pack();
+  }
+  void rebuild() {
+    dic_.rebuild();
+  }
+  void shrink() {
+    dic_.shrink();
+  }
+
+  void stat(Stat& ret) const {
+    dic_.stat(ret);
+  }
+  double ratio_singles() const {
+    return dic_.ratio_singles();
+  }
+
+  void write(std::ostream& os) const {
+    dic_.write(os);
+  }
+
+private:
+  DictionarySGL<false, false> dic_;
+};
+
+// writes dic to file_name, checking the file size against the stat, and reads it back
+template <typename T>
+std::unique_ptr<T> write_and_read(const std::unique_ptr<T>& dic, const char* file_name) {
+  {
+    std::ofstream ofs{file_name};
+    dic->write(ofs);
+  }
+  {
+    std::ifstream ifs{file_name};
+    auto size = static_cast<size_t>(ifs.seekg(0, std::ios::end).tellg());
+    Stat stat{};
+    dic->stat(stat);
+    assert(stat.size_in_bytes == size);
+  }
+  { // the same bytes to a stream that cannot seek back over the table
+    std::string bytes;
+    utils::StringOutputBuf buf(&bytes);
+    std::ostream os(&buf);
+    dic->write(os);
+    std::ifstream ifs{file_name};
+    assert(bytes == std::string(std::istreambuf_iterator<char>(ifs), {}));
+  }
+  std::ifstream ifs{file_name};
+  return make_unique<T>(ifs);
+}
+
 template <typename T>
 void test(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
   for (auto &kv : kvs) {
@@ -87,17 +177,20 @@ void test(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
   }
 
   const char* file_name = "test.index";
-  {
-    std::ofstream ofs{file_name};
-    dic->write(ofs);
-  }
+  dic = write_and_read(dic, file_name);
+
+  dic->pack();
 
+  for (auto kv : test_kvs[0]) {
+    assert(dic->search_key(kv->key.c_str()) == NOT_FOUND);
+  }
+  for (auto kv : test_kvs[1]) {
+    assert(dic->search_key(kv->key.c_str()) == kv->value);
+  }
   {
-    std::ifstream ifs{file_name};
-    auto size = static_cast<size_t>(ifs.seekg(0, std::ios::end).tellg());
     Stat stat{};
     dic->stat(stat);
-    assert(stat.size_in_bytes == size);
+    assert(stat.num_keys == test_kvs[1].size());
   }
 
   {
@@ -105,7 +198,7 @@ void test(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
     dic = make_unique<T>(ifs);
   }
 
-  dic->pack();
+  dic->rebuild();
 
   for (auto kv : test_kvs[0]) {
     assert(dic->search_key(kv->key.c_str()) == NOT_FOUND);
@@ -118,25 +211,803 @@ void test(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
     dic->stat(stat);
     assert(stat.num_keys == test_kvs[1].size());
   }
+}
+
+template <typename T>
+void test_tail_reuse(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
+  for (auto &kv : kvs) {
+    assert(dic->insert_key(kv.key.c_str(), kv.value));
+  }
 
+  Stat orig_stat{};
+  dic->stat(orig_stat);
+
+  for (size_t round = 0; round < 4; ++round) { // churn on every other key
+    for (size_t i = round % 2; i < kvs.size(); i += 2) {
+      assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+    for (size_t i = round % 2; i < kvs.size(); i += 2) {
+      assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+  }
+  for (auto &kv : kvs) {
+    assert(dic->search_key(kv.key.c_str()) == kv.value);
+  }
+
+  Stat stat{};
+  dic->stat(stat);
+  assert(stat.tail_size <= orig_stat.tail_size + orig_stat.tail_size / 4);
+  assert(stat.tail_emps <= stat.tail_size);
+
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  Stat deleted_stat{};
+  dic->stat(deleted_stat);
+  dic = write_and_read(dic, "test.index"); // the holes are remade from the entries
+  Stat read_stat{};
+  dic->stat(read_stat);
+  assert(0 < read_stat.tail_holes && read_stat.tail_holes == deleted_stat.tail_holes);
+  assert(read_stat.tail_holes * 2 * sizeof(TailHole<false>) <= read_stat.hole_size);
+  assert(read_stat.tail_emps == deleted_stat.tail_emps);
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  dic->stat(stat);
+  assert(stat.tail_size <= deleted_stat.tail_size + deleted_stat.tail_size / 4);
+}
+
+template <typename T>
+void test_subtrie_reuse(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
+  for (auto &kv : kvs) {
+    assert(dic->insert_key(kv.key.c_str(), kv.value));
+  }
+
+  Stat orig_stat{};
+  dic->stat(orig_stat);
+
+  auto is_churned = [](const KvPair& kv) { // empties the subtries of half the first chars
+    return kv.key[0] < 'N';
+  };
+  for (size_t round = 0; round < 3; ++round) {
+    for (auto &kv : kvs) {
+      if (is_churned(kv)) {
+        assert(dic->delete_key(kv.key.c_str()) == kv.value);
+      }
+    }
+    {
+      Stat stat{};
+      dic->stat(stat);
+      assert(stat.num_tries < orig_stat.num_tries);
+    }
+
+    auto read_dic = write_and_read(dic, "test.index");
+    if (round == 1) { // restarts with the emptied slots not made yet
+      dic = std::move(read_dic);
+    }
+
+    for (auto &kv : kvs) {
+      if (is_churned(kv)) {
+        assert(dic->insert_key(kv.key.c_str(), kv.value));
+      }
+    }
+  }
+  for (auto &kv : kvs) {
+    assert(dic->search_key(kv.key.c_str()) == kv.value);
+  }
+
+  Stat stat{};
+  dic->stat(stat);
+  assert(stat.num_tries == orig_stat.num_tries);
+}
+
+template <typename T>
+void test_shared_tail(std::vector<KvPair> kvs, std::unique_ptr<T> dic) {
+  for (auto &kv : kvs) { // with a common extension
+    kv.key += ".html";
+  }
+  for (auto &kv : kvs) {
+    assert(dic->insert_key(kv.key.c_str(), kv.value));
+  }
+  dic->set_shared_tail(true);
+  for (auto &kv : kvs) {
+    assert(dic->search_key(kv.key.c_str()) == kv.value);
+  }
+
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
   {
-    std::ifstream ifs{file_name};
-    dic = make_unique<T>(ifs);
+    Stat stat{};
+    dic->stat(stat);
+    assert(0 < stat.tail_emps && stat.tail_emps <= stat.tail_size);
+  }
+  for (size_t i = 0; i < kvs.size(); i += 4) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    auto value = (i % 2 == 1 || i % 4 == 0) ? kvs[i].value : NOT_FOUND;
+    assert(dic->search_key(kvs[i].key.c_str()) == value);
   }
 
   dic->rebuild();
+  {
+    Stat stat{};
+    dic->stat(stat);
+    assert(0 < stat.tail_saved);
+  }
+
+  dic = write_and_read(dic, "test.index");
+
+  dic->set_shared_tail(false);
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    auto value = (i % 2 == 1 || i % 4 == 0) ? kvs[i].value : NOT_FOUND;
+    assert(dic->search_key(kvs[i].key.c_str()) == value);
+  }
+}
+
+template <typename T>
+void test_inlines(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
+  auto check_leaves = [&](size_t num_keys) {
+    LeafStat stat{};
+    dic->leaf_stat(stat);
+    assert(stat.num_terminals + stat.num_inlines + stat.num_tails == num_keys);
+    assert(0 < stat.num_inlines);
+  };
+
+  for (auto& kv : kvs) {
+    assert(dic->insert_key(kv.key.c_str(), kv.value));
+  }
+  check_leaves(kvs.size());
+
+  for (size_t i = 0; i < kvs.size(); i += 2) { // folding chains into suffixes
+    assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    assert(dic->search_key(kvs[i].key.c_str()) == (i % 2 == 0 ? NOT_FOUND : kvs[i].value));
+  }
+  check_leaves(kvs.size() / 2);
+
+  dic->rebuild();
+  for (size_t i = 1; i < kvs.size(); i += 2) {
+    assert(dic->search_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  check_leaves(kvs.size() / 2);
+}
+
+template <typename T, typename F>
+void test_values(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic, F value_of) {
+  for (auto& kv : kvs) {
+    assert(dic->insert_key(kv.key.c_str(), value_of(kv.value)));
+  }
+  for (auto& kv : kvs) {
+    assert(dic->search_key(kv.key.c_str()) == value_of(kv.value));
+  }
+  {
+    std::vector<typename T::KvPair> ret;
+    dic->enumerate(ret);
+    assert(kvs.size() == ret.size());
+    for (auto& kv : ret) {
+      assert(dic->search_key(kv.key.c_str()) == kv.value);
+    }
+  }
+
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    assert(dic->delete_key(kvs[i].key.c_str()) == value_of(kvs[i].value));
+  }
+
+  dic = write_and_read(dic, "test.index");
+
+  dic->set_shared_tail(true);
+  dic->rebuild();
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    auto value = i % 2 == 1 ? value_of(kvs[i].value) : T::VTraits::NOT_FOUND;
+    assert(dic->search_key(kvs[i].key.c_str()) == value);
+  }
+}
+
+template <typename T>
+void test_long_edges(std::vector<KvPair> kvs, std::unique_ptr<T> dic) {
+  for (auto& kv : kvs) { // chains longer than a compressed edge
+    kv.key.insert(0, kv.value % 3 * 200, '/');
+  }
+
+  std::vector<const KvPair*> test_kvs[2];
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    test_kvs[i % 2].push_back(&kvs[i]);
+  }
 
+  for (auto kv : test_kvs[0]) {
+    assert(dic->insert_key(kv->key.c_str(), kv->value));
+  }
+  dic->set_edge_compression(true);
+  dic->rebuild();
+  for (auto kv : test_kvs[1]) { // splitting the collapsed chains
+    assert(dic->insert_key(kv->key.c_str(), kv->value));
+  }
+  for (auto& kv : kvs) {
+    assert(dic->search_key(kv.key.c_str()) == kv.value);
+  }
+  {
+    Stat stat{};
+    dic->stat(stat);
+    assert(0 < stat.label_size);
+  }
+
+  for (auto kv : test_kvs[0]) {
+    assert(dic->delete_key(kv->key.c_str()) == kv->value);
+  }
+  dic->rebuild();
   for (auto kv : test_kvs[0]) {
     assert(dic->search_key(kv->key.c_str()) == NOT_FOUND);
   }
   for (auto kv : test_kvs[1]) {
     assert(dic->search_key(kv->key.c_str()) == kv->value);
   }
+  {
+    std::vector<KvPair> ret;
+    dic->enumerate(ret);
+    assert(test_kvs[1].size() == ret.size());
+  }
+
+  dic->set_edge_compression(false);
+  dic->rebuild(); // expanding the edges again
   {
     Stat stat{};
     dic->stat(stat);
-    assert(stat.num_keys == test_kvs[1].size());
+    assert(stat.label_size == 0);
+  }
+  for (auto kv : test_kvs[1]) {
+    assert(dic->search_key(kv->key.c_str()) == kv->value);
+  }
+}
+
+// the BC positions of the nodes that searching key visits in trie
+template <typename T>
+std::vector<size_t> trace_nodes(const T& trie, const std::string& key) {
+  typename T::Query query(key.c_str());
+  AccessTrace trace;
+  trie.trace_key(query, trace);
+  auto root = static_cast<const char*>(trace[0].first); // the first unit of BC
+  auto unit_size = trace[0].second;
+  std::vector<size_t> ret;
+  for (auto& range : trace) {
+    auto ptr = static_cast<const char*>(range.first);
+    if (root <= ptr && ptr < root + trie.bc_size() * unit_size) {
+      ret.push_back(static_cast<size_t>(ptr - root) / unit_size);
+    }
+  }
+  return ret;
+}
+
+template <typename T>
+void test_hot_layout(const std::vector<KvPair>& kvs) {
+  using Query = typename T::Query;
+  for (size_t h = 0; h < 16; ++h) { // a hot key each, whose nodes the later inserts move
+    T trie;
+    size_t num_counted = 0; // nodes of the hot key, while later inserts only go deeper
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      if (i == kvs.size() / 16) {
+        trie.set_profiling(1);
+        for (size_t round = 0; round < 100; ++round) {
+          Query query(kvs[h].key.c_str());
+          assert(trie.search_key(query));
+        }
+        num_counted = trace_nodes(trie, kvs[h].key).size();
+      }
+      Query query(kvs[i].key.c_str());
+      query.set_value(kvs[i].value);
+      assert(trie.insert_key(query));
+    }
+    trie.rebuild();
+
+    auto nodes = trace_nodes(trie, kvs[h].key);
+    assert(num_counted <= nodes.size());
+    for (size_t i = 0; i < num_counted; ++i) { // laid out first, next to the root
+      assert(nodes[i] < BLOCK_SIZE);
+    }
+  }
+}
+
+template <typename T>
+void test_frozen(const std::vector<KvPair>& kvs) {
+  using Query = typename T::Query;
+  T trie;
+  trie.set_edge_compression(true);
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    Query query(kvs[i].key.c_str());
+    query.set_value(kvs[i].value);
+    assert(trie.insert_key(query));
+  }
+
+  typename T::FrozenType frozen;
+  trie.freeze(frozen);
+  assert(frozen.num_nodes() <= trie.num_nodes());
+  assert(frozen.size_in_bytes() < trie.size_in_bytes());
+  {
+    std::vector<typename T::KvPair> ret, frozen_ret;
+    trie.enumerate(ROOT_POS, "", ret);
+    frozen.enumerate(ROOT_POS, "", frozen_ret);
+    std::sort(ret.begin(), ret.end());
+    std::sort(frozen_ret.begin(), frozen_ret.end());
+    assert(ret == frozen_ret);
+  }
+
+  std::stringstream ss;
+  frozen.write(ss);
+  assert(ss.str().size() == frozen.size_in_bytes());
+  typename T::FrozenType read_frozen(ss);
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    Query query(kvs[i].key.c_str());
+    assert(read_frozen.search_key(query) == (i % 2 == 0));
+    assert(i % 2 != 0 || query.value() == kvs[i].value);
+  }
+
+  T thawed;
+  thawed.thaw(read_frozen);
+  for (size_t i = 1; i < kvs.size(); i += 2) {
+    Query query(kvs[i].key.c_str());
+    query.set_value(kvs[i].value);
+    assert(thawed.insert_key(query));
+  }
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    Query query(kvs[i].key.c_str());
+    assert(thawed.search_key(query) && query.value() == kvs[i].value);
+  }
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    Query query(kvs[i].key.c_str());
+    assert(thawed.delete_key(query));
+  }
+}
+
+template <typename T>
+void test_frozen_prefix(const std::vector<KvPair>& kvs, const std::vector<const char*>& prefixes) {
+  using Query = typename T::Query;
+  T trie(prefixes);
+  for (size_t i = 0; i < 64; ++i) { // with terminals and suffix links
+    auto key = kvs[i].key.substr(0, 1 + i % 4);
+    Query query(key.c_str());
+    if (!trie.search_prefix(query)) {
+      query.set_value(kvs[i].value);
+      trie.insert_prefix_leaf(query);
+    }
+  }
+
+  typename T::FrozenType frozen;
+  trie.freeze(frozen);
+  T thawed;
+  thawed.thaw(frozen);
+  for (auto& kv : kvs) {
+    Query query(kv.key.c_str()), frozen_query(kv.key.c_str()), thawed_query(kv.key.c_str());
+    auto found = trie.search_prefix(query);
+    assert(frozen.search_prefix(frozen_query) == found);
+    assert(thawed.search_prefix(thawed_query) == found);
+    assert(frozen_query.key() == query.key() && thawed_query.key() == query.key());
+    assert(!found || (frozen_query.value() == query.value() && thawed_query.value() == query.value()));
+  }
+
+  std::vector<typename T::KvPair> ret, frozen_ret, thawed_ret;
+  std::vector<bool> terminals, frozen_terminals, thawed_terminals;
+  trie.enumerate_prefix(ROOT_POS, "", ret, terminals);
+  frozen.enumerate_prefix(ROOT_POS, "", frozen_ret, frozen_terminals);
+  thawed.enumerate_prefix(ROOT_POS, "", thawed_ret, thawed_terminals);
+  assert(!ret.empty() && ret == frozen_ret && ret == thawed_ret);
+  assert(terminals == frozen_terminals && terminals == thawed_terminals);
+}
+
+// The files in fixtures/ were written by DictionarySGL<true, false> and by
+// DictionaryMLT<false, true> with the prefixes "legacy/1" and "legacy/3" of
+// the first release, before the container, for these keys but the deleted
+template <typename T>
+void test_legacy(const char* file_name) {
+  std::vector<KvPair> kvs;
+  for (uint32_t i = 0; i < 300; ++i) {
+    kvs.push_back(KvPair{"legacy/" + std::to_string(i % 4) + "/" + std::to_string(i * i % 9973)
+                         + "/key" + std::to_string(i), i});
+  }
+  auto is_deleted = [](uint32_t i) {
+    return i % 3 == 0 || i % 4 == 3;
+  };
+
+  std::ifstream ifs{std::string{DDD_FIXTURE_DIR} + "/" + file_name};
+  auto dic = make_unique<T>(ifs);
+  assert(!ifs.fail());
+  Stat stat{};
+  dic->stat(stat);
+  assert(0 < stat.tail_holes && stat.tail_emps <= stat.tail_size);
+  size_t num_keys = 0;
+  for (uint32_t i = 0; i < kvs.size(); ++i) {
+    assert(dic->search_key(kvs[i].key.c_str()) == (is_deleted(i) ? NOT_FOUND : kvs[i].value));
+    num_keys += !is_deleted(i);
+  }
+  assert(stat.num_keys == num_keys);
+
+  for (uint32_t i = 0; i < kvs.size(); ++i) { // and updated as ever
+    if (is_deleted(i)) {
+      assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+    } else if (i % 2 == 0) {
+      assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+  }
+  dic = write_and_read(dic, "test.index");
+  for (uint32_t i = 0; i < kvs.size(); ++i) {
+    auto is_kept = is_deleted(i) || i % 2 == 1;
+    assert(dic->search_key(kvs[i].key.c_str()) == (is_kept ? kvs[i].value : NOT_FOUND));
+  }
+}
+
+template <typename T>
+void test_snapshot(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
+  const auto half = kvs.size() / 2;
+  for (size_t i = 0; i < half; ++i) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  std::string file;
+  {
+    std::stringstream ss;
+    dic->write(ss);
+    file = ss.str();
+  }
+
+  const char* file_name = "test.index";
+  SnapshotWriter writer;
+  writer.start(*dic, file_name);
+  for (size_t i = half; i < kvs.size(); ++i) { // while writing
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  for (size_t i = 0; i < half; i += 2) {
+    assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  assert(writer.wait());
+
+  std::ifstream ifs{file_name};
+  std::string snapshot_file{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+  assert(snapshot_file == file);
+  ifs.clear();
+  ifs.seekg(0);
+  T snapshot_dic(ifs);
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    assert(snapshot_dic.search_key(kvs[i].key.c_str()) == (i < half ? kvs[i].value : NOT_FOUND));
+  }
+}
+
+template <typename T>
+void test_compressed(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
+  for (auto& kv : kvs) {
+    assert(dic->insert_key(kv.key.c_str(), kv.value));
+  }
+  for (size_t i = 0; i < kvs.size(); i += 3) {
+    assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  std::stringstream ss, compressed_ss;
+  dic->write(ss);
+  dic->set_edge_compression(true);
+  dic->write_compressed(compressed_ss);
+  const auto file = compressed_ss.str();
+  assert(file.size() < ss.str().size());
+
+  const auto not_found = T::VTraits::NOT_FOUND;
+  T new_dic(compressed_ss);
+  assert(!compressed_ss.fail());
+  Stat stat{}, new_stat{};
+  dic->stat(stat);
+  new_dic.stat(new_stat);
+  assert(new_stat.num_keys == stat.num_keys);
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    assert(new_dic.search_key(kvs[i].key.c_str()) == (i % 3 == 0 ? not_found : kvs[i].value));
+  }
+  for (size_t i = 0; i < kvs.size(); i += 3) { // still updatable
+    assert(new_dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  for (size_t i = 1; i < kvs.size(); i += 3) {
+    assert(new_dic.delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    assert(new_dic.search_key(kvs[i].key.c_str()) == (i % 3 == 1 ? not_found : kvs[i].value));
+  }
+
+  auto broken_file = file;
+  broken_file[broken_file.size() / 2] ^= 1;
+  std::stringstream broken_ss(broken_file);
+  T broken_dic(broken_ss);
+  assert(broken_ss.fail());
+}
+
+template <typename T>
+void test_deltas(const std::vector<KvPair>& kvs, std::unique_ptr<T> dic) {
+  const char* file_name = "test.index";
+  const std::vector<std::string> delta_names = {"test.delta1", "test.delta2", "test.delta3"};
+  const auto third = kvs.size() / 3;
+
+  for (size_t i = 0; i < third; ++i) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  {
+    std::ofstream ofs{file_name};
+    dic->write(ofs);
+  }
+  DeltaBase base;
+  dic->delta_base(base);
+
+  auto write_delta = [&](size_t id) {
+    std::ofstream ofs{delta_names[id]};
+    dic->write_delta(base, ofs);
+  };
+  for (size_t i = third; i < 2 * third; ++i) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  write_delta(0);
+  for (size_t i = 0; i < 2 * third; i += 3) {
+    assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  for (size_t i = 2 * third; i < kvs.size(); ++i) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  write_delta(1);
+  for (size_t i = 0; i < kvs.size() / 2; ++i) { // to empty subtries
+    if (i % 3 != 0 || 2 * third <= i) {
+      assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+  }
+  write_delta(2);
+
+  {
+    std::ifstream ifs{delta_names[0]};
+    auto delta_size = static_cast<size_t>(ifs.seekg(0, std::ios::end).tellg());
+    Stat stat{};
+    dic->stat(stat);
+    assert(delta_size < stat.size_in_bytes);
+  }
+
+  DeltaBase read_base;
+  auto read_dic = read_delta_chain<T>(file_name, delta_names, read_base);
+  assert(read_dic && read_base.digest == base.digest);
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    auto is_kept = kvs.size() / 2 <= i && (i % 3 != 0 || 2 * third <= i);
+    auto value = is_kept ? kvs[i].value : NOT_FOUND;
+    assert(read_dic->search_key(kvs[i].key.c_str()) == value);
+  }
+  for (auto& kv : kvs) { // still dynamic
+    read_dic->insert_key(kv.key.c_str(), kv.value);
+  }
+  for (auto& kv : kvs) {
+    assert(read_dic->search_key(kv.key.c_str()) == kv.value);
+  }
+
+  DeltaBase misordered_base;
+  assert(!read_delta_chain<T>(file_name, {delta_names[0], delta_names[2]}, misordered_base));
+  for (auto& delta_name : delta_names) {
+    std::remove(delta_name.c_str());
+  }
+}
+
+void test_shared(const std::vector<KvPair>& kvs) {
+  const auto name = "/ddd_test." + std::to_string(::getpid());
+  const auto half = kvs.size() / 2;
+  DictionarySGL<true, false> dic;
+  for (size_t i = 0; i < half; ++i) {
+    assert(dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+
+  SharedPublisher<> publisher(name);
+  assert(publisher.is_open());
+  SharedReader<> early_reader(name);
+  assert(early_reader.is_open() && !early_reader.refresh()); // nothing published
+  assert(publisher.publish(dic) && publisher.generation() == 1);
+
+  SharedReader<> reader(name);
+  assert(reader.generation() == 1 && reader.num_keys() == half);
+  for (size_t i = half; i < kvs.size(); ++i) {
+    assert(dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  for (size_t i = 0; i < half; i += 2) {
+    assert(dic.delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  assert(publisher.publish(dic) && publisher.generation() == 2);
+
+  auto pid = ::fork(); // a reader in another process
+  if (pid == 0) {
+    SharedReader<> child_reader(name);
+    auto is_found = child_reader.generation() == 2;
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      auto value = i < half && i % 2 == 0 ? NOT_FOUND : kvs[i].value;
+      is_found = is_found && child_reader.search_key(kvs[i].key.c_str()) == value;
+    }
+    ::_exit(is_found ? 0 : 1);
+  }
+  int status = 0;
+  assert(pid != -1 && ::waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+  for (size_t i = 0; i < kvs.size(); ++i) { // in the unlinked generation until refresh()
+    assert(reader.search_key(kvs[i].key.c_str()) == (i < half ? kvs[i].value : NOT_FOUND));
+  }
+  assert(reader.refresh() && reader.generation() == 2 && early_reader.refresh());
+  for (size_t i = 0; i < kvs.size(); ++i) {
+    auto value = i < half && i % 2 == 0 ? NOT_FOUND : kvs[i].value;
+    assert(reader.search_key(kvs[i].key.c_str()) == value);
+    assert(early_reader.search_key(kvs[i].key.c_str()) == value);
+  }
+
+  {
+    SharedPublisher<> next_publisher(name); // after the last generation
+    assert(next_publisher.generation() == 2);
+  }
+  publisher.unlink();
+  SharedReader<> late_reader(name);
+  assert(!late_reader.is_open() && !late_reader.refresh());
+  assert(reader.search_key(kvs[1].key.c_str()) == kvs[1].value);
+}
+
+void test_replicated(const std::vector<KvPair>& kvs) {
+  {
+    std::vector<uint32_t> cpus;
+    utils::parse_cpulist("0-3,8,10-11", cpus);
+    assert((cpus == std::vector<uint32_t>{0, 1, 2, 3, 8, 10, 11}));
+    std::vector<std::vector<uint32_t>> nodes;
+    utils::numa_nodes(nodes);
+    assert(!nodes.empty());
+  }
+
+  using Dic = DictionarySGL<true, false>;
+  auto read = [](std::istream& is) -> std::unique_ptr<Dictionary> {
+    return make_unique<Dic>(is);
+  };
+  const auto half = kvs.size() / 2;
+  auto dic = make_unique<Dic>();
+  for (size_t i = 0; i < half; ++i) {
+    assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  // two nodes of CPU 0, as a machine may have a node only
+  ReplicatedDictionary<uint32_t> rep_dic{std::move(dic), read, {{0}, {0}}};
+  assert(rep_dic.num_replicas() == 2);
+
+  for (size_t i = half; i < kvs.size(); ++i) {
+    assert(rep_dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+  }
+  assert(!rep_dic.insert_key(kvs[0].key.c_str(), kvs[0].value));
+  for (size_t i = 0; i < kvs.size(); i += 2) {
+    assert(rep_dic.delete_key(kvs[i].key.c_str()) == kvs[i].value);
+  }
+  rep_dic.rebuild();
+
+  auto check = [&](size_t first) { // even keys from first on deleted
+    for (size_t r = 0; r < rep_dic.num_replicas(); ++r) {
+      for (size_t i = 0; i < kvs.size(); ++i) {
+        auto value = (i % 2 == 1 || i < first) ? kvs[i].value : NOT_FOUND;
+        assert(rep_dic.replica(r).search_key(kvs[i].key.c_str()) == value);
+      }
+    }
+  };
+  check(0);
+  {
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&] {
+        for (size_t i = 1; i < kvs.size(); i += 2) {
+          assert(rep_dic.search_key(kvs[i].key.c_str()) == kvs[i].value);
+        }
+      });
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+  }
+
+  // a delta by a copy of the dictionary, which reinserts the first 100 keys
+  DeltaBase base, rep_base;
+  std::stringstream ss;
+  rep_dic.write(ss);
+  Dic copy_dic{ss};
+  copy_dic.delta_base(base);
+  rep_dic.delta_base(rep_base);
+  for (size_t i = 0; i < 100; i += 2) {
+    assert(copy_dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
   }
+  std::stringstream delta;
+  copy_dic.write_delta(base, delta);
+  auto digest = rep_base.digest;
+  std::stringstream cut_delta{delta.str().substr(0, delta.str().size() / 2)};
+  assert(!rep_dic.read_delta(cut_delta, rep_base));
+  assert(rep_base.digest == digest);
+  check(0);
+  assert(rep_dic.read_delta(delta, rep_base));
+  assert(rep_base.digest == base.digest);
+  check(100);
+
+  auto is_replicated = true; // the failure of a worker reaches the caller
+  try {
+    auto read_none = [](std::istream&) { return std::unique_ptr<Dictionary>(); };
+    ReplicatedDictionary<uint32_t> none_dic{make_unique<Dic>(), read_none, {{0}, {0}}};
+  } catch (const std::runtime_error&) {
+    is_replicated = false;
+  }
+  assert(!is_replicated);
+}
+
+// runs func in a forked child, which then ends by _exit() as if crashing,
+// with nothing destroyed or flushed, and checks that func went through
+template <typename F>
+void run_and_crash(F func) {
+  auto pid = ::fork();
+  if (pid == 0) {
+    func();
+    ::_exit(0);
+  }
+  int status = 0;
+  assert(pid != -1 && ::waitpid(pid, &status, 0) == pid);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_log(const std::vector<KvPair>& kvs) {
+  const char* file_name = "test.index";
+  const char* log_name = "test.log";
+  std::remove(log_name);
+  std::remove("test.log.old");
+  const auto half = kvs.size() / 2;
+
+  auto expected = [&](size_t i, size_t num_inserted) -> uint32_t {
+    return i < num_inserted && i % 4 != 0 ? kvs[i].value : NOT_FOUND;
+  };
+  auto recover = [&]() {
+    std::ifstream ifs{file_name};
+    auto dic = make_unique<DictionarySGL<true, false>>(ifs);
+    assert(!ifs.fail());
+    return make_unique<LoggedDictionary<uint32_t>>(std::move(dic), log_name, LogSync::EVERY_GROUP, 16);
+  };
+
+  run_and_crash([&]() {
+    auto dic = make_unique<LoggedDictionary<uint32_t>>(make_unique<DictionarySGL<true, false>>(),
+                                                      log_name, LogSync::EVERY_GROUP, 16);
+    for (size_t i = 0; i < half; ++i) {
+      assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+    dic->checkpoint(file_name);
+    for (size_t i = half; i < kvs.size(); ++i) {
+      assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+    for (size_t i = 0; i < kvs.size(); i += 4) {
+      assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+    assert(dic->wait_checkpoint() && dic->commit());
+  });
+  {
+    std::ofstream ofs{log_name, std::ios::app | std::ios::binary};
+    const char torn[] = {'t', 'o', 'r', 'n', '\xff', '\xff', '\xff', '\x7f', 1}; // with a broken length
+    ofs.write(torn, sizeof(torn)); // by the crash
+  }
+  run_and_crash([&]() {
+    auto dic = recover();
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      assert(dic->search_key(kvs[i].key.c_str()) == expected(i, kvs.size()));
+    }
+    dic->checkpoint("no_dir/test.index"); // fails, keeping the old log
+    assert(!dic->wait_checkpoint());
+    assert(dic->insert_key(kvs[0].key.c_str(), kvs[0].value));
+    dic->checkpoint("no_dir/test.index");
+    assert(!dic->wait_checkpoint());
+    assert(dic->delete_key(kvs[0].key.c_str()) == kvs[0].value);
+    assert(dic->commit());
+  });
+  {
+    auto dic = recover(); // from the first snapshot
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      assert(dic->search_key(kvs[i].key.c_str()) == expected(i, kvs.size()));
+    }
+    dic->checkpoint(file_name);
+    assert(dic->wait_checkpoint());
+  }
+  {
+    std::ifstream ifs{"test.log.old"};
+    assert(!ifs); // removed with the snapshot
+  }
+  {
+    auto dic = recover();
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      assert(dic->search_key(kvs[i].key.c_str()) == expected(i, kvs.size()));
+    }
+  }
+  std::remove(log_name);
 }
 
 } // namespace
@@ -180,5 +1051,551 @@ int main() {
   std::cerr << "-- test for MLT_NL_BL with pre-registered prefixes --" << std::endl;
   test(kvs, make_unique<DictionaryMLT<true, true>>(prefixes));
 
+  std::cerr << "-- test for SGL_NL with wide indices --" << std::endl;
+  test(kvs, make_unique<DictionarySGL<false, true, true>>());
+  std::cerr << "-- test for MLT_BL with wide indices --" << std::endl;
+  test(kvs, make_unique<DictionaryMLT<true, false, true>>(prefixes));
+
+  std::cerr << "-- test for SGL on a pool --" << std::endl;
+  {
+    PoolResource pool;
+    test(kvs, make_unique<DictionarySGL<true, true>>(&pool));
+    assert(0 < pool.num_chunks());
+  }
+
+  auto value64 = [](uint32_t value) -> uint64_t { // half of them do not fit in BC
+    return value % 2 == 0 ? value : (uint64_t{value} << 32 | value);
+  };
+
+  std::cerr << "-- test for subtrie split --" << std::endl;
+  {
+    auto dic = make_unique<DictionaryMLT<true, false>>(prefixes);
+    dic->set_split_threshold(NUM_KEYS / 64);
+    test(kvs, std::move(dic));
+
+    DictionaryMLT<false, true, false, uint64_t> split_dic, whole_dic;
+    split_dic.set_split_threshold(NUM_KEYS / 64);
+    for (auto& kv : kvs) {
+      assert(split_dic.insert_key(kv.key.c_str(), value64(kv.value)));
+      assert(whole_dic.insert_key(kv.key.c_str(), value64(kv.value)));
+    }
+    for (auto& kv : kvs) {
+      assert(split_dic.search_key(kv.key.c_str()) == value64(kv.value));
+    }
+    Stat split_stat{}, whole_stat{};
+    split_dic.stat(split_stat);
+    whole_dic.stat(whole_stat);
+    assert(split_stat.num_keys == kvs.size());
+    assert(whole_stat.num_tries < split_stat.num_tries);
+
+    std::vector<BasicKvPair<uint64_t>> split_kvs, whole_kvs;
+    split_dic.enumerate(split_kvs);
+    whole_dic.enumerate(whole_kvs);
+    std::sort(split_kvs.begin(), split_kvs.end());
+    std::sort(whole_kvs.begin(), whole_kvs.end());
+    assert(split_kvs.size() == whole_kvs.size());
+    for (size_t i = 0; i < split_kvs.size(); ++i) {
+      assert(std::string(split_kvs[i].key.c_str()) == whole_kvs[i].key.c_str());
+      assert(split_kvs[i].value == whole_kvs[i].value);
+    }
+
+    const std::string url = "http://www.example.com/"; // shared by all the keys
+    DictionaryMLT<true, false> url_dic;
+    url_dic.set_split_threshold(NUM_KEYS / 64);
+    assert(url_dic.insert_key(url.c_str(), NUM_KEYS)); // ending in the common prefix
+    for (auto& kv : kvs) {
+      assert(url_dic.insert_key((url + kv.key).c_str(), kv.value));
+    }
+    assert(url_dic.search_key(url.c_str()) == NUM_KEYS);
+    for (auto& kv : kvs) {
+      assert(url_dic.search_key((url + kv.key).c_str()) == kv.value);
+    }
+    Stat url_stat{};
+    url_dic.stat(url_stat);
+    assert(url_stat.num_keys == kvs.size() + 1);
+    assert(whole_stat.num_tries < url_stat.num_tries);
+  }
+
+  std::cerr << "-- test for subtrie merge --" << std::endl;
+  {
+    std::vector<std::string> buf_pairs{"a"}; // without keys
+    for (char c1 = 'A'; c1 <= 'Z'; ++c1) {
+      for (char c2 = 'A'; c2 <= 'Z'; ++c2) {
+        buf_pairs.push_back(std::string{c1, c2});
+      }
+    }
+    std::vector<const char*> pairs;
+    for (auto& pair : buf_pairs) {
+      pairs.push_back(pair.c_str());
+    }
+
+    DictionaryMLT<true, true> dic{pairs};
+    for (auto& kv : kvs) {
+      assert(dic.insert_key(kv.key.c_str(), kv.value));
+    }
+    Stat orig_stat{};
+    dic.stat(orig_stat);
+
+    dic.merge_subtries(NUM_KEYS / 16);
+    for (auto& kv : kvs) {
+      assert(dic.search_key(kv.key.c_str()) == kv.value);
+    }
+    Stat stat{};
+    dic.stat(stat);
+    assert(stat.num_keys == kvs.size());
+    assert(stat.num_tries < orig_stat.num_tries / 8);
+    assert(stat.size_in_bytes < orig_stat.size_in_bytes);
+
+    std::vector<KvPair> ret;
+    dic.enumerate(ret);
+    assert(ret.size() == kvs.size());
+
+    dic.merge_subtries(NUM_KEYS * 16); // into the subtries of the first characters
+    dic.stat(stat);
+    assert(stat.num_tries <= 27);
+    for (auto& kv : kvs) {
+      assert(dic.search_key(kv.key.c_str()) == kv.value);
+    }
+  }
+
+  std::cerr << "-- test for Bloom filters --" << std::endl;
+  {
+    BloomFilter filter;
+    filter.init(kvs.size() / 2, 10);
+    for (size_t i = 0; i < kvs.size(); i += 2) {
+      filter.add(utils::hash(kvs[i].key.c_str()));
+    }
+    size_t num_positives = 0;
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      auto positive = filter.may_contain(utils::hash(kvs[i].key.c_str()));
+      assert(i % 2 == 1 || positive);
+      num_positives += i % 2 == 1 && positive;
+    }
+    assert(num_positives < kvs.size() / 2 / 20); // under 5%
+
+    auto dic = make_unique<DictionaryMLT<true, false>>(prefixes);
+    dic->set_filter_bits(10);
+    test(kvs, std::move(dic));
+
+    DictionaryMLT<false, false> filtered_dic;
+    for (size_t i = 0; i < kvs.size(); i += 2) {
+      assert(filtered_dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+    filtered_dic.set_filter_bits(10); // for existing keys
+    for (size_t i = 1; i < kvs.size(); i += 2) {
+      assert(filtered_dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+    for (size_t i = 0; i < kvs.size(); i += 4) {
+      assert(filtered_dic.delete_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+    filtered_dic.rebuild();
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      auto value = i % 4 == 0 ? NOT_FOUND : kvs[i].value;
+      assert(filtered_dic.search_key(kvs[i].key.c_str()) == value);
+    }
+    Stat stat{};
+    filtered_dic.stat(stat);
+    assert(kvs.size() < stat.filter_size);
+    filtered_dic.set_filter_bits(0);
+    filtered_dic.stat(stat);
+    assert(stat.filter_size == 0);
+  }
+
+  std::cerr << "-- test for cached search --" << std::endl;
+  {
+    CachedDictionary<uint32_t> dic{make_unique<DictionarySGL<true, false>>(), 64};
+    for (size_t i = 0; i < kvs.size(); i += 2) {
+      assert(dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+    for (size_t round = 0; round < 4; ++round) { // a hot set of 32 keys
+      for (size_t i = 0; i < 32; ++i) {
+        auto value = i % 2 == 0 ? kvs[i].value : NOT_FOUND;
+        assert(dic.search_key(kvs[i].key.c_str()) == value);
+      }
+    }
+    assert(0 < dic.num_hits() && dic.num_hits() < dic.num_lookups());
+
+    for (size_t i = 0; i < 32; ++i) { // turns hits into misses and vice versa
+      if (i % 2 == 0) {
+        assert(dic.delete_key(kvs[i].key.c_str()) == kvs[i].value);
+      } else {
+        assert(dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+      }
+    }
+    for (size_t i = 0; i < 32; ++i) {
+      auto value = i % 2 == 1 ? kvs[i].value : NOT_FOUND;
+      assert(dic.search_key(kvs[i].key.c_str()) == value);
+    }
+    for (size_t i = 32; i < kvs.size(); ++i) {
+      auto value = i % 2 == 0 ? kvs[i].value : NOT_FOUND;
+      assert(dic.search_key(kvs[i].key.c_str()) == value);
+    }
+
+    dic.clear_cache();
+    std::vector<std::thread> threads; // on the same hot set
+    for (uint32_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&] {
+        for (size_t round = 0; round < 100; ++round) {
+          for (size_t i = 0; i < 32; ++i) {
+            auto value = i % 2 == 1 ? kvs[i].value : NOT_FOUND;
+            assert(dic.search_key(kvs[i].key.c_str()) == value);
+          }
+        }
+      });
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+    assert(dic.num_lookups() == 4 * 100 * 32 && 0 < dic.num_hits());
+  }
+
+  std::cerr << "-- test for prefix analysis --" << std::endl;
+  {
+    PrefixAnalyzer analyzer{NUM_KEYS / 64, NUM_KEYS}; // samples all the keys
+    for (auto& kv : kvs) {
+      analyzer.add_key(kv.key.c_str());
+    }
+    analyzer.analyze();
+    auto& sizes = analyzer.subtrie_sizes();
+    assert(!analyzer.prefixes().empty());
+    assert(sizes.front() <= NUM_KEYS / 64);
+    assert(std::accumulate(sizes.begin(), sizes.end(), analyzer.num_terminals()) == kvs.size());
+
+    auto dic = make_unique<DictionaryMLT<true, false>>(analyzer.prefixes());
+    for (auto& kv : kvs) {
+      assert(dic->insert_key(kv.key.c_str(), kv.value));
+    }
+    Stat stat{};
+    dic->stat(stat);
+    assert(stat.num_tries == sizes.size() + 1);
+
+    PrefixAnalyzer re_analyzer{NUM_KEYS / 64, NUM_KEYS};
+    re_analyzer.add_keys(*dic);
+    re_analyzer.analyze();
+    assert(re_analyzer.subtrie_sizes() == sizes);
+  }
+
+  std::cerr << "-- test for TAIL reuse --" << std::endl;
+  test_tail_reuse(kvs, make_unique<DictionarySGL<false, false>>());
+  test_tail_reuse(kvs, make_unique<DictionaryMLT<false, false>>());
+
+  std::cerr << "-- test for subtrie reuse --" << std::endl;
+  test_subtrie_reuse(kvs, make_unique<DictionaryMLT<false, false>>());
+  test_subtrie_reuse(kvs, make_unique<DictionaryMLT<true, true>>(prefixes));
+
+  std::cerr << "-- test for shared TAIL --" << std::endl;
+  test_shared_tail(kvs, make_unique<DictionarySGL<false, true>>());
+  test_shared_tail(kvs, make_unique<DictionaryMLT<true, false>>(prefixes));
+
+  std::cerr << "-- test for inlined suffixes --" << std::endl;
+  test_inlines(kvs, make_unique<DictionarySGL<false, true>>());
+  test_inlines(kvs, make_unique<DictionaryMLT<true, false>>(prefixes));
+
+  std::cerr << "-- test for compressed edges --" << std::endl;
+  test_long_edges(kvs, make_unique<DictionarySGL<false, false>>());
+  test_long_edges(kvs, make_unique<DictionarySGL<true, true>>());
+  test_long_edges(kvs, make_unique<DictionarySGL<true, false, true>>());
+
+  std::cerr << "-- test for profiled rebuild --" << std::endl;
+  {
+    std::vector<std::unique_ptr<Dictionary>> dics;
+    dics.push_back(make_unique<DictionarySGL<true, false>>());
+    dics.push_back(make_unique<DictionaryMLT<false, true>>(prefixes));
+    for (auto& dic : dics) {
+      for (size_t i = 0; i < kvs.size() / 2; ++i) {
+        assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+      }
+      dic->set_profiling(3);
+      for (size_t i = kvs.size() / 2; i < kvs.size(); ++i) { // beyond the profile
+        assert(dic->insert_key(kvs[i].key.c_str(), kvs[i].value));
+      }
+      std::vector<std::thread> searchers; // counting concurrently
+      for (size_t round = 0; round < 4; ++round) {
+        searchers.emplace_back([&]() {
+          for (size_t i = 0; i < kvs.size(); i += 1 + (i % 8 == 0 ? 0 : 7)) { // hot and cold keys
+            assert(dic->search_key(kvs[i].key.c_str()) == kvs[i].value);
+          }
+        });
+      }
+      for (auto& searcher : searchers) {
+        searcher.join();
+      }
+      dic->rebuild(); // going on with a new profile
+      dic->set_profiling(0);
+      for (size_t i = 0; i < kvs.size(); i += 2) {
+        assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+      }
+      dic->rebuild();
+      for (size_t i = 0; i < kvs.size(); ++i) {
+        assert(dic->search_key(kvs[i].key.c_str()) == (i % 2 == 0 ? NOT_FOUND : kvs[i].value));
+      }
+    }
+  }
+
+  test_hot_layout<DaTrie<false, false, false>>(kvs);
+  test_hot_layout<DaTrie<true, true, false>>(kvs);
+
+  std::cerr << "-- test for layouts --" << std::endl;
+  for (auto layout : {Layout::DFS, Layout::BFS, Layout::VEB}) {
+    std::vector<std::unique_ptr<Dictionary>> dics;
+    dics.push_back(make_unique<DictionarySGL<false, true>>());
+    dics.push_back(make_unique<DictionaryMLT<true, false>>(prefixes));
+    for (auto& dic : dics) {
+      for (auto& kv : kvs) {
+        assert(dic->insert_key(kv.key.c_str(), kv.value));
+      }
+      for (size_t i = 0; i < kvs.size(); i += 2) {
+        assert(dic->delete_key(kvs[i].key.c_str()) == kvs[i].value);
+      }
+      dic->set_layout(layout);
+      dic->rebuild();
+      for (size_t i = 0; i < kvs.size(); ++i) {
+        assert(dic->search_key(kvs[i].key.c_str()) == (i % 2 == 0 ? NOT_FOUND : kvs[i].value));
+      }
+      Stat stat{};
+      dic->stat(stat);
+      assert(stat.num_keys == kvs.size() / 2);
+
+      AccessTrace trace;
+      dic->trace_key(kvs[1].key.c_str(), trace);
+      assert(!trace.empty());
+    }
+  }
+
+  std::cerr << "-- test for jump table --" << std::endl;
+  {
+    DictionarySGL<false, true> dic;
+    dic.set_jump_table(true);
+    for (auto& kv : kvs) {
+      assert(dic.insert_key(kv.key.c_str(), kv.value));
+    }
+    for (size_t i = 0; i < kvs.size(); i += 2) {
+      assert(dic.delete_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+    dic.pack(); // moving nodes at depth 2
+    for (size_t i = 0; i < kvs.size(); ++i) {
+      assert(dic.search_key(kvs[i].key.c_str()) == (i % 2 == 0 ? NOT_FOUND : kvs[i].value));
+    }
+
+    dic.set_edge_compression(true);
+    dic.rebuild(); // into compressed edges
+    for (size_t i = 0; i < kvs.size(); i += 2) {
+      assert(dic.insert_key(kvs[i].key.c_str(), kvs[i].value));
+    }
+    for (auto& kv : kvs) {
+      assert(dic.search_key(kv.key.c_str()) == kv.value);
+    }
+    for (auto& kv : kvs) { // down to the root
+      assert(dic.delete_key(kv.key.c_str()) == kv.value);
+    }
+    assert(dic.insert_key("AB", 1) && dic.insert_key("ABC", 2) && dic.insert_key("AC", 3));
+    assert(dic.search_key("AB") == 1 && dic.search_key("ABC") == 2 && dic.search_key("AC") == 3);
+    assert(dic.search_key("A") == NOT_FOUND && dic.search_key("ABCD") == NOT_FOUND);
+  }
+
+  std::cerr << "-- test for frozen tries --" << std::endl;
+  test_frozen<DaTrie<false, true, false>>(kvs);
+  test_frozen<DaTrie<true, false, false, true>>(kvs);
+  test_frozen<DaTrie<false, false, false, false, uint64_t>>(kvs);
+  test_frozen_prefix<DaTrie<false, true, true>>(kvs, prefixes);
+
+  std::cerr << "-- test for file format --" << std::endl;
+  {
+    DictionaryMLT<true, false> dic(prefixes);
+    for (auto& kv : kvs) {
+      assert(dic.insert_key(kv.key.c_str(), kv.value));
+    }
+    std::stringstream ss;
+    dic.write(ss);
+    const auto file = ss.str();
+    Stat stat{};
+    dic.stat(stat);
+    assert(stat.size_in_bytes == file.size());
+
+    std::stringstream lazy_ss(file);
+    DictionaryMLT<true, false> lazy_dic(lazy_ss, true);
+    for (size_t i = 0; i < kvs.size(); i += 2) {
+      assert(lazy_dic.search_key(kvs[i].key.c_str()) == kvs[i].value);
+    }
+    lazy_dic.load_suffixes();
+    lazy_ss.str("");
+    for (auto& kv : kvs) {
+      assert(lazy_dic.search_key(kv.key.c_str()) == kv.value);
+    }
+    assert(!lazy_ss.fail());
+
+    std::stringstream sgl_ss(file);
+    DictionarySGL<true, false> sgl_dic(sgl_ss); // of another dictionary
+    assert(sgl_ss.fail() && sgl_dic.search_key(kvs[0].key.c_str()) == NOT_FOUND);
+
+    auto broken_file = file;
+    broken_file[broken_file.size() - 8] ^= 1; // in the last subtrie
+    std::stringstream broken_ss(broken_file);
+    DictionaryMLT<true, false> broken_dic(broken_ss);
+    assert(broken_ss.fail() && broken_dic.search_key(kvs[0].key.c_str()) == NOT_FOUND);
+
+    std::stringstream lazy_broken_ss(broken_file);
+    DictionaryMLT<true, false> lazy_broken_dic(lazy_broken_ss, true);
+    size_t num_found = 0, num_rejected = 0;
+    for (auto& kv : kvs) {
+      try {
+        num_found += lazy_broken_dic.search_key(kv.key.c_str()) == kv.value;
+      } catch (const std::ios_base::failure&) { // never an empty subtrie
+        ++num_rejected;
+      }
+    }
+    assert(lazy_broken_ss.fail() && 0 < num_found && 0 < num_rejected);
+    auto is_written = true;
+    try {
+      std::stringstream rewritten_ss;
+      lazy_broken_dic.write(rewritten_ss);
+    } catch (const std::ios_base::failure&) {
+      is_written = false;
+    }
+    assert(!is_written);
+
+    auto swapped_file = file; // with the header in the other byte order
+    for (size_t i = 0; i < sizeof(FileHeader); i += sizeof(uint32_t)) {
+      std::reverse(swapped_file.begin() + i, swapped_file.begin() + i + sizeof(uint32_t));
+    }
+    for (auto& bad_file : {std::string{}, swapped_file, // neither containers nor raw files
+                           std::string("\0\0\0\0\0\1\0\0", 8) + file}) { // BC past the file
+      std::stringstream bad_ss(bad_file);
+      DictionaryMLT<true, false> bad_dic(bad_ss);
+      assert(bad_ss.fail() && bad_dic.search_key(kvs[0].key.c_str()) == NOT_FOUND);
+      std::stringstream bad_sgl_ss(bad_file);
+      DictionarySGL<true, false> bad_sgl_dic(bad_sgl_ss);
+      assert(bad_sgl_ss.fail() && bad_sgl_dic.search_key(kvs[0].key.c_str()) == NOT_FOUND);
+    }
+
+    auto huge_file = file; // with a count of sections that the file cannot hold
+    huge_file[12] = huge_file[13] = huge_file[14] = huge_file[15] = '\xff';
+    std::stringstream huge_ss(huge_file);
+    DictionaryMLT<true, false> huge_dic(huge_ss);
+    assert(huge_ss.fail() && huge_dic.search_key(kvs[0].key.c_str()) == NOT_FOUND);
+
+    const char* file_name = "test.index";
+    for (auto is_broken : {false, true}) {
+      {
+        std::ofstream ofs{file_name};
+        ofs << (is_broken ? broken_file : file);
+      }
+      std::ifstream ifs{file_name};
+      auto fd = ::open(file_name, O_RDONLY);
+      assert(fd != -1);
+      DictionaryMLT<true, false> par_dic(ifs, PreadReader{fd}, 3); // by parallel reads
+      ::close(fd);
+      if (is_broken) {
+        assert(ifs.fail() && par_dic.search_key(kvs[0].key.c_str()) == NOT_FOUND);
+        continue;
+      }
+      assert(!ifs.fail());
+      for (auto& kv : kvs) {
+        assert(par_dic.search_key(kv.key.c_str()) == kv.value);
+      }
+    }
+  }
+
+  std::cerr << "-- test for files before the container --" << std::endl;
+  test_legacy<DictionarySGL<true, false>>("baseline_sgl.index");
+  test_legacy<DictionaryMLT<false, true>>("baseline_mlt.index");
+  {
+    std::ifstream ifs{std::string{DDD_FIXTURE_DIR} + "/baseline_sgl.index"};
+    DictionarySGL<true, false, true> wide_dic(ifs); // never wide then
+    assert(ifs.fail() && wide_dic.search_key("legacy/1/1/key1") == NOT_FOUND);
+  }
+
+  std::cerr << "-- test for snapshots --" << std::endl;
+  test_snapshot(kvs, make_unique<DictionarySGL<true, false>>());
+  test_snapshot(kvs, make_unique<DictionaryMLT<true, false>>(prefixes));
+  test_snapshot(kvs, make_unique<PlainDictionary>()); // by parsing write()
+  {
+    PlainDictionary dic;
+    dic.set_shared_tail(true); // ignored as the other hooks
+    dic.set_profiling(1);
+    dic.set_layout(Layout::BFS);
+    dic.set_edge_compression(true);
+    for (auto& kv : kvs) {
+      assert(dic.insert_key(kv.key.c_str(), kv.value));
+    }
+    LeafStat leaf_stat{};
+    dic.leaf_stat(leaf_stat);
+    assert(leaf_stat.num_tails == 0);
+    AccessTrace trace;
+    dic.trace_key(kvs[0].key.c_str(), trace);
+    assert(trace.empty());
+
+    DeltaBase base;
+    dic.delta_base(base);
+    std::stringstream delta_ss;
+    dic.write_delta(base, delta_ss);
+    assert(delta_ss.fail() && !dic.read_delta(delta_ss, base));
+
+    std::stringstream ss;
+    dic.write_compressed(ss);
+    PlainDictionary read_dic(ss);
+    for (auto& kv : kvs) {
+      assert(read_dic.search_key(kv.key.c_str()) == kv.value);
+    }
+  }
+
+  std::cerr << "-- test for deltas --" << std::endl;
+  test_deltas(kvs, make_unique<DictionarySGL<true, false>>());
+  test_deltas(kvs, make_unique<DictionarySGL<false, true, true>>());
+  test_deltas(kvs, make_unique<DictionaryMLT<true, false>>(prefixes));
+  test_deltas(kvs, make_unique<DictionaryMLT<false, true>>(prefixes));
+
+  std::cerr << "-- test for compressed files --" << std::endl;
+  {
+    std::string text;
+    for (size_t i = 0; i < 1000; ++i) {
+      text += kvs[i % 50].key + std::to_string(i * 7919 % 1000);
+    }
+    for (auto& src : {std::string{}, std::string{"abc"}, std::string(300, '\0'), text}) {
+      std::string packed;
+      utils::lz_compress(src.data(), src.size(), packed);
+      std::string unpacked(src.size(), '\0');
+      assert(utils::lz_decompress(packed.data(), packed.size(), &unpacked[0], unpacked.size()));
+      assert(unpacked == src);
+      assert(src.empty() || !utils::lz_decompress(packed.data(), packed.size(), &unpacked[0],
+                                                   unpacked.size() / 2));
+    }
+  }
+  test_compressed(kvs, make_unique<DictionarySGL<true, false>>());
+  test_compressed(kvs, make_unique<DictionarySGL<false, true, true>>());
+  test_compressed(kvs, make_unique<DictionarySGL<false, false, false, uint64_t>>());
+  test_compressed(kvs, make_unique<DictionaryMLT<true, false>>(prefixes));
+  test_compressed(kvs, make_unique<DictionaryMLT<false, true>>(prefixes));
+
+  std::cerr << "-- test for shared memory --" << std::endl;
+  test_shared(kvs);
+
+  std::cerr << "-- test for NUMA replicas --" << std::endl;
+  test_replicated(kvs);
+
+  std::cerr << "-- test for write-ahead logs --" << std::endl;
+  test_log(kvs);
+
+  std::cerr << "-- test for 64-bit values --" << std::endl;
+  test_values(kvs, make_unique<DictionarySGL<false, false, false, uint64_t>>(), value64);
+  test_values(kvs, make_unique<DictionaryMLT<true, true, true, uint64_t>>(prefixes), value64);
+
+  std::cerr << "-- test for sets --" << std::endl;
+  auto value0 = [](uint32_t) -> uint32_t { return 0; };
+  test_values(kvs, make_unique<DictionarySGL<false, true, false, void>>(), value0);
+  test_values(kvs, make_unique<DictionaryMLT<true, false, false, void>>(prefixes), value0);
+  {
+    DictionarySGL<false, false> map;
+    DictionarySGL<false, false, false, void> set;
+    for (auto& kv : kvs) {
+      map.insert_key(kv.key.c_str(), kv.value);
+      set.insert_key(kv.key.c_str(), kv.value);
+    }
+    Stat map_stat{}, set_stat{};
+    map.stat(map_stat);
+    set.stat(set_stat);
+    assert(set_stat.tail_size + sizeof(uint32_t) * map_stat.num_keys / 2 < map_stat.tail_size);
+  }
+
   return 0;
 }
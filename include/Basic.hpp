@@ -1,6 +1,8 @@
 #ifndef DDD_BASIC_HPP
 #define DDD_BASIC_HPP
 
+#include <algorithm>
+#include <cassert>
 #include <cstdint>
 #include <cstddef>
 #include <cstring>
@@ -8,6 +10,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace ddd {
@@ -15,30 +18,136 @@ namespace ddd {
 using std::size_t;
 using std::uint8_t;
 using std::uint32_t;
+using std::uint64_t;
 
 constexpr uint32_t ROOT_POS = 0;
 constexpr uint32_t BLOCK_SIZE = 1U << 8;
 constexpr uint32_t INVALID_VALUE = UINT32_MAX >> 1;
 constexpr uint32_t NOT_FOUND = UINT32_MAX;
+constexpr uint32_t INLINE_FLAG = 1U << 30; // flags a leaf inlining its suffix
+constexpr uint32_t MAX_INLINE_LENGTH = 3;
+constexpr uint32_t MAX_EDGE_LENGTH = UINT8_MAX; // labels in a compressed edge
 
 template<typename T, typename... Ts>
 inline std::unique_ptr<T> make_unique(Ts&& ... params) {
   return std::unique_ptr<T>(new T(std::forward<Ts>(params)...));
 };
 
-struct KvPair {
+// Positions in BC, TAIL and the label pool. The default variant has 31-bit
+// fields in 8-byte BC elements, and the wide one has 47-bit fields in 12-byte
+// elements. The top bit of a field flags inlined leaves while TAIL is below
+// it, and compressed edges while BC is below it.
+template<bool Wide>
+struct IndexTraits {
+  using Type = typename std::conditional<Wide, uint64_t, uint32_t>::type;
+
+  static constexpr uint32_t BITS = Wide ? 47 : 31;
+  static constexpr Type INVALID = (Type{1} << BITS) - 1;
+  static constexpr Type NOT_FOUND = ~Type{0};
+  static constexpr Type LABEL_FLAG = Type{1} << (BITS - 1); // for internal nodes
+  static constexpr Type INLINE_FLAG = Type{1} << (BITS - 1); // for leaves
+};
+
+template<bool Wide> constexpr uint32_t IndexTraits<Wide>::BITS;
+template<bool Wide> constexpr typename IndexTraits<Wide>::Type IndexTraits<Wide>::INVALID;
+template<bool Wide> constexpr typename IndexTraits<Wide>::Type IndexTraits<Wide>::NOT_FOUND;
+template<bool Wide> constexpr typename IndexTraits<Wide>::Type IndexTraits<Wide>::LABEL_FLAG;
+template<bool Wide> constexpr typename IndexTraits<Wide>::Type IndexTraits<Wide>::INLINE_FLAG;
+
+// Values of leaves. BITS is the usable width, BYTES is the width of a value
+// appended to a TAIL entry, and the bit above BITS flags TAIL_REF entries in
+// the shared mode. ValueTraits<void> stores no value, for pure sets.
+template<class Value>
+struct ValueTraits;
+
+template<>
+struct ValueTraits<uint32_t> {
+  using Type = uint32_t;
+
+  static constexpr bool HAS_VALUE = true;
+  static constexpr uint32_t BITS = 31;
+  static constexpr uint32_t BYTES = sizeof(Type);
+  static constexpr Type NOT_FOUND = UINT32_MAX;
+  static constexpr Type TAIL_REF = Type{1} << BITS;
+};
+
+template<>
+struct ValueTraits<uint64_t> {
+  using Type = uint64_t;
+
+  static constexpr bool HAS_VALUE = true;
+  static constexpr uint32_t BITS = 63;
+  static constexpr uint32_t BYTES = sizeof(Type);
+  static constexpr Type NOT_FOUND = UINT64_MAX;
+  static constexpr Type TAIL_REF = Type{1} << BITS;
+};
+
+template<>
+struct ValueTraits<void> { // values are always 0
+  using Type = uint32_t;
+
+  static constexpr bool HAS_VALUE = false;
+  static constexpr uint32_t BITS = 0;
+  static constexpr uint32_t BYTES = 0;
+  static constexpr Type NOT_FOUND = UINT32_MAX;
+  static constexpr Type TAIL_REF = 0; // suffixes are referred to directly
+};
+
+template<class T>
+struct BasicKvPair {
   std::string key;
-  uint32_t value;
+  T value;
 };
 
-inline bool operator==(const KvPair& lhs, const KvPair& rhs) {
+using KvPair = BasicKvPair<uint32_t>;
+
+template<class T>
+inline bool operator==(const BasicKvPair<T>& lhs, const BasicKvPair<T>& rhs) {
   return lhs.key == rhs.key;
 }
 
-inline bool operator<(const KvPair& lhs, const KvPair& rhs) {
+template<class T>
+inline bool operator<(const BasicKvPair<T>& lhs, const BasicKvPair<T>& rhs) {
   return lhs.key < rhs.key;
 }
 
+struct LeafStat {
+  size_t num_terminals = 0; // values in BC
+  size_t num_inlines = 0; // suffixes and values in BC
+  size_t num_tails = 0; // suffixes and values in TAIL
+};
+
+// The node order of rebuild(): DFS keeps subtrees together, BFS keeps the top
+// levels together, and VEB lays out the top half of the levels before each of
+// the subtrees below them, recursively (the van Emde Boas layout).
+enum class Layout {
+  DFS, BFS, VEB
+};
+
+// The byte ranges read by a search, for locality analysis
+using AccessTrace = std::vector<std::pair<const void*, size_t>>;
+
+// 64-bit hashes of the chunks of the arrays of a trie and of its other
+// members, against which DaTrie::write_delta() finds the changed chunks
+struct TrieHashes {
+  static constexpr uint32_t NUM_ARRAYS = 5;
+
+  std::vector<uint64_t> arrays[NUM_ARRAYS];
+  uint64_t rest = 0;
+
+  bool operator==(const TrieHashes& rhs) const {
+    for (uint32_t i = 0; i < NUM_ARRAYS; ++i) {
+      if (arrays[i] != rhs.arrays[i]) {
+        return false;
+      }
+    }
+    return rest == rhs.rest;
+  }
+  bool operator!=(const TrieHashes& rhs) const {
+    return !(*this == rhs);
+  }
+};
+
 struct Stat {
   size_t num_keys = 0;
   size_t num_tries = 0;
@@ -49,13 +158,19 @@ struct Stat {
   size_t tail_size = 0;
   size_t tail_capa = 0;
   size_t tail_emps = 0;
+  size_t tail_holes = 0;
+  size_t tail_saved = 0;
+  size_t label_size = 0;
+  size_t filter_size = 0; // in bytes, not written
+  size_t hole_size = 0; // in bytes of the hole lists, not written
   size_t size_in_bytes = 0;
 };
 
-class Bc {
+template<bool Wide>
+class BasicBc {
 public:
-  Bc() : base_{0}, is_leaf_{0}, check_{0}, is_fixed_{0} {}
-  ~Bc() {}
+  BasicBc() : base_{0}, is_leaf_{0}, check_{0}, is_fixed_{0} {}
+  ~BasicBc() {}
 
   uint32_t base() const { return base_; }
   uint32_t value() const { return base_; }
@@ -82,14 +197,54 @@ private:
   uint32_t is_fixed_ : 1;
 };
 
+template<>
+class BasicBc<true> { // the upper 15 bits of base and check are in hi_
+public:
+  BasicBc() : base_lo_{0}, check_lo_{0}, base_hi_{0}, is_leaf_{0}, check_hi_{0}, is_fixed_{0} {}
+  ~BasicBc() {}
+
+  uint64_t base() const { return base_lo_ | (static_cast<uint64_t>(base_hi_) << 32); }
+  uint64_t value() const { return base(); }
+  uint64_t check() const { return check_lo_ | (static_cast<uint64_t>(check_hi_) << 32); }
+  bool is_leaf() const { return is_leaf_ == 1; }
+  bool is_fixed() const { return is_fixed_ == 1; }
+
+  void set_base(uint64_t base) {
+    base_lo_ = static_cast<uint32_t>(base);
+    base_hi_ = static_cast<uint32_t>(base >> 32);
+    is_leaf_ = 0;
+  }
+  void set_value(uint64_t value) {
+    set_base(value);
+    is_leaf_ = 1;
+  }
+  void set_check(uint64_t check) {
+    check_lo_ = static_cast<uint32_t>(check);
+    check_hi_ = static_cast<uint32_t>(check >> 32);
+  }
+  void fix() { is_fixed_ = 1; }
+  void unfix() { is_fixed_ = 0; }
+
+private:
+  uint32_t base_lo_;
+  uint32_t check_lo_;
+  uint32_t base_hi_  : 15;
+  uint32_t is_leaf_  : 1;
+  uint32_t check_hi_ : 15;
+  uint32_t is_fixed_ : 1;
+};
+
 struct Block {
   uint32_t num_emps = BLOCK_SIZE;
 };
 
-struct BlockLink {
-  uint32_t next = 0;
-  uint32_t prev = 0;
-  uint32_t head = 0;
+template<bool Wide>
+struct BasicBlockLink {
+  using IndexType = typename IndexTraits<Wide>::Type;
+
+  IndexType next = 0;
+  IndexType prev = 0;
+  IndexType head = 0;
   uint32_t num_emps = BLOCK_SIZE;
 };
 
@@ -98,20 +253,24 @@ struct NodeLink {
   uint8_t sib = '\0';
 };
 
-class Query {
+template<bool Wide, class Value = uint32_t>
+class BasicQuery {
 public:
-  Query() {}
-  Query(const char* key) : key_{key} {}
-  ~Query() {}
+  using IndexType = typename IndexTraits<Wide>::Type;
+  using ValueType = typename ValueTraits<Value>::Type;
+
+  BasicQuery() {}
+  BasicQuery(const char* key) : key_{key} {}
+  ~BasicQuery() {}
 
   const char* key() const { return key_ + pos_; }
   uint8_t label() const { return static_cast<uint8_t>(key_[pos_]); }
-  uint32_t value() const { return value_; }
-  uint32_t node_pos() const { return node_pos_; }
+  ValueType value() const { return value_; }
+  IndexType node_pos() const { return node_pos_; }
   bool is_finished() const { return is_finished_; }
 
   void next() { is_finished_ = key_[pos_++] == '\0'; }
-  void next(uint32_t node_pos) {
+  void next(IndexType node_pos) {
     set_node_pos(node_pos);
     next();
   }
@@ -119,22 +278,22 @@ public:
     is_finished_ = false;
     --pos_;
   }
-  void prev(uint32_t node_pos) {
+  void prev(IndexType node_pos) {
     set_node_pos(node_pos);
     prev();
   }
 
-  void set_value(uint32_t value) { value_ = value; }
-  void set_node_pos(uint32_t node_pos) { node_pos_ = node_pos; }
+  void set_value(ValueType value) { value_ = value; }
+  void set_node_pos(IndexType node_pos) { node_pos_ = node_pos; }
 
-  Query(const Query&) = delete;
-  Query& operator=(const Query&) = delete;
+  BasicQuery(const BasicQuery&) = delete;
+  BasicQuery& operator=(const BasicQuery&) = delete;
 
 private:
   const char* key_ = nullptr;
   uint32_t pos_ = 0;
-  uint32_t value_ = INVALID_VALUE;
-  uint32_t node_pos_ = ROOT_POS;
+  ValueType value_ = INVALID_VALUE;
+  IndexType node_pos_ = ROOT_POS;
   bool is_finished_ = false;
 };
 
@@ -181,15 +340,71 @@ inline uint32_t length(const char* str) {
   return static_cast<uint32_t>(std::strlen(str)) + 1;
 }
 
-inline uint32_t extract_value(const char* str) {
-  uint32_t value = 0;
-  std::memcpy(&value, str, sizeof(uint32_t));
+inline uint64_t hash(const char* str) { // FNV-1a up to the terminator
+  uint64_t ret = 0xcbf29ce484222325ULL;
+  while (*str != '\0') {
+    ret = (ret ^ static_cast<uint8_t>(*str++)) * 0x100000001b3ULL;
+  }
+  return ret;
+}
+
+template<class Value = uint32_t>
+inline typename ValueTraits<Value>::Type extract_value(const char* str) {
+  typename ValueTraits<Value>::Type value = 0;
+  std::memcpy(&value, str, ValueTraits<Value>::BYTES);
   return value;
 }
 
-template<class T>
-inline size_t size_in_bytes(const std::vector<T>& vec) {
-  return vec.size() * sizeof(T) + sizeof(vec.size());
+// A non-terminal leaf can inline a suffix of up to MAX_INLINE_LENGTH labels
+// into the 30 bits below INLINE_FLAG: 2 bits for the length, 8 bits for each
+// label from the top, and the rest for the value.
+inline bool is_inline(uint32_t leaf) {
+  return (leaf & INLINE_FLAG) != 0;
+}
+
+inline uint32_t inline_length(uint32_t leaf) {
+  return (leaf >> 28) & 0x3;
+}
+
+inline uint32_t inline_value(uint32_t leaf) {
+  return leaf & ((1U << (28 - 8 * inline_length(leaf))) - 1);
+}
+
+inline bool make_inline(const char* suffix, uint32_t len, uint32_t value, uint32_t& leaf) {
+  if (MAX_INLINE_LENGTH < --len) { // without the terminator
+    return false;
+  }
+  if ((value >> (28 - 8 * len)) != 0) {
+    return false;
+  }
+  leaf = INLINE_FLAG | (len << 28) | value;
+  for (uint32_t i = 0; i < len; ++i) {
+    leaf |= static_cast<uint32_t>(static_cast<uint8_t>(suffix[i])) << (20 - 8 * i);
+  }
+  return true;
+}
+
+inline bool match_inline(const char* key, uint32_t leaf) {
+  auto len = inline_length(leaf);
+  for (uint32_t i = 0; i < len; ++i) {
+    if (static_cast<uint8_t>(key[i]) != ((leaf >> (20 - 8 * i)) & 0xFF)) {
+      return false;
+    }
+  }
+  return key[len] == '\0';
+}
+
+inline void extract_inline(uint32_t leaf, char* suffix) {
+  auto len = inline_length(leaf);
+  for (uint32_t i = 0; i < len; ++i) {
+    suffix[i] = static_cast<char>((leaf >> (20 - 8 * i)) & 0xFF);
+  }
+  suffix[len] = '\0';
+}
+
+template<class T, class A>
+inline size_t size_in_bytes(const std::vector<T, A>& vec) { // with the 64-bit length
+  return vec.size() * sizeof(T) + sizeof(uint64_t);
 }
 
 template<class T>
@@ -197,11 +412,13 @@ inline void write_value(const T val, std::ostream& os) {
   os.write(reinterpret_cast<const char*>(&val), sizeof(val));
 }
 
-template<class T>
-inline void write_vector(const std::vector<T>& vec, std::ostream& os) {
-  auto size = vec.size();
+template<class T, class A>
+inline void write_vector(const std::vector<T, A>& vec, std::ostream& os) {
+  auto size = static_cast<uint64_t>(vec.size());
   write_value(size, os);
-  os.write(reinterpret_cast<const char*>(&vec[0]), sizeof(T) * size);
+  if (size != 0) { // data() may be null
+    os.write(reinterpret_cast<const char*>(vec.data()), sizeof(T) * size);
+  }
 }
 
 template<class T>
@@ -209,13 +426,164 @@ inline void read_value(T& val, std::istream& is) {
   is.read(reinterpret_cast<char*>(&val), sizeof(val));
 }
 
-template<class T>
-inline void read_vector(std::vector<T>& vec, std::istream& is) {
+template<class T, class A>
+inline void read_vector(std::vector<T, A>& vec, std::istream& is) {
   vec.clear();
-  size_t size = 0;
+  uint64_t size = 0;
+  read_value(size, is);
+  vec.resize(static_cast<size_t>(size));
+  if (size != 0) {
+    is.read(reinterpret_cast<char*>(vec.data()), sizeof(T) * size);
+  }
+}
+
+// reads as above but sets the failbit instead of allocating past max_bytes,
+// for bytes whose lengths are not checked otherwise
+template<class T, class A>
+inline void read_vector(std::vector<T, A>& vec, std::istream& is, uint64_t max_bytes) {
+  vec.clear();
+  uint64_t size = 0;
+  read_value(size, is);
+  if (!is || max_bytes / sizeof(T) < size) {
+    is.setstate(std::ios::failbit);
+    return;
+  }
+  vec.resize(static_cast<size_t>(size));
+  if (size != 0) {
+    is.read(reinterpret_cast<char*>(vec.data()), sizeof(T) * size);
+  }
+}
+
+// a fast 64-bit hash of bytes for finding changes, not against adversaries,
+// in four lanes of multiply-xorshift
+inline uint64_t hash_bytes(const char* data, size_t size, uint64_t seed = 0) {
+  constexpr uint64_t MUL = 0x9E3779B97F4A7C15ULL;
+  auto mix = [](uint64_t x) {
+    x = (x ^ (x >> 31)) * 0xBF58476D1CE4E5B9ULL;
+    return x ^ (x >> 29);
+  };
+  uint64_t lanes[4] = {seed ^ size, seed + MUL, seed - MUL, ~seed};
+  for (; 32 <= size; data += 32, size -= 32) {
+    for (int i = 0; i < 4; ++i) {
+      uint64_t word = 0;
+      std::memcpy(&word, data + 8 * i, 8);
+      lanes[i] = ((lanes[i] ^ word) * MUL) ^ (lanes[i] >> 29);
+    }
+  }
+  for (int i = 0; size != 0; ++i) {
+    uint64_t word = 0;
+    auto len = size < 8 ? size : 8;
+    std::memcpy(&word, data, len);
+    lanes[i] = ((lanes[i] ^ word) * MUL) ^ (lanes[i] >> 29);
+    data += len;
+    size -= len;
+  }
+  return mix(mix(lanes[0]) + lanes[1]) ^ mix(mix(lanes[2]) + lanes[3]);
+}
+
+// The hashes of the chunks of chunk_len elements of an array, kept along
+// with the chunks changed since they were taken, so that update() rehashes
+// only those and the last chunk, whose length may have changed. The owner of
+// the array marks every change; clear() makes all the chunks rehashed.
+class ChunkHashes {
+public:
+  void mark(size_t chunk) { // for chunks past the hashes, which are new, too
+    if (chunk < changed_.size()) {
+      changed_[chunk] = true;
+    }
+  }
+
+  void mark(size_t first, size_t last) { // from first to last inclusive
+    for (auto chunk = first; chunk <= last && chunk < changed_.size(); ++chunk) {
+      changed_[chunk] = true;
+    }
+  }
+
+  void clear() {
+    hashes_.clear();
+    changed_.clear();
+  }
+
+  template<class T, class A>
+  const std::vector<uint64_t>& update(const std::vector<T, A>& vec, size_t chunk_len) {
+    auto num_chunks = (vec.size() + chunk_len - 1) / chunk_len;
+    auto num_hashed = std::min(hashes_.size(), num_chunks);
+    if (num_hashed != 0) {
+      changed_[num_hashed - 1] = true;
+    }
+    hashes_.resize(num_chunks);
+    changed_.resize(num_chunks, true);
+    for (size_t i = 0; i < num_chunks; ++i) {
+      if (changed_[i]) {
+        hashes_[i] = hash_(vec, chunk_len, i);
+        changed_[i] = false;
+      }
+      assert(hashes_[i] == hash_(vec, chunk_len, i)); // every change is marked
+    }
+    return hashes_;
+  }
+
+  void swap(ChunkHashes& rhs) {
+    hashes_.swap(rhs.hashes_);
+    changed_.swap(rhs.changed_);
+  }
+
+private:
+  std::vector<uint64_t> hashes_;
+  std::vector<bool> changed_;
+
+  template<class T, class A>
+  static uint64_t hash_(const std::vector<T, A>& vec, size_t chunk_len, size_t i) {
+    auto len = std::min(chunk_len, vec.size() - i * chunk_len);
+    auto chunk = reinterpret_cast<const char*>(vec.data() + i * chunk_len);
+    return hash_bytes(chunk, sizeof(T) * len, len);
+  }
+};
+
+// writes the length of vec and its chunks whose hashes in now differ from
+// those in base, each with its index
+template<class T, class A>
+inline void write_chunks(const std::vector<T, A>& vec, size_t chunk_len,
+                         const std::vector<uint64_t>& base, const std::vector<uint64_t>& now,
+                         std::ostream& os) {
+  assert(now.size() == (vec.size() + chunk_len - 1) / chunk_len);
+  uint64_t num_chunks = 0;
+  for (size_t i = 0; i < now.size(); ++i) {
+    num_chunks += base.size() <= i || base[i] != now[i];
+  }
+  write_value(static_cast<uint64_t>(vec.size()), os);
+  write_value(num_chunks, os);
+  for (size_t i = 0; i < now.size(); ++i) {
+    if (base.size() <= i || base[i] != now[i]) {
+      auto len = std::min(chunk_len, vec.size() - i * chunk_len);
+      write_value(static_cast<uint64_t>(i), os);
+      os.write(reinterpret_cast<const char*>(&vec[i * chunk_len]), sizeof(T) * len);
+    }
+  }
+}
+
+// applies chunks written by write_chunks() to vec, marking them in hashes
+template<class T, class A>
+inline void read_chunks(std::vector<T, A>& vec, size_t chunk_len, std::istream& is,
+                        ChunkHashes& hashes) {
+  uint64_t size = 0, num_chunks = 0;
   read_value(size, is);
-  vec.resize(size);
-  is.read(reinterpret_cast<char*>(&vec[0]), sizeof(T) * size);
+  read_value(num_chunks, is);
+  if (!is) {
+    return;
+  }
+  vec.resize(static_cast<size_t>(size));
+  for (uint64_t k = 0; k < num_chunks; ++k) {
+    uint64_t i = 0;
+    read_value(i, is);
+    if (!is || (vec.size() + chunk_len - 1) / chunk_len <= i) {
+      is.setstate(std::ios::failbit);
+      return;
+    }
+    auto len = std::min<size_t>(chunk_len, vec.size() - i * chunk_len);
+    is.read(reinterpret_cast<char*>(&vec[i * chunk_len]), sizeof(T) * len);
+    hashes.mark(static_cast<size_t>(i));
+  }
 }
 
 };
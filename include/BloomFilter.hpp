@@ -0,0 +1,121 @@
+#ifndef DDD_BLOOM_FILTER_HPP
+#define DDD_BLOOM_FILTER_HPP
+
+#include "MemoryResource.hpp"
+
+namespace ddd {
+
+// A Bloom filter blocked by cache lines: the bits of a key are set in one
+// 512-bit block, so that a probe touches one line. Keys are given as hashes
+// such as utils::hash. They cannot be removed, so the owner remakes the
+// filter to forget deleted keys.
+class BloomFilter {
+public:
+  static constexpr uint32_t BLOCK_WORDS = 8;
+  static constexpr uint32_t MAX_PROBES = 7; // taking 9 bits of a hash each
+
+  explicit BloomFilter(MemoryResource* resource = new_delete_resource()) : words_(resource) {}
+
+  BloomFilter(BloomFilter&& rhs) : words_(rhs.words_.get_allocator()) {
+    swap(rhs);
+  }
+
+  ~BloomFilter() {}
+
+  // clears the filter and sizes it for capacity keys of bits_per_key bits
+  void init(size_t capacity, size_t bits_per_key) {
+    assert(0 < bits_per_key);
+
+    auto num_bits = capacity * bits_per_key;
+    num_blocks_ = (num_bits + BLOCK_WORDS * 64 - 1) / (BLOCK_WORDS * 64);
+    if (num_blocks_ == 0) {
+      num_blocks_ = 1;
+    }
+    num_probes_ = static_cast<uint32_t>(bits_per_key * 0.69 + 0.5); // ln 2
+    if (num_probes_ < 1) {
+      num_probes_ = 1;
+    } else if (MAX_PROBES < num_probes_) {
+      num_probes_ = MAX_PROBES;
+    }
+    capacity_ = capacity;
+    num_keys_ = 0;
+
+    words_.clear();
+    words_.resize(num_blocks_ * BLOCK_WORDS, 0);
+  }
+
+  void clear() {
+    ResourceVector<uint64_t>(words_.get_allocator()).swap(words_);
+    num_blocks_ = 0;
+    capacity_ = 0;
+    num_keys_ = 0;
+  }
+
+  void add(uint64_t hash) {
+    assert(!words_.empty());
+    hash = mix_(hash);
+    auto block = &words_[block_(hash) * BLOCK_WORDS];
+    auto bits = mix_(hash);
+    for (uint32_t i = 0; i < num_probes_; ++i, bits >>= 9) {
+      block[(bits >> 6) & (BLOCK_WORDS - 1)] |= 1ULL << (bits & 63);
+    }
+    ++num_keys_;
+  }
+
+  bool may_contain(uint64_t hash) const {
+    if (words_.empty()) {
+      return true;
+    }
+    hash = mix_(hash);
+    auto block = &words_[block_(hash) * BLOCK_WORDS];
+    auto bits = mix_(hash);
+    for (uint32_t i = 0; i < num_probes_; ++i, bits >>= 9) {
+      if ((block[(bits >> 6) & (BLOCK_WORDS - 1)] & (1ULL << (bits & 63))) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool is_full() const {
+    return capacity_ < num_keys_;
+  }
+
+  size_t size_in_bytes() const {
+    return words_.size() * sizeof(uint64_t);
+  }
+
+  void swap(BloomFilter& rhs) {
+    words_.swap(rhs.words_);
+    std::swap(num_blocks_, rhs.num_blocks_);
+    std::swap(num_probes_, rhs.num_probes_);
+    std::swap(capacity_, rhs.capacity_);
+    std::swap(num_keys_, rhs.num_keys_);
+  }
+
+  BloomFilter(const BloomFilter&) = delete;
+  BloomFilter& operator=(const BloomFilter&) = delete;
+
+private:
+  ResourceVector<uint64_t> words_;
+  size_t num_blocks_ = 0;
+  uint32_t num_probes_ = 0;
+  size_t capacity_ = 0;
+  size_t num_keys_ = 0; // added since init
+
+  size_t block_(uint64_t hash) const { // by multiply-shift of the upper half
+    return static_cast<size_t>(((hash >> 32) * num_blocks_) >> 32);
+  }
+
+  static uint64_t mix_(uint64_t hash) { // the finalizer of MurmurHash3
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 33);
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_BLOOM_FILTER_HPP
@@ -0,0 +1,198 @@
+#ifndef DDD_CACHED_DICTIONARY_HPP
+#define DDD_CACHED_DICTIONARY_HPP
+
+#include "Dictionary.hpp"
+
+namespace ddd {
+
+// A fixed-size cache of search results in front of a dictionary, for skewed
+// lookups. Results of keys up to MAX_KEY_LENGTH bytes are cached, misses
+// included, and are dropped on insert_key and delete_key. A set is a cache
+// line of tags followed by a line per way, and the victim in a set is chosen
+// by CLOCK. search_key updates a set holding its spinlock, and the counters
+// by __atomic builtins, so searches can run concurrently, though not with the
+// other operations. The rest goes to the dictionary, so that profiles, traces and files are of
+// it without the cache.
+template<class T>
+class CachedDictionary : public ForwardingDictionary<T> {
+public:
+  static constexpr uint32_t LINE_SIZE = 64;
+  static constexpr uint32_t NUM_WAYS = 8;
+  static constexpr uint32_t MAX_KEY_LENGTH = LINE_SIZE - sizeof(T) - 1;
+
+  CachedDictionary(std::unique_ptr<BasicDictionary<T>> dic, size_t num_entries)
+    : ForwardingDictionary<T>{std::move(dic)} {
+    num_sets_ = (num_entries + NUM_WAYS - 1) / NUM_WAYS;
+    if (num_sets_ == 0) {
+      num_sets_ = 1;
+    }
+    buf_.reset(new char[num_sets_ * sizeof(Set) + LINE_SIZE]);
+    auto addr = reinterpret_cast<std::uintptr_t>(buf_.get());
+    sets_ = reinterpret_cast<Set*>((addr + LINE_SIZE - 1) & ~std::uintptr_t{LINE_SIZE - 1});
+    clear_cache();
+  }
+
+  ~CachedDictionary() {}
+
+  std::string name() const {
+    return "Cached" + dic_->name();
+  }
+
+  T search_key(const char* key) const {
+    auto len = std::strlen(key);
+    if (MAX_KEY_LENGTH < len) {
+      return dic_->search_key(key);
+    }
+
+    __atomic_add_fetch(&num_lookups_, 1, __ATOMIC_RELAXED);
+    auto hash = utils::hash(key);
+    auto& set = set_(hash);
+    lock_(set);
+    auto way = find_(set, hash, key, len);
+    if (way != NUM_WAYS) {
+      set.refs |= 1U << way;
+      auto value = set.entries[way].value;
+      unlock_(set);
+      __atomic_add_fetch(&num_hits_, 1, __ATOMIC_RELAXED);
+      return value;
+    }
+    unlock_(set); // not held during the search
+
+    auto value = dic_->search_key(key);
+    lock_(set);
+    if (find_(set, hash, key, len) == NUM_WAYS) { // not cached by another search meanwhile
+      way = victim_(set);
+      set.tags[way] = static_cast<uint32_t>(hash >> 32);
+      set.valids |= 1U << way;
+      set.entries[way].value = value;
+      std::memcpy(set.entries[way].key, key, len + 1);
+    }
+    unlock_(set);
+    return value;
+  }
+
+  bool insert_key(const char* key, T value) {
+    if (!dic_->insert_key(key, value)) {
+      return false;
+    }
+    erase_(key); // a cached miss
+    return true;
+  }
+
+  T delete_key(const char* key) {
+    auto value = dic_->delete_key(key);
+    if (value != ValueTraits<T>::NOT_FOUND) {
+      erase_(key);
+    }
+    return value;
+  }
+
+  bool read_delta(std::istream& is, DeltaBase& base) {
+    clear_cache();
+    return dic_->read_delta(is, base);
+  }
+
+  void clear_cache() {
+    std::memset(sets_, 0, num_sets_ * sizeof(Set));
+    num_lookups_ = 0;
+    num_hits_ = 0;
+  }
+
+  size_t num_lookups() const { // of cacheable keys
+    return num_lookups_;
+  }
+
+  size_t num_hits() const {
+    return num_hits_;
+  }
+
+  size_t cache_size_in_bytes() const {
+    return num_sets_ * sizeof(Set);
+  }
+
+  CachedDictionary(const CachedDictionary&) = delete;
+  CachedDictionary& operator=(const CachedDictionary&) = delete;
+
+private:
+  struct Entry {
+    T value;
+    char key[LINE_SIZE - sizeof(T)]; // terminated
+  };
+
+  struct Set {
+    uint32_t tags[NUM_WAYS]; // upper halves of the hashes
+    uint8_t valids;
+    uint8_t refs;
+    uint8_t hand;
+    bool is_locked;
+    uint8_t padding[LINE_SIZE - sizeof(uint32_t) * NUM_WAYS - 4];
+    Entry entries[NUM_WAYS];
+  };
+
+  static_assert(sizeof(Entry) == LINE_SIZE, "an entry has to fill a line");
+  static_assert(sizeof(Set) == LINE_SIZE * (NUM_WAYS + 1), "a set has to fill lines");
+
+  using ForwardingDictionary<T>::dic_;
+
+  std::unique_ptr<char[]> buf_;
+  Set* sets_ = nullptr; // aligned in buf_
+  size_t num_sets_ = 0;
+  mutable size_t num_lookups_ = 0;
+  mutable size_t num_hits_ = 0;
+
+  Set& set_(uint64_t hash) const { // by multiply-shift of the lower half
+    return sets_[((hash & UINT32_MAX) * num_sets_) >> 32];
+  }
+
+  static void lock_(Set& set) {
+    while (__atomic_test_and_set(&set.is_locked, __ATOMIC_ACQUIRE)) {
+      while (__atomic_load_n(&set.is_locked, __ATOMIC_RELAXED)) {}
+    }
+  }
+
+  static void unlock_(Set& set) {
+    __atomic_clear(&set.is_locked, __ATOMIC_RELEASE);
+  }
+
+  static uint32_t find_(const Set& set, uint64_t hash, const char* key, size_t len) {
+    auto tag = static_cast<uint32_t>(hash >> 32);
+    for (uint32_t way = 0; way < NUM_WAYS; ++way) {
+      if ((set.valids >> way & 1U) != 0 && set.tags[way] == tag
+          && std::memcmp(set.entries[way].key, key, len + 1) == 0) {
+        return way;
+      }
+    }
+    return NUM_WAYS;
+  }
+
+  static uint32_t victim_(Set& set) { // an empty way or the first unreferenced one
+    if (set.valids != UINT8_MAX) {
+      return static_cast<uint32_t>(__builtin_ctz(~set.valids & UINT8_MAX));
+    }
+    while ((set.refs >> set.hand & 1U) != 0) {
+      set.refs &= ~(1U << set.hand);
+      set.hand = (set.hand + 1) % NUM_WAYS;
+    }
+    auto way = set.hand;
+    set.hand = (set.hand + 1) % NUM_WAYS;
+    return way;
+  }
+
+  void erase_(const char* key) {
+    auto len = std::strlen(key);
+    if (MAX_KEY_LENGTH < len) {
+      return;
+    }
+    auto hash = utils::hash(key);
+    auto& set = set_(hash);
+    auto way = find_(set, hash, key, len);
+    if (way != NUM_WAYS) {
+      set.valids &= ~(1U << way);
+      set.refs &= ~(1U << way);
+    }
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_CACHED_DICTIONARY_HPP
@@ -0,0 +1,129 @@
+#ifndef DDD_COMPRESSION_HPP
+#define DDD_COMPRESSION_HPP
+
+#include "Basic.hpp"
+
+namespace ddd {
+
+namespace utils {
+
+inline void append_varint(uint64_t value, std::string& dst) { // 7 bits a byte, LEB128
+  while (0x80 <= value) {
+    dst += static_cast<char>((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  dst += static_cast<char>(value);
+}
+
+inline bool read_varint(const char*& src, const char* end, uint64_t& value) {
+  value = 0;
+  for (uint32_t shift = 0; src != end && shift < 64; shift += 7) {
+    auto byte = static_cast<uint8_t>(*src++);
+    value |= uint64_t{byte & 0x7FU} << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr uint32_t LZ_HASH_BITS = 16;
+
+// compresses src by LZ77 with a hash table of the last position of each
+// 4-byte string, as fast as LZ4 but without entropy coding. dst is a series
+// of a literal length, the literals, a match length and a match offset, all
+// varint-coded, ended by a match length of 0.
+inline void lz_compress(const char* src, size_t size, std::string& dst) {
+  auto hash = [](uint32_t word) {
+    return (word * 2654435761U) >> (32 - LZ_HASH_BITS);
+  };
+  std::vector<size_t> table(size_t{1} << LZ_HASH_BITS, 0); // positions plus one
+  dst.clear();
+  dst.reserve(size / 2);
+
+  size_t anchor = 0, pos = 0;
+  while (pos + LZ_MIN_MATCH <= size) {
+    uint32_t word = 0;
+    std::memcpy(&word, src + pos, 4);
+    auto& entry = table[hash(word)];
+    auto match_end = entry; // the last position plus one, or 0 for none
+    entry = pos + 1;
+
+    uint32_t match_word = 0;
+    if (match_end != 0) {
+      std::memcpy(&match_word, src + match_end - 1, 4);
+    }
+    if (match_end == 0 || match_word != word) {
+      pos += 1 + ((pos - anchor) >> 5); // faster over incompressible bytes
+      continue;
+    }
+    auto match = match_end - 1;
+    auto len = LZ_MIN_MATCH;
+    while (pos + len < size && src[match + len] == src[pos + len]) {
+      ++len;
+    }
+    append_varint(pos - anchor, dst);
+    dst.append(src + anchor, pos - anchor);
+    append_varint(len - LZ_MIN_MATCH + 1, dst);
+    append_varint(pos - match, dst);
+    pos += len;
+    anchor = pos;
+  }
+  append_varint(size - anchor, dst);
+  dst.append(src + anchor, size - anchor);
+  append_varint(0, dst);
+}
+
+// decompresses the output of lz_compress() into dst of exactly size bytes,
+// returning false for broken input
+inline bool lz_decompress(const char* src, size_t src_size, char* dst, size_t size) {
+  const auto end = src + src_size;
+  size_t pos = 0;
+  while (true) {
+    uint64_t lit_len = 0, len = 0, offset = 0;
+    if (!read_varint(src, end, lit_len) || static_cast<uint64_t>(end - src) < lit_len
+        || size - pos < lit_len) {
+      return false;
+    }
+    if (lit_len != 0) { // dst may be null for size 0
+      std::memcpy(dst + pos, src, static_cast<size_t>(lit_len));
+    }
+    src += lit_len;
+    pos += static_cast<size_t>(lit_len);
+
+    if (!read_varint(src, end, len)) {
+      return false;
+    }
+    if (len == 0) {
+      return src == end && pos == size;
+    }
+    len += LZ_MIN_MATCH - 1;
+    if (!read_varint(src, end, offset) || offset == 0 || pos < offset || size - pos < len) {
+      return false;
+    }
+    auto from = dst + pos - offset;
+    if (len <= offset) {
+      std::memcpy(dst + pos, from, static_cast<size_t>(len));
+    } else { // overlapping, repeating the last offset bytes
+      for (uint64_t i = 0; i < len; ++i) {
+        dst[pos + i] = from[i];
+      }
+    }
+    pos += static_cast<size_t>(len);
+  }
+}
+
+} // namespace -- utils
+
+} // namespace -- ddd
+
+#endif // DDD_COMPRESSION_HPP
@@ -3,48 +3,56 @@
 
 #include <algorithm>
 #include <cassert>
+#include <deque>
+#include <queue>
+#include <sstream>
+#include <stdexcept>
 
-#include "Basic.hpp"
+#include "Compression.hpp"
+#include "FrozenDaTrie.hpp"
+#include "TailFreeList.hpp"
 
 namespace ddd {
 
-template<bool WithBLM, bool WithNLM, bool Prefix>
+template<bool WithBLM, bool WithNLM, bool Prefix, bool Wide = false, class Value = uint32_t>
 class DaTrie {
 public:
+  using Traits = IndexTraits<Wide>;
+  using IndexType = typename Traits::Type;
+  using VTraits = ValueTraits<Value>;
+  using ValueType = typename VTraits::Type;
+  using KvPair = BasicKvPair<ValueType>;
+  using Bc = BasicBc<Wide>;
+  using BlockLink = BasicBlockLink<Wide>;
+  using Query = BasicQuery<Wide, Value>;
   using BlockType = typename std::conditional<WithBLM, BlockLink, Block>::type;
+  using FrozenType = FrozenDaTrie<Prefix, Wide, Value>;
 
-  DaTrie() {
+  // All the arrays are drawn from resource, which has to outlive the trie.
+  explicit DaTrie(MemoryResource* resource = new_delete_resource())
+    : bc_(resource), tail_(resource), blocks_(resource), node_links_(resource),
+      tail_holes_(resource), label_pool_(resource), label_holes_(resource),
+      jump_table_(resource), profile_(resource) {
     if (Prefix) {
       fix_(ROOT_POS, blocks_);
-      bc_[ROOT_POS].set_base(INVALID_VALUE);
-      bc_[ROOT_POS].set_check(INVALID_VALUE);
+      edit_bc_(ROOT_POS).set_base(Traits::INVALID);
+      edit_bc_(ROOT_POS).set_check(Traits::INVALID);
     }
   }
 
-  DaTrie(const std::vector<const char*>& prefixes) {
+  DaTrie(const std::vector<const char*>& prefixes,
+         MemoryResource* resource = new_delete_resource()) : DaTrie(resource) {
     assert(Prefix);
 
-    fix_(ROOT_POS, blocks_);
-    bc_[ROOT_POS].set_base(INVALID_VALUE);
-    bc_[ROOT_POS].set_check(INVALID_VALUE);
-
     for (auto prefix : prefixes) {
-      Query query(prefix);
-      search_prefix(query);
-      if (*query.key() == '\0') {
-        continue;
-      }
-      if (bc_[query.node_pos()].base() != INVALID_VALUE) {
-        insert_edge_(query);
-      }
-      while (*query.key() != '\0') {
-        append_edge_(query);
-      }
-      bc_[query.node_pos()].set_base(INVALID_VALUE);
+      register_prefix(prefix);
     }
   }
 
-  DaTrie(std::istream& is) {
+  DaTrie(std::istream& is, MemoryResource* resource = new_delete_resource())
+    : bc_(resource), tail_(resource), blocks_(resource), node_links_(resource),
+      tail_holes_(resource), label_pool_(resource), label_holes_(resource),
+      jump_table_(resource), profile_(resource) {
     utils::read_vector(bc_, is);
     utils::read_vector(tail_, is);
     utils::read_vector(blocks_, is);
@@ -52,54 +60,90 @@ public:
     utils::read_value(head_pos_, is);
     utils::read_value(bc_emps_, is);
     utils::read_value(tail_emps_, is);
+    utils::read_value(tail_saved_, is);
+    utils::read_value(shared_tail_, is);
+    utils::read_vector(label_pool_, is);
+    if (is && !remake_holes_()) {
+      is.setstate(std::ios::failbit);
+    }
   }
 
   ~DaTrie() {}
 
-  bool search_key(Query& query) const {
-    assert(query.node_pos() < bc_.size());
-    assert(bc_[query.node_pos()].is_fixed());
-    assert(!Prefix);
-
-    while (!bc_[query.node_pos()].is_leaf()) {
-      auto child_pos = bc_[query.node_pos()].base() ^query.label();
-      if (bc_[child_pos].check() != query.node_pos()) {
-        return false;
-      }
-      query.next(child_pos);
-    }
-
-    auto value = bc_[query.node_pos()].value();
-    if (query.is_finished()) {
-      query.set_value(value);
-      return true;
+  // replaces the trie with one of a file written before the container, of
+  // the arrays and the counters alone, where the members added since keep
+  // their defaults and the holes are remade. Such files have narrow indices
+  // and 32-bit values. Sets the failbit of is for bytes that cannot be such a
+  // trie, allocating no array past max_bytes, and leaves the trie as it is.
+  void read_legacy(std::istream& is, uint64_t max_bytes) {
+    constexpr bool IS_LEGACY = !Wide && std::is_same<Value, uint32_t>::value;
+
+    DaTrie trie(resource());
+    if (IS_LEGACY) {
+      utils::read_vector(trie.bc_, is, max_bytes);
+      utils::read_vector(trie.tail_, is, max_bytes);
+      utils::read_vector(trie.blocks_, is, max_bytes);
+      utils::read_vector(trie.node_links_, is, max_bytes);
+      utils::read_value(trie.head_pos_, is);
+      utils::read_value(trie.bc_emps_, is);
+      utils::read_value(trie.tail_emps_, is);
+    }
+    if (!IS_LEGACY || !is || trie.bc_.empty() || trie.bc_.size() % BLOCK_SIZE != 0
+        || trie.blocks_.size() != trie.bc_.size() / BLOCK_SIZE
+        || (WithNLM && trie.node_links_.size() != trie.bc_.size())
+        || !trie.remake_holes_()) {
+      is.setstate(std::ios::failbit);
+      return;
     }
+    swap(trie);
+  }
 
-    uint32_t len = 0;
-    auto tail = tail_.data() + value;
-    if (!utils::match(query.key(), tail, len)) {
-      return false;
+  bool search_key(Query& query) const {
+    if (profile_period_ != 0
+        && __atomic_add_fetch(&profile_tick_, 1, __ATOMIC_RELAXED) % profile_period_ == 0) {
+      Query path(query.key());
+      path.set_node_pos(query.node_pos());
+      walk_(path, [&](IndexType node_pos) {
+        if (node_pos < profile_.size()) { // not for nodes added since profiling
+          __atomic_add_fetch(&profile_[node_pos], 1, __ATOMIC_RELAXED);
+        }
+      });
     }
-    query.set_value(utils::extract_value(tail + len));
-    return true;
+    uint32_t num_matched = NOT_FOUND;
+    return search_(query, num_matched);
   }
 
   bool insert_key(Query& query) {
     assert(!Prefix);
 
+    auto key = query.key();
     if (bc_.empty()) { // first insert
       fix_(ROOT_POS, blocks_);
-      bc_[ROOT_POS].set_check(INVALID_VALUE);
+      edit_bc_(ROOT_POS).set_check(Traits::INVALID);
       insert_tail_(query);
       return true;
     }
 
-    if (search_key(query)) {
+    uint32_t num_matched = NOT_FOUND;
+    if (search_(query, num_matched)) {
       return false;
     }
 
-    bc_[query.node_pos()].is_leaf() ? insert_branch_(query) : insert_edge_(query);
+    // the new entry and the rest of a branched leaf, reserved before any change
+    if (!reserve_tail_(utils::length(query.key()) + 2 * (VTraits::BYTES + sizeof(IndexType)))) {
+      throw std::length_error("ddd: TAIL exceeds the positions of leaves");
+    }
+    if (num_matched != NOT_FOUND) { // mismatched inside a compressed edge
+      split_edge_(query, num_matched);
+      insert_edge_(query);
+    } else {
+      bc_[query.node_pos()].is_leaf() ? insert_branch_(query) : insert_edge_(query);
+    }
     insert_tail_(query);
+
+    if (!jump_table_.empty() && key[0] != '\0' && key[1] != '\0') {
+      link_jump_(static_cast<uint8_t>(key[0]), static_cast<uint8_t>(key[1]));
+    }
     return true;
   }
 
@@ -108,12 +152,16 @@ public:
     assert(bc_[query.node_pos()].is_fixed());
     assert(!Prefix);
 
-    if (!search_key(query)) {
+    uint32_t num_matched = NOT_FOUND;
+    if (!search_(query, num_matched)) { // not profiled as a search
       return false;
     }
 
     if (query.node_pos() == ROOT_POS) {
-      DaTrie().swap(*this);
+      DaTrie trie(resource());
+      trie.shared_tail_ = shared_tail_;
+      trie.jump_table_.swap(jump_table_); // with no depth-2 nodes
+      trie.swap(*this);
       return true;
     }
 
@@ -121,20 +169,25 @@ public:
       delete_sib_(query.node_pos());
     }
 
-    if (!is_terminal_(query.node_pos())) {
-      auto tail_pos = bc_[query.node_pos()].value();
-      tail_emps_ += utils::length(tail_.data() + tail_pos) + sizeof(uint32_t);
+    auto leaf = bc_[query.node_pos()].value();
+    if (is_terminal_(query.node_pos())) {
+      free_terminal_(leaf);
+    } else if (shared_tail_ && !is_inline_(leaf)) {
+      drop_shared_tail_(leaf, utils::length(tail_suffix_(leaf)) + VTraits::BYTES);
+    } else if (!is_inline_(leaf)) {
+      free_tail_(leaf, utils::length(tail_.data() + leaf) + VTraits::BYTES);
     }
 
     auto parent_pos = bc_[query.node_pos()].check();
+    relink_jump_(query.node_pos(), ROOT_POS);
     unfix_(query.node_pos(), blocks_);
-    query.prev(parent_pos);
+    query.set_node_pos(parent_pos);
 
     change_branch_(query);
     return true;
   }
 
-  void enumerate(uint32_t node_pos, const std::string& prefix, std::vector<KvPair>& kvs) const {
+  void enumerate(IndexType node_pos, const std::string& prefix, std::vector<KvPair>& kvs) const {
     assert(node_pos < bc_.size());
     assert(bc_[node_pos].is_fixed());
     assert(!Prefix);
@@ -143,29 +196,34 @@ public:
       KvPair kv;
       kv.key = prefix;
       if (is_terminal_(node_pos)) {
-        kv.value = bc_[node_pos].value();
+        kv.value = terminal_value_(bc_[node_pos].value());
       } else {
-        auto tail_pos = bc_[node_pos].value();
-        while (tail_[tail_pos] != '\0') {
-          kv.key += tail_[tail_pos++];
+        char buf[MAX_INLINE_LENGTH + 1];
+        auto tail = leaf_suffix_(bc_[node_pos].value(), buf);
+        while (*tail != '\0') {
+          kv.key += *tail++;
         }
-        kv.key += tail_[tail_pos++];
-        kv.value = utils::extract_value(tail_.data() + tail_pos);
+        kv.key += *tail++;
+        kv.value = leaf_value_(bc_[node_pos].value(), tail);
       }
       kvs.push_back(kv);
       return;
     }
 
-    auto base = bc_[node_pos].base();
+    uint32_t len = 0;
+    auto labels = labels_(node_pos, len);
+    const auto _prefix = prefix + std::string(labels, len);
+
+    auto base = base_(node_pos);
     auto child_pos = base ^static_cast<uint8_t>('\0');
     if (bc_[child_pos].check() == node_pos) {
-      enumerate(child_pos, prefix, kvs);
+      enumerate(child_pos, _prefix, kvs);
     }
 
     for (uint32_t label = 1; label < 256; ++label) {
       child_pos = base ^ label;
       if (bc_[child_pos].check() == node_pos) {
-        enumerate(child_pos, prefix + static_cast<char>(label), kvs);
+        enumerate(child_pos, _prefix + static_cast<char>(label), kvs);
       }
     }
   }
@@ -189,7 +247,7 @@ public:
       edge_(query.node_pos(), edge);
 
       auto base = excheck_(edge, blocks_);
-      if (base == NOT_FOUND) {
+      if (base == Traits::NOT_FOUND) {
         break;
       }
 
@@ -200,44 +258,228 @@ public:
 
   void pack_tail() {
     assert(!Prefix);
+    pack_tail_(shared_tail_);
+  }
 
-    std::vector<char> tail;
-    tail.reserve(tail_.size() - tail_emps_);
-
-    tail_.swap(tail);
-
-    for (uint32_t node_pos = 0; node_pos < bc_size(); ++node_pos) {
-      if (bc_[node_pos].is_leaf() && !is_terminal_(node_pos)) {
-        auto _tail = tail.data() + bc_[node_pos].value();
-        Query query(_tail);
-        query.set_value(utils::extract_value(_tail + utils::length(_tail)));
-        query.set_node_pos(node_pos);
-        insert_tail_(query);
-      }
+  // In the shared mode, identical suffixes (and suffixes of suffixes) in TAIL
+  // are stored once. Each leaf keeps its own entry of the value followed by
+  // either the suffix or a reference to the shared one, so the value does not
+  // have to move out of TAIL. Sharing is built by pack_tail() and rebuild();
+  // entries written in the meantime are not shared, and dead bytes are only
+  // counted in tail_emps() until the next build because other leaves may
+  // refer to them.
+  void set_shared_tail(bool shared) {
+    assert(!Prefix);
+    if (shared_tail_ != shared) {
+      pack_tail_(shared);
     }
-    tail_emps_ = 0;
   }
 
   void rebuild() {
     assert(!Prefix);
 
-    DaTrie new_trie;
+    DaTrie new_trie(resource());
+    new_trie.layout_ = layout_;
+    new_trie.edge_compression_ = edge_compression_;
 
     const auto bc_capa = num_nodes() / 256 * 256 + 1024; // expecting avoidance of reallocation
     new_trie.bc_.reserve(bc_capa);
     new_trie.tail_.reserve(tail_.size() - tail_emps_);
+    new_trie.label_pool_.reserve(label_pool_.size());
     new_trie.blocks_.reserve(bc_capa / 256);
     if (WithNLM) {
       new_trie.node_links_.reserve(bc_capa);
     }
 
     rebuild_(new_trie);
+    if (shared_tail_) {
+      new_trie.pack_tail_(true);
+    }
     swap(new_trie);
+    if (!new_trie.jump_table_.empty()) {
+      set_jump_table(true);
+    }
+    set_profiling(new_trie.profile_period_); // the old profile is consumed
+  }
+
+  // makes frozen a read-only copy with the nodes and TAIL packed as by
+  // rebuild() in the shared mode, leaving the trie as it is
+  void freeze(FrozenType& frozen) const {
+    if (Prefix || is_empty()) {
+      frozen.build_(*this);
+      return;
+    }
+    DaTrie trie(resource());
+    rebuild_(trie);
+    trie.pack_tail_(true);
+    frozen.build_(trie);
+  }
+
+  // replaces the trie with an updatable copy of frozen, keeping the settings
+  void thaw(const FrozenType& frozen) {
+    DaTrie new_trie(resource());
+    new_trie.layout_ = layout_;
+    new_trie.edge_compression_ = edge_compression_;
+    new_trie.tail_.assign(frozen.tail_.begin(), frozen.tail_.end());
+    new_trie.shared_tail_ = frozen.shared_tail_;
+    new_trie.no_inline_ = Traits::INLINE_FLAG < new_trie.tail_.size();
+
+    if (!Prefix && !frozen.is_empty()) {
+      new_trie.fix_(ROOT_POS, new_trie.blocks_);
+      new_trie.edit_bc_(ROOT_POS).set_check(Traits::INVALID);
+    }
+
+    using NodePair = std::pair<IndexType, IndexType>;
+    std::vector<NodePair> np_stack;
+    if (!frozen.is_empty()) {
+      np_stack.push_back({ROOT_POS, ROOT_POS});
+    }
+    Edge edge;
+
+    while (!np_stack.empty()) {
+      const NodePair node_pair = np_stack.back();
+      np_stack.pop_back();
+
+      if (frozen.units_[node_pair.first].is_leaf()) {
+        new_trie.edit_bc_(node_pair.second).set_value(frozen.units_[node_pair.first].value());
+        continue;
+      }
+      frozen.edge_(node_pair.first, edge);
+      if (edge.size() == 0) { // a registered prefix without keys
+        new_trie.edit_bc_(node_pair.second).set_base(Traits::INVALID);
+        continue;
+      }
+
+      uint32_t len = 0;
+      auto labels = frozen.labels_(node_pair.first, len);
+      auto base = new_trie.xcheck_(edge, new_trie.blocks_);
+      new_trie.compress_(node_pair.second, labels, len, base);
+      if (WithNLM) {
+        new_trie.edit_link_(node_pair.second).child = edge[0];
+      }
+
+      auto frozen_base = frozen.base_(node_pair.first);
+      for (size_t i = 0; i < edge.size(); ++i) {
+        auto child_pos = base ^edge[i];
+        new_trie.fix_(child_pos, new_trie.blocks_);
+        new_trie.edit_bc_(child_pos).set_check(node_pair.second);
+        if (WithNLM) { // the siblings are linked circularly in the label order
+          new_trie.edit_link_(child_pos).sib = edge[(i + 1) % edge.size()];
+        }
+        np_stack.push_back({frozen_base ^ edge[i], child_pos});
+      }
+    }
+
+    swap(new_trie);
+    if (!Prefix) {
+      if (!new_trie.jump_table_.empty()) {
+        set_jump_table(true);
+      }
+      set_profiling(new_trie.profile_period_);
+    }
+  }
+
+  // While profiling, every period-th search_key() counts the nodes it visits
+  // by relaxed atomic increments, so that concurrent searches stay
+  // thread-safe. rebuild() lays out the nodes hottest first by the counts, so
+  // that hot sibling sets share cache lines and blocks. A period of 0 stops
+  // counting, keeping the counts for rebuild().
+  void set_profiling(uint32_t period) {
+    assert(!Prefix);
+
+    if (period != 0) {
+      profile_.assign(bc_size(), 0);
+    }
+    profile_period_ = period;
+    profile_tick_ = 0;
+  }
+
+  bool has_profile() const {
+    return !profile_.empty();
+  }
+
+  // the node order of rebuild() without a profile, not written
+  void set_layout(Layout layout) {
+    layout_ = layout;
+  }
+
+  // whether rebuild() collapses single-child chains into compressed edges,
+  // not written. The edges are flagged in the base field, so that a trie with
+  // them takes at most Traits::LABEL_FLAG BC slots. rebuild() without the
+  // setting expands the edges of the trie again.
+  void set_edge_compression(bool enabled) {
+    assert(!Prefix);
+    edge_compression_ = enabled;
+  }
+
+  bool has_edge_compression() const {
+    return edge_compression_;
+  }
+
+  // records the byte ranges that searching query reads, leaving query where it
+  // stops, and returns whether it reaches a leaf. The jump table is not used.
+  bool trace_key(Query& query, AccessTrace& trace) const {
+    auto is_leaf = walk_(query, [&](IndexType node_pos) {
+      trace.emplace_back(&bc_[node_pos], sizeof(Bc));
+      uint32_t len = 0;
+      auto labels = labels_(node_pos, len);
+      if (len != 0) {
+        trace.emplace_back(labels - sizeof(IndexType) - 1, sizeof(IndexType) + 1 + len);
+      }
+    });
+    if (!is_leaf) {
+      return false;
+    }
+
+    auto leaf = bc_[query.node_pos()].value();
+    if (Prefix) {
+      query.set_value(is_terminal_(query.node_pos()) ? terminal_value_(leaf)
+                                                     : static_cast<ValueType>(leaf));
+      return true;
+    }
+    if (query.is_finished() || is_inline_(leaf)) {
+      return true;
+    }
+
+    auto entry = tail_.data() + leaf;
+    auto suffix = tail_suffix_(leaf);
+    auto suffix_end = suffix + utils::length(suffix);
+    if (suffix != entry && suffix != entry + VTraits::BYTES) { // a reference to a shared one
+      trace.emplace_back(entry, VTraits::BYTES + sizeof(IndexType));
+      trace.emplace_back(suffix, suffix_end - suffix);
+    } else {
+      trace.emplace_back(entry, suffix_end - entry + (shared_tail_ ? 0 : VTraits::BYTES));
+    }
+    return true;
+  }
+
+  // The jump table maps the first two labels of a key to its node at depth 2,
+  // or to ROOT_POS if there is none, so that search_key() and insert_key()
+  // skip the first two transitions. It takes 2^16 indices and is not written.
+  // Nodes under compressed edges of the root and its children are not linked.
+  void set_jump_table(bool enabled) {
+    assert(!Prefix);
+
+    ResourceVector<IndexType>(resource()).swap(jump_table_);
+    if (!enabled) {
+      return;
+    }
+    jump_table_.resize(JUMP_TABLE_SIZE, ROOT_POS);
+    for (uint32_t label = 1; label < 256; ++label) {
+      for (uint32_t label2 = 1; label2 < 256; ++label2) {
+        link_jump_(static_cast<uint8_t>(label), static_cast<uint8_t>(label2));
+      }
+    }
+  }
+
+  bool has_jump_table() const {
+    return !jump_table_.empty();
   }
 
   void shrink() {
     bc_.shrink_to_fit();
     tail_.shrink_to_fit();
+    label_pool_.shrink_to_fit();
     blocks_.shrink_to_fit();
     if (WithNLM) {
       node_links_.shrink_to_fit();
@@ -252,7 +494,7 @@ public:
 
     while (!bc_[query.node_pos()].is_leaf()) {
       auto base = bc_[query.node_pos()].base();
-      if (base == INVALID_VALUE) {
+      if (base == Traits::INVALID) {
         return false;
       }
       auto child_pos = base ^query.label();
@@ -262,21 +504,47 @@ public:
       query.next(child_pos);
     }
 
-    query.set_value(bc_[query.node_pos()].value());
+    auto leaf = bc_[query.node_pos()].value();
+    query.set_value(is_terminal_(query.node_pos()) ? terminal_value_(leaf)
+                                                   : static_cast<ValueType>(leaf));
     return true;
   }
 
+  // for prefix trie, makes prefix a path whose keys go to longer prefixes
+  void register_prefix(const char* prefix) {
+    assert(Prefix);
+
+    Query query(prefix);
+    search_prefix(query);
+    assert(!bc_[query.node_pos()].is_leaf()); // or its keys are in a suffix subtrie
+
+    if (*query.key() == '\0') {
+      return;
+    }
+    if (bc_[query.node_pos()].base() != Traits::INVALID) {
+      insert_edge_(query);
+    }
+    while (*query.key() != '\0') {
+      append_edge_(query);
+    }
+    edit_bc_(query.node_pos()).set_base(Traits::INVALID);
+  }
+
   // for prefix trie
   void insert_prefix_leaf(Query& query) {
     assert(query.node_pos() < bc_.size());
     assert(Prefix);
 
-    if (bc_[query.node_pos()].base() != INVALID_VALUE) {
+    if (bc_[query.node_pos()].base() != Traits::INVALID) {
       insert_edge_(query);
     } else {
       append_edge_(query);
     }
-    bc_[query.node_pos()].set_value(query.value());
+    if (query.is_finished()) {
+      edit_bc_(query.node_pos()).set_value(make_terminal_(query.value()));
+    } else { // linking to a suffix subtrie
+      edit_bc_(query.node_pos()).set_value(static_cast<IndexType>(query.value()));
+    }
   }
 
   // for prefix trie
@@ -292,39 +560,48 @@ public:
     if (WithNLM) {
       delete_sib_(query.node_pos());
     }
+    if (is_terminal_(query.node_pos())) {
+      free_terminal_(bc_[query.node_pos()].value());
+    }
 
     unfix_(query.node_pos(), blocks_);
     if (edge_size == 1) {
-      bc_[parent_pos].set_base(INVALID_VALUE);
+      edit_bc_(parent_pos).set_base(Traits::INVALID);
     }
   }
 
-  // for prefix trie
-  void enumerate_prefix(uint32_t node_pos, const std::string& prefix,
-                        std::vector<KvPair>& kvs) const {
+  // for prefix trie, terminals[i] tells if kvs[i] is a key or a suffix link
+  void enumerate_prefix(IndexType node_pos, const std::string& prefix,
+                        std::vector<KvPair>& kvs, std::vector<bool>& terminals) const {
     assert(node_pos < bc_.size());
     assert(bc_[node_pos].is_fixed());
     assert(Prefix);
 
     if (bc_[node_pos].is_leaf()) {
-      auto value = bc_[node_pos].value();
+      auto leaf = bc_[node_pos].value();
       if (is_terminal_(node_pos)) {
-        value |= (1U << 31);
+        kvs.push_back(KvPair{prefix, terminal_value_(leaf)});
+        terminals.push_back(true);
+      } else {
+        kvs.push_back(KvPair{prefix, static_cast<ValueType>(leaf)});
+        terminals.push_back(false);
       }
-      kvs.push_back(KvPair{prefix, value});
       return;
     }
 
     auto base = bc_[node_pos].base();
+    if (base == Traits::INVALID) { // a registered prefix without keys
+      return;
+    }
     auto child_pos = base ^static_cast<uint8_t>('\0');
     if (bc_[child_pos].check() == node_pos) {
-      enumerate_prefix(child_pos, prefix, kvs);
+      enumerate_prefix(child_pos, prefix, kvs, terminals);
     }
 
     for (uint32_t label = 1; label < 256; ++label) {
       child_pos = base ^ label;
       if (bc_[child_pos].check() == node_pos) {
-        enumerate_prefix(child_pos, prefix + static_cast<char>(label), kvs);
+        enumerate_prefix(child_pos, prefix + static_cast<char>(label), kvs, terminals);
       }
     }
   }
@@ -333,13 +610,17 @@ public:
     return bc_.empty();
   }
 
-  uint32_t num_nodes() const {
+  MemoryResource* resource() const {
+    return bc_.get_allocator().resource();
+  }
+
+  IndexType num_nodes() const {
     return bc_size() - bc_emps();
   };
 
-  uint32_t num_singles() const { // not in constant time
-    uint32_t ret = 0;
-    for (uint32_t i = 0; i < bc_size(); ++i) {
+  IndexType num_singles() const { // not in constant time
+    IndexType ret = 0;
+    for (IndexType i = 0; i < bc_size(); ++i) {
       if (!bc_[i].is_fixed()) {
         continue;
       }
@@ -350,34 +631,67 @@ public:
     return ret;
   }
 
-  uint32_t num_blocks() const {
-    return static_cast<uint32_t>(blocks_.size());
+  void leaf_stat(LeafStat& ret) const { // not in constant time
+    for (IndexType i = 0; i < bc_size(); ++i) {
+      if (!bc_[i].is_fixed() || !bc_[i].is_leaf()) {
+        continue;
+      }
+      if (is_terminal_(i)) {
+        ++ret.num_terminals;
+      } else if (Prefix) { // linking to a suffix subtrie
+        continue;
+      } else if (is_inline_(bc_[i].value())) {
+        ++ret.num_inlines;
+      } else {
+        ++ret.num_tails;
+      }
+    }
+  }
+
+  IndexType num_blocks() const {
+    return static_cast<IndexType>(blocks_.size());
   }
 
-  uint32_t bc_size() const {
-    return static_cast<uint32_t>(bc_.size());
+  IndexType bc_size() const {
+    return static_cast<IndexType>(bc_.size());
   }
 
-  uint32_t bc_capa() const {
-    return static_cast<uint32_t>(bc_.capacity());
+  IndexType bc_capa() const {
+    return static_cast<IndexType>(bc_.capacity());
   }
 
-  uint32_t bc_emps() const {
+  IndexType bc_emps() const {
     return bc_emps_;
   }
 
-  uint32_t tail_size() const {
-    return static_cast<uint32_t>(tail_.size());
+  IndexType tail_size() const {
+    return static_cast<IndexType>(tail_.size());
   }
 
-  uint32_t tail_capa() const {
-    return static_cast<uint32_t>(tail_.capacity());
+  IndexType tail_capa() const {
+    return static_cast<IndexType>(tail_.capacity());
   }
 
-  uint32_t tail_emps() const {
+  IndexType tail_emps() const {
     return tail_emps_;
   }
 
+  size_t tail_holes() const {
+    return tail_holes_.num_holes();
+  }
+
+  size_t hole_size() const { // of the lists in memory, in bytes
+    return tail_holes_.size_in_bytes() + label_holes_.size_in_bytes();
+  }
+
+  IndexType tail_saved() const {
+    return tail_saved_;
+  }
+
+  IndexType label_size() const {
+    return static_cast<IndexType>(label_pool_.size());
+  }
+
   size_t size_in_bytes() const {
     size_t size = 0;
     size += utils::size_in_bytes(bc_);
@@ -387,9 +701,14 @@ public:
     size += sizeof(head_pos_);
     size += sizeof(bc_emps_);
     size += sizeof(tail_emps_);
+    size += sizeof(tail_saved_);
+    size += sizeof(shared_tail_);
+    size += utils::size_in_bytes(label_pool_);
     return size;
   }
 
+  // writes the arrays and the counters, but not the lists of holes, which
+  // the reader remakes from the entries
   void write(std::ostream& os) const {
     utils::write_vector(bc_, os);
     utils::write_vector(tail_, os);
@@ -398,95 +717,750 @@ public:
     utils::write_value(head_pos_, os);
     utils::write_value(bc_emps_, os);
     utils::write_value(tail_emps_, os);
+    utils::write_value(tail_saved_, os);
+    utils::write_value(shared_tail_, os);
+    utils::write_vector(label_pool_, os);
+  }
+
+  // hashes the chunks of the arrays, blocks of BC and pages of the others,
+  // and the other members as written, for write_delta(). Only the chunks
+  // changed since the last call are rehashed, updating the hashes kept in
+  // the trie, so calls must not overlap.
+  void hash_chunks(TrieHashes& ret) const {
+    ret.arrays[0] = chunk_hashes_[0].update(bc_, BLOCK_SIZE);
+    ret.arrays[1] = chunk_hashes_[1].update(tail_, DELTA_PAGE_SIZE);
+    ret.arrays[2] = chunk_hashes_[2].update(blocks_, BLOCK_SIZE);
+    ret.arrays[3] = chunk_hashes_[3].update(node_links_, BLOCK_SIZE);
+    ret.arrays[4] = chunk_hashes_[4].update(label_pool_, DELTA_PAGE_SIZE);
+    std::ostringstream oss;
+    write_rest_(oss);
+    auto rest = oss.str();
+    ret.rest = utils::hash_bytes(rest.data(), rest.size());
+  }
+
+  // writes the chunks whose hashes changed from base to now, which are of the
+  // trie as written before and of the trie itself, and the other members
+  void write_delta(const TrieHashes& base, const TrieHashes& now, std::ostream& os) const {
+    utils::write_chunks(bc_, BLOCK_SIZE, base.arrays[0], now.arrays[0], os);
+    utils::write_chunks(tail_, DELTA_PAGE_SIZE, base.arrays[1], now.arrays[1], os);
+    utils::write_chunks(blocks_, BLOCK_SIZE, base.arrays[2], now.arrays[2], os);
+    utils::write_chunks(node_links_, BLOCK_SIZE, base.arrays[3], now.arrays[3], os);
+    utils::write_chunks(label_pool_, DELTA_PAGE_SIZE, base.arrays[4], now.arrays[4], os);
+    write_rest_(os);
+  }
+
+  // applies a delta written against the trie as it is
+  void read_delta(std::istream& is) {
+    utils::read_chunks(bc_, BLOCK_SIZE, is, chunk_hashes_[0]);
+    utils::read_chunks(tail_, DELTA_PAGE_SIZE, is, chunk_hashes_[1]);
+    utils::read_chunks(blocks_, BLOCK_SIZE, is, chunk_hashes_[2]);
+    utils::read_chunks(node_links_, BLOCK_SIZE, is, chunk_hashes_[3]);
+    utils::read_chunks(label_pool_, DELTA_PAGE_SIZE, is, chunk_hashes_[4]);
+    utils::read_value(head_pos_, is);
+    utils::read_value(bc_emps_, is);
+    utils::read_value(tail_emps_, is);
+    utils::read_value(tail_saved_, is);
+    utils::read_value(shared_tail_, is);
+    if (!is || !remake_holes_()) {
+      is.setstate(std::ios::failbit);
+      return;
+    }
+
+    if (has_jump_table()) { // remade for the new nodes
+      set_jump_table(true);
+    }
+    if (has_profile()) {
+      profile_.assign(bc_size(), 0);
+    }
+  }
+
+  // writes the trie rebuilt with TAIL packed as freeze(), for archives. The
+  // nodes are written in the depth-first order by their labels and values,
+  // varint-coded, instead of BC, and TAIL is compressed by utils::lz_compress().
+  void write_compressed(std::ostream& os) const {
+    if (Prefix || is_empty()) {
+      write_compressed_(os);
+      return;
+    }
+    DaTrie trie(resource());
+    rebuild_(trie);
+    trie.pack_tail_(true);
+    trie.write_compressed_(os);
+  }
+
+  // replaces the trie with one written by write_compressed(), keeping the
+  // settings, where the nodes are placed again as thaw(). Sets the failbit of
+  // is for broken bytes, leaving the trie as it is.
+  void read_compressed(std::istream& is) {
+    std::vector<char> nodes, packed_tail;
+    uint64_t tail_size = 0;
+    bool shared_tail = false;
+    utils::read_vector(nodes, is);
+    utils::read_value(tail_size, is);
+    utils::read_vector(packed_tail, is);
+    utils::read_value(shared_tail, is);
+    if (!is) {
+      return;
+    }
+
+    DaTrie new_trie(resource());
+    new_trie.layout_ = layout_;
+    new_trie.edge_compression_ = edge_compression_;
+    new_trie.tail_.resize(static_cast<size_t>(tail_size));
+    new_trie.shared_tail_ = shared_tail;
+    new_trie.no_inline_ = Traits::INLINE_FLAG < new_trie.tail_.size();
+    if (!utils::lz_decompress(packed_tail.data(), packed_tail.size(),
+                              new_trie.tail_.data(), new_trie.tail_.size())
+        || !new_trie.read_nodes_(nodes)) {
+      is.setstate(std::ios::failbit);
+      return;
+    }
+
+    swap(new_trie);
+    if (!Prefix) {
+      if (!new_trie.jump_table_.empty()) {
+        set_jump_table(true);
+      }
+      set_profiling(new_trie.profile_period_);
+    }
+  }
+
+  void swap(DaTrie& rhs) {
+    bc_.swap(rhs.bc_);
+    tail_.swap(rhs.tail_);
+    blocks_.swap(rhs.blocks_);
+    node_links_.swap(rhs.node_links_);
+    std::swap(head_pos_, rhs.head_pos_);
+    std::swap(bc_emps_, rhs.bc_emps_);
+    std::swap(tail_emps_, rhs.tail_emps_);
+    tail_holes_.swap(rhs.tail_holes_);
+    std::swap(tail_saved_, rhs.tail_saved_);
+    std::swap(no_inline_, rhs.no_inline_);
+    std::swap(shared_tail_, rhs.shared_tail_);
+    label_pool_.swap(rhs.label_pool_);
+    label_holes_.swap(rhs.label_holes_);
+    jump_table_.swap(rhs.jump_table_);
+    profile_.swap(rhs.profile_);
+    std::swap(profile_period_, rhs.profile_period_);
+    std::swap(profile_tick_, rhs.profile_tick_);
+    std::swap(layout_, rhs.layout_);
+    std::swap(edge_compression_, rhs.edge_compression_);
+    for (uint32_t i = 0; i < TrieHashes::NUM_ARRAYS; ++i) {
+      chunk_hashes_[i].swap(rhs.chunk_hashes_[i]);
+    }
+  }
+
+  DaTrie(const DaTrie&) = delete;
+  DaTrie& operator=(const DaTrie&) = delete;
+
+protected:
+  template<bool, bool, class> friend class FrozenDaTrie;
+
+  ResourceVector<Bc> bc_;
+  ResourceVector<char> tail_;
+  ResourceVector<BlockType> blocks_;
+  ResourceVector<NodeLink> node_links_;
+
+  IndexType head_pos_ = Traits::NOT_FOUND;
+  IndexType bc_emps_ = 0; // in bc_
+  IndexType tail_emps_ = 0; // in tail_
+  TailFreeList<Wide> tail_holes_; // holes in tail_ of tail_emps_ bytes in total
+  IndexType tail_saved_ = 0; // bytes saved by the last suffix sharing
+  bool shared_tail_ = false;
+  bool no_inline_ = false; // whether TAIL may pass Traits::INLINE_FLAG, see expel_inline_()
+  ResourceVector<char> label_pool_; // for compressed edges
+  TailFreeList<Wide> label_holes_; // holes in label_pool_
+  ResourceVector<IndexType> jump_table_; // empty unless enabled
+  // access counts of nodes, empty unless profiled, and the searches since
+  // profiling, both updated by __atomic builtins in search_key()
+  mutable ResourceVector<uint32_t> profile_;
+  uint32_t profile_period_ = 0;
+  mutable uint32_t profile_tick_ = 0;
+  Layout layout_ = Layout::DFS;
+  bool edge_compression_ = false;
+  // of the arrays in the order of TrieHashes, kept by hash_chunks()
+  mutable utils::ChunkHashes chunk_hashes_[TrieHashes::NUM_ARRAYS];
+
+  static constexpr uint32_t JUMP_TABLE_SIZE = 1U << 16;
+  static constexpr size_t DELTA_PAGE_SIZE = size_t{1} << 12; // in bytes, for deltas
+
+  void write_rest_(std::ostream& os) const { // all but the arrays in deltas
+    utils::write_value(head_pos_, os);
+    utils::write_value(bc_emps_, os);
+    utils::write_value(tail_emps_, os);
+    utils::write_value(tail_saved_, os);
+    utils::write_value(shared_tail_, os);
+  }
+
+  // Each node in write_compressed() begins with a varint of the kind in the
+  // lowest 2 bits and, above them, the TAIL position relative to the last
+  // one, the leaf value, or the number of children, which the length and the
+  // labels of the compressed edge and the child labels by gaps follow.
+  static constexpr uint64_t NODE_TAIL_LEAF = 0;
+  static constexpr uint64_t NODE_LEAF = 1;
+  static constexpr uint64_t NODE_INTERNAL = 2;
+
+  void write_compressed_(std::ostream& os) const { // of the trie as it is
+    std::string nodes;
+    std::vector<IndexType> node_stack;
+    if (!is_empty()) {
+      node_stack.push_back(ROOT_POS);
+    }
+    Edge edge;
+    uint8_t labels[256];
+    int64_t tail_pos = 0;
+
+    while (!node_stack.empty()) {
+      auto node_pos = node_stack.back();
+      node_stack.pop_back();
+
+      if (bc_[node_pos].is_leaf()) {
+        auto leaf = bc_[node_pos].value();
+        if (!Prefix && !is_terminal_(node_pos) && !is_inline_(leaf)) {
+          auto diff = static_cast<int64_t>(leaf) - tail_pos;
+          utils::append_varint(utils::zigzag(diff) << 2 | NODE_TAIL_LEAF, nodes);
+          tail_pos = static_cast<int64_t>(leaf);
+        } else {
+          utils::append_varint(static_cast<uint64_t>(leaf) << 2 | NODE_LEAF, nodes);
+        }
+        continue;
+      }
+      edge_(node_pos, edge);
+      utils::append_varint(uint64_t{edge.size()} << 2 | NODE_INTERNAL, nodes);
+      if (edge.size() == 0) { // a registered prefix without keys
+        continue;
+      }
+
+      uint32_t len = 0;
+      auto edge_labels = labels_(node_pos, len);
+      nodes += static_cast<char>(len);
+      nodes.append(edge_labels, len);
+
+      std::copy(edge.begin(), edge.end(), labels); // in the link order with NLM
+      std::sort(labels, labels + edge.size());
+      nodes += static_cast<char>(labels[0]);
+      for (size_t i = 1; i < edge.size(); ++i) {
+        nodes += static_cast<char>(labels[i] - labels[i - 1] - 1);
+      }
+      auto base = base_(node_pos);
+      for (auto i = edge.size(); i-- > 0;) { // the first child on the top
+        node_stack.push_back(base ^ labels[i]);
+      }
+    }
+
+    std::string packed_tail;
+    utils::lz_compress(tail_.data(), tail_.size(), packed_tail);
+    utils::write_value(static_cast<uint64_t>(nodes.size()), os);
+    os.write(nodes.data(), static_cast<std::streamsize>(nodes.size()));
+    utils::write_value(static_cast<uint64_t>(tail_.size()), os);
+    utils::write_value(static_cast<uint64_t>(packed_tail.size()), os);
+    os.write(packed_tail.data(), static_cast<std::streamsize>(packed_tail.size()));
+    utils::write_value(shared_tail_, os);
+  }
+
+  // places the nodes of write_compressed_() into the trie made only with
+  // TAIL, returning false for broken bytes
+  bool read_nodes_(const std::vector<char>& nodes) {
+    auto src = nodes.data();
+    const auto end = src + nodes.size();
+    std::vector<IndexType> node_stack;
+    if (!nodes.empty()) {
+      if (!Prefix) {
+        fix_(ROOT_POS, blocks_);
+        edit_bc_(ROOT_POS).set_check(Traits::INVALID);
+      }
+      node_stack.push_back(ROOT_POS);
+    }
+    Edge edge;
+    int64_t tail_pos = 0;
+
+    while (!node_stack.empty()) {
+      auto node_pos = node_stack.back();
+      node_stack.pop_back();
+
+      uint64_t header = 0;
+      if (!utils::read_varint(src, end, header)) {
+        return false;
+      }
+      if ((header & 3) == NODE_TAIL_LEAF) {
+        tail_pos += utils::unzigzag(header >> 2);
+        if (tail_pos < 0 || tail_.size() <= static_cast<uint64_t>(tail_pos)) {
+          return false;
+        }
+        edit_bc_(node_pos).set_value(static_cast<IndexType>(tail_pos));
+        continue;
+      }
+      if ((header & 3) == NODE_LEAF) {
+        edit_bc_(node_pos).set_value(static_cast<IndexType>(header >> 2));
+        continue;
+      }
+      auto num_children = header >> 2;
+      if ((header & 3) != NODE_INTERNAL || 256 < num_children) {
+        return false;
+      }
+      if (num_children == 0) {
+        edit_bc_(node_pos).set_base(Traits::INVALID);
+        continue;
+      }
+
+      if (src == end) {
+        return false;
+      }
+      auto len = uint32_t{static_cast<uint8_t>(*src++)};
+      if (static_cast<uint64_t>(end - src) < len + num_children) {
+        return false;
+      }
+      auto labels = src;
+      src += len;
+
+      edge.clear();
+      auto label = uint32_t{static_cast<uint8_t>(*src++)};
+      edge.push(static_cast<uint8_t>(label));
+      for (uint64_t i = 1; i < num_children; ++i) {
+        label += uint32_t{static_cast<uint8_t>(*src++)} + 1;
+        if (255 < label) {
+          return false;
+        }
+        edge.push(static_cast<uint8_t>(label));
+      }
+
+      auto base = xcheck_(edge, blocks_);
+      compress_(node_pos, labels, len, base);
+      if (WithNLM) {
+        edit_link_(node_pos).child = edge[0];
+      }
+      for (size_t i = 0; i < edge.size(); ++i) {
+        auto child_pos = base ^edge[i];
+        fix_(child_pos, blocks_);
+        edit_bc_(child_pos).set_check(node_pos);
+        if (WithNLM) { // the siblings are linked circularly in the label order
+          edit_link_(child_pos).sib = edge[(i + 1) % edge.size()];
+        }
+      }
+      for (auto i = edge.size(); i-- > 0;) {
+        node_stack.push_back(base ^ edge[i]);
+      }
+    }
+    return src == end;
+  }
+
+  bool is_terminal_(IndexType node_pos) const {
+    if (!bc_[node_pos].is_leaf()) {
+      return false;
+    }
+    if (node_pos == ROOT_POS) {
+      return false;
+    }
+    return (base_(bc_[node_pos].check()) ^ node_pos) == 0;
+  }
+
+  bool search_(Query& query, uint32_t& num_matched) const {
+    assert(query.node_pos() < bc_.size());
+    assert(bc_[query.node_pos()].is_fixed());
+    assert(!Prefix);
+
+    if (!jump_table_.empty() && query.node_pos() == ROOT_POS) {
+      jump_(query);
+    }
+    while (!bc_[query.node_pos()].is_leaf()) {
+      auto base = bc_[query.node_pos()].base();
+      if ((base & Traits::LABEL_FLAG) != 0 && !label_pool_.empty()) {
+        auto entry = label_pool_.data() + (base & ~Traits::LABEL_FLAG);
+        auto len = static_cast<uint8_t>(entry[sizeof(IndexType)]);
+        auto labels = entry + sizeof(IndexType) + 1;
+        for (uint32_t i = 0; i < len; ++i) {
+          if (query.label() != static_cast<uint8_t>(labels[i])) {
+            num_matched = i; // the query stops at the mismatch
+            return false;
+          }
+          query.next();
+        }
+        base = extract_index_(entry);
+      }
+      auto child_pos = base ^query.label();
+      if (bc_[child_pos].check() != query.node_pos()) {
+        return false;
+      }
+      query.next(child_pos);
+    }
+    auto value = bc_[query.node_pos()].value();
+    if (query.is_finished()) {
+      query.set_value(terminal_value_(value));
+      return true;
+    }
+
+    if (is_inline_(value)) { // without touching TAIL
+      if (!utils::match_inline(query.key(), inline_code_(value))) {
+        return false;
+      }
+      query.set_value(utils::inline_value(inline_code_(value)));
+      return true;
+    }
+
+    uint32_t len = 0;
+    auto tail = tail_suffix_(value);
+    if (!utils::match(query.key(), tail, len)) {
+      return false;
+    }
+    query.set_value(tail_value_(value, tail + len));
+    return true;
+  }
+
+  void jump_(Query& query) const {
+    auto key = query.key();
+    if (key[0] == '\0' || key[1] == '\0') {
+      return;
+    }
+    auto first = static_cast<uint8_t>(key[0]), second = static_cast<uint8_t>(key[1]);
+    auto node_pos = jump_table_[jump_index_(first, second)];
+    if (node_pos != ROOT_POS) {
+      query.next();
+      query.next(node_pos);
+    }
+  }
+
+  // visits the nodes that search_() passes, returning whether a leaf is reached
+  template<class F>
+  bool walk_(Query& query, F visit) const {
+    while (true) {
+      visit(query.node_pos());
+      if (bc_[query.node_pos()].is_leaf()) {
+        return true;
+      }
+      auto base = bc_[query.node_pos()].base();
+      if (base == Traits::INVALID) { // of prefix tries
+        return false;
+      }
+      if (is_compressed_(query.node_pos())) {
+        auto entry = label_pool_.data() + (base & ~Traits::LABEL_FLAG);
+        auto len = static_cast<uint8_t>(entry[sizeof(IndexType)]);
+        auto labels = entry + sizeof(IndexType) + 1;
+        for (uint32_t i = 0; i < len; ++i) {
+          if (query.label() != static_cast<uint8_t>(labels[i])) {
+            return false;
+          }
+          query.next();
+        }
+        base = extract_index_(entry);
+      }
+      auto child_pos = base ^query.label();
+      if (bc_[child_pos].check() != query.node_pos()) {
+        return false;
+      }
+      query.next(child_pos);
+    }
+  }
+
+  static uint32_t jump_index_(uint8_t label, uint8_t label2) {
+    return uint32_t{label} << 8 | label2;
+  }
+
+  void link_jump_(uint8_t label, uint8_t label2) {
+    auto& entry = jump_table_[jump_index_(label, label2)];
+    if (entry != ROOT_POS || bc_.empty() || bc_[ROOT_POS].is_leaf() || is_compressed_(ROOT_POS)) {
+      return;
+    }
+    auto node_pos = bc_[ROOT_POS].base() ^label;
+    if (bc_[node_pos].check() != ROOT_POS || bc_[node_pos].is_leaf() || is_compressed_(node_pos)) {
+      return;
+    }
+    auto child_pos = bc_[node_pos].base() ^label2;
+    if (bc_[child_pos].check() == node_pos) {
+      entry = child_pos;
+    }
+  }
+
+  // has to be called before a node at depth 2 moves to new_pos or is unfixed
+  void relink_jump_(IndexType node_pos, IndexType new_pos) {
+    if (jump_table_.empty()) {
+      return;
+    }
+    auto parent_pos = bc_[node_pos].check();
+    if (parent_pos == ROOT_POS || bc_[parent_pos].check() != ROOT_POS) {
+      return;
+    }
+    auto label = static_cast<uint8_t>(base_(ROOT_POS) ^ parent_pos);
+    auto child_label = static_cast<uint8_t>(base_(parent_pos) ^ node_pos);
+    auto& entry = jump_table_[jump_index_(label, child_label)];
+    if (entry == node_pos) {
+      entry = new_pos;
+    }
+  }
+
+  IndexType next_(IndexType pos) const {
+    return bc_[pos].base();
+  }
+
+  IndexType prev_(IndexType pos) const {
+    return bc_[pos].check();
+  }
+
+  // The writers of bc_, node_links_ and blocks_ go through these to mark the
+  // chunks they change for hash_chunks().
+  Bc& edit_bc_(IndexType pos) {
+    chunk_hashes_[0].mark(pos / BLOCK_SIZE);
+    return bc_[pos];
+  }
+
+  NodeLink& edit_link_(IndexType pos) {
+    chunk_hashes_[3].mark(pos / BLOCK_SIZE);
+    return node_links_[pos];
+  }
+
+  template<class B>
+  B& edit_block_(ResourceVector<B>& blocks, IndexType block_pos) {
+    chunk_hashes_[2].mark(block_pos / BLOCK_SIZE);
+    return blocks[block_pos];
+  }
+
+  // for the len bytes from pos on of TAIL or the label pool
+  static void mark_pages_(utils::ChunkHashes& hashes, size_t pos, size_t len) {
+    hashes.mark(pos / DELTA_PAGE_SIZE, (pos + len - 1) / DELTA_PAGE_SIZE);
+  }
+
+  void set_next_(IndexType pos, IndexType next) {
+    edit_bc_(pos).set_base(next);
+  }
+
+  void set_prev_(IndexType pos, IndexType prev) {
+    edit_bc_(pos).set_check(prev);
+  }
+
+  static IndexType extract_index_(const char* str) {
+    IndexType index = 0;
+    std::memcpy(&index, str, sizeof(IndexType));
+    return index;
+  }
+
+  // An inlined leaf keeps the code of utils::make_inline() below
+  // Traits::INLINE_FLAG, so the wide variant only moves the flag. TAIL
+  // positions share the field and stay below the flag while leaves inline,
+  // and once TAIL passes it, no leaf does, so that the whole field is left to
+  // the positions (see expel_inline_()).
+  bool is_inline_(IndexType leaf) const {
+    return !no_inline_ && (leaf & Traits::INLINE_FLAG) != 0;
+  }
+
+  // for a trie read as it is, where leaves can inline only with TAIL below
+  // the flag, as an inlining trie never lets TAIL pass it
+  static bool is_inline_(IndexType leaf, size_t tail_size) {
+    return tail_size <= Traits::INLINE_FLAG && (leaf & Traits::INLINE_FLAG) != 0;
+  }
+
+  static uint32_t inline_code_(IndexType leaf) {
+    return INLINE_FLAG | static_cast<uint32_t>(leaf & (INLINE_FLAG - 1));
+  }
+
+  bool make_inline_(const char* suffix, uint32_t len, ValueType value, IndexType& leaf) const {
+    uint32_t code = 0;
+    if (no_inline_ || (value >> 28) != 0) { // wider than any inlined value
+      return false;
+    }
+    if (!utils::make_inline(suffix, len, static_cast<uint32_t>(value), code)) {
+      return false;
+    }
+    leaf = Traits::INLINE_FLAG | (code & (INLINE_FLAG - 1));
+    return true;
   }
 
-  void swap(DaTrie& rhs) {
-    bc_.swap(rhs.bc_);
-    tail_.swap(rhs.tail_);
-    blocks_.swap(rhs.blocks_);
-    node_links_.swap(rhs.node_links_);
-    std::swap(head_pos_, rhs.head_pos_);
-    std::swap(bc_emps_, rhs.bc_emps_);
-    std::swap(tail_emps_, rhs.tail_emps_);
+  // A terminal leaf keeps its value in the base field. When values can be
+  // wider than the field, one that does not fit below INLINE_FLAG is moved to
+  // a TAIL entry of its own, and the leaf refers to it with INLINE_FLAG.
+  static constexpr bool TERMINALS_FIT = VTraits::BITS <= Traits::BITS;
+
+  IndexType make_terminal_(ValueType value) {
+    if (TERMINALS_FIT || value < Traits::INLINE_FLAG) {
+      return static_cast<IndexType>(value);
+    }
+    auto tail_pos = alloc_tail_(VTraits::BYTES);
+    std::memcpy(tail_.data() + tail_pos, &value, VTraits::BYTES);
+    return Traits::INLINE_FLAG | tail_pos;
   }
 
-  DaTrie(const DaTrie&) = delete;
-  DaTrie& operator=(const DaTrie&) = delete;
+  ValueType terminal_value_(IndexType leaf) const {
+    if (TERMINALS_FIT || !is_inline_(leaf)) {
+      return static_cast<ValueType>(leaf);
+    }
+    return utils::extract_value<Value>(tail_.data() + (leaf & ~Traits::INLINE_FLAG));
+  }
 
-protected:
-  std::vector<Bc> bc_;
-  std::vector<char> tail_;
-  std::vector<BlockType> blocks_;
-  std::vector<NodeLink> node_links_;
+  void free_terminal_(IndexType leaf) { // never shared
+    if (!TERMINALS_FIT && is_inline_(leaf)) {
+      free_tail_(leaf & ~Traits::INLINE_FLAG, VTraits::BYTES);
+    }
+  }
 
-  uint32_t head_pos_ = NOT_FOUND;
-  uint32_t bc_emps_ = 0; // in bc_
-  uint32_t tail_emps_ = 0; // in tail_
+  // An internal node flagged by LABEL_FLAG stands for a chain of single-child
+  // nodes. Its base refers to an entry of label_pool_ holding the real base,
+  // the number of labels and the labels followed before the child label.
+  // Such nodes are made by rebuild() and split again by insert_key(). Without
+  // them, the flag is a bit of bases, as BC may grow past it.
+  bool is_compressed_(IndexType node_pos) const {
+    return !Prefix && !label_pool_.empty() && !bc_[node_pos].is_leaf()
+           && (bc_[node_pos].base() & Traits::LABEL_FLAG) != 0;
+  }
 
-  bool is_terminal_(uint32_t node_pos) const {
-    if (!bc_[node_pos].is_leaf()) {
-      return false;
+  IndexType base_(IndexType node_pos) const {
+    if (!is_compressed_(node_pos)) {
+      return bc_[node_pos].base();
     }
-    if (node_pos == ROOT_POS) {
-      return false;
+    return extract_index_(label_pool_.data() + (bc_[node_pos].base() & ~Traits::LABEL_FLAG));
+  }
+
+  void set_base_(IndexType node_pos, IndexType base) {
+    if (!is_compressed_(node_pos)) {
+      edit_bc_(node_pos).set_base(base);
+      return;
     }
-    return (bc_[bc_[node_pos].check()].base() ^ node_pos) == 0;
+    auto entry_pos = bc_[node_pos].base() & ~Traits::LABEL_FLAG;
+    mark_pages_(chunk_hashes_[4], entry_pos, sizeof(IndexType));
+    std::memcpy(label_pool_.data() + entry_pos, &base, sizeof(IndexType));
   }
 
-  uint32_t next_(uint32_t pos) const {
-    return bc_[pos].base();
+  const char* labels_(IndexType node_pos, uint32_t& len) const {
+    if (!is_compressed_(node_pos)) {
+      len = 0;
+      return "";
+    }
+    auto entry = label_pool_.data() + (bc_[node_pos].base() & ~Traits::LABEL_FLAG);
+    len = static_cast<uint8_t>(entry[sizeof(IndexType)]);
+    return entry + sizeof(IndexType) + 1;
   }
 
-  uint32_t prev_(uint32_t pos) const {
-    return bc_[pos].check();
+  void compress_(IndexType node_pos, const char* labels, uint32_t len, IndexType base) {
+    assert(len <= MAX_EDGE_LENGTH);
+
+    if (len == 0) {
+      edit_bc_(node_pos).set_base(base);
+      return;
+    }
+
+    if (Traits::LABEL_FLAG < bc_.size()) {
+      throw std::length_error("ddd: BC too long to flag compressed edges");
+    }
+    auto entry_len = static_cast<IndexType>(sizeof(IndexType) + 1 + len);
+    auto entry_pos = label_holes_.allocate(entry_len);
+    if (entry_pos == Traits::NOT_FOUND) {
+      if (Traits::LABEL_FLAG < label_pool_.size() + entry_len) {
+        throw std::length_error("ddd: label pool exceeds the index field");
+      }
+      entry_pos = label_size();
+      label_pool_.resize(label_pool_.size() + entry_len);
+    }
+
+    mark_pages_(chunk_hashes_[4], entry_pos, entry_len);
+    auto entry = label_pool_.data() + entry_pos;
+    std::memcpy(entry, &base, sizeof(IndexType));
+    entry[sizeof(IndexType)] = static_cast<char>(len);
+    std::memcpy(entry + sizeof(IndexType) + 1, labels, len);
+    edit_bc_(node_pos).set_base(Traits::LABEL_FLAG | entry_pos);
   }
 
-  void set_next_(uint32_t pos, uint32_t next) {
-    bc_[pos].set_base(next);
+  void decompress_(IndexType node_pos) { // keeping the real base
+    uint32_t len = 0;
+    labels_(node_pos, len);
+    if (len == 0) {
+      return;
+    }
+
+    auto base = base_(node_pos);
+    label_holes_.release(bc_[node_pos].base() & ~Traits::LABEL_FLAG, sizeof(IndexType) + 1 + len);
+    label_pool_.resize(label_holes_.trim(label_size()));
+    edit_bc_(node_pos).set_base(base);
   }
 
-  void set_prev_(uint32_t pos, uint32_t prev) {
-    bc_[pos].set_check(prev);
+  void split_edge_(Query& query, uint32_t num_matched) {
+    assert(is_compressed_(query.node_pos()));
+
+    auto node_pos = query.node_pos();
+    char labels[MAX_EDGE_LENGTH];
+    uint32_t len = 0;
+    auto pool_labels = labels_(node_pos, len);
+    std::memcpy(labels, pool_labels, len);
+    assert(num_matched < len);
+
+    Edge orig_edge;
+    edge_(node_pos, orig_edge);
+    auto orig_base = base_(node_pos);
+    decompress_(node_pos);
+
+    auto branch = static_cast<uint8_t>(labels[num_matched]);
+
+    Edge edge;
+    edge.push(branch);
+    edge.push(query.label());
+
+    auto base = xcheck_(edge, blocks_);
+    compress_(node_pos, labels, num_matched, base);
+
+    auto child_pos = base ^branch;
+    fix_(child_pos, blocks_);
+    edit_bc_(child_pos).set_check(node_pos);
+    compress_(child_pos, labels + num_matched + 1, len - num_matched - 1, orig_base);
+
+    for (auto label : orig_edge) {
+      edit_bc_(orig_base ^ label).set_check(child_pos);
+    }
+
+    if (WithNLM) {
+      edit_link_(child_pos).child = node_links_[node_pos].child;
+      edit_link_(child_pos).sib = branch;
+      edit_link_(node_pos).child = branch;
+    }
   }
 
   void insert_branch_(Query& query) {
     assert(query.node_pos() < bc_.size());
     assert(bc_[query.node_pos()].is_leaf());
 
-    auto tail_pos = bc_[query.node_pos()].value();
+    char buf[MAX_INLINE_LENGTH + 1];
+    auto leaf = bc_[query.node_pos()].value();
+    auto suffix = leaf_suffix_(leaf, buf);
+    auto suffix_len = utils::length(suffix);
+    auto value = leaf_value_(leaf, suffix + suffix_len);
 
-    while (*query.key() == tail_[tail_pos]) {
+    uint32_t len = 0;
+    while (*query.key() == suffix[len]) {
       append_edge_(query);
-      ++tail_pos;
-      ++tail_emps_;
+      ++len;
     }
 
-    auto branch = static_cast<uint8_t>(tail_[tail_pos++]);
-    ++tail_emps_;
+    auto branch = static_cast<uint8_t>(suffix[len++]);
 
     Edge edge;
     edge.push(branch);
     edge.push(query.label());
 
     auto base = xcheck_(edge, blocks_);
-    bc_[query.node_pos()].set_base(base);
+    set_base_(query.node_pos(), base);
 
     auto child_pos = base ^branch;
     fix_(child_pos, blocks_);
 
-    bc_[child_pos].set_check(query.node_pos());
-    if (branch != '\0') {
-      bc_[child_pos].set_value(tail_pos);
-    } else {
-      uint32_t value = 0;
-      std::memcpy(&value, tail_.data() + tail_pos, sizeof(uint32_t));
-      bc_[child_pos].set_value(value);
-      tail_emps_ += sizeof(uint32_t);
+    edit_bc_(child_pos).set_check(query.node_pos());
+
+    IndexType child_leaf = 0;
+    auto is_kept = false; // whether the rest of the entry stays in TAIL
+    if (branch == '\0') {
+      child_leaf = make_terminal_(value);
+    } else if (!make_inline_(suffix + len, suffix_len - len, value, child_leaf)) {
+      assert(!is_inline_(leaf));
+      auto rest_pos = static_cast<IndexType>(suffix + len - tail_.data());
+      // the entry may be referred to in the shared mode, so the rest gets a new one
+      child_leaf = shared_tail_ ? insert_tail_ref_(rest_pos, value) : rest_pos;
+      is_kept = true;
+    }
+    edit_bc_(child_pos).set_value(child_leaf);
+
+    if (shared_tail_ && !is_inline_(leaf)) {
+      drop_shared_tail_(leaf, (is_kept ? len : suffix_len) + VTraits::BYTES);
+    } else if (!is_inline_(leaf)) {
+      free_tail_(leaf, is_kept ? len : suffix_len + VTraits::BYTES);
     }
 
     if (WithNLM) {
-      node_links_[query.node_pos()].child = branch;
-      node_links_[child_pos].sib = branch;
+      edit_link_(query.node_pos()).child = branch;
+      edit_link_(child_pos).sib = branch;
     }
     insert_edge_(query);
   }
@@ -495,20 +1469,20 @@ protected:
     assert(query.node_pos() < bc_.size());
     assert(bc_[query.node_pos()].is_fixed());
 
-    auto child_pos = bc_[query.node_pos()].base() ^query.label();
+    auto child_pos = base_(query.node_pos()) ^query.label();
 
     if (bc_[child_pos].is_fixed()) {
       solve_(query);
-      child_pos = bc_[query.node_pos()].base() ^ query.label();
+      child_pos = base_(query.node_pos()) ^ query.label();
     }
 
     fix_(child_pos, blocks_);
-    bc_[child_pos].set_check(query.node_pos());
+    edit_bc_(child_pos).set_check(query.node_pos());
 
     if (WithNLM) {
-      auto _child_pos = bc_[query.node_pos()].base() ^node_links_[query.node_pos()].child;
-      node_links_[child_pos].sib = node_links_[_child_pos].sib;
-      node_links_[_child_pos].sib = query.label();
+      auto _child_pos = base_(query.node_pos()) ^node_links_[query.node_pos()].child;
+      edit_link_(child_pos).sib = node_links_[_child_pos].sib;
+      edit_link_(_child_pos).sib = query.label();
     }
     query.next(child_pos);
   }
@@ -521,12 +1495,12 @@ protected:
     auto child_pos = base ^query.label();
 
     fix_(child_pos, blocks_);
-    bc_[query.node_pos()].set_base(base);
-    bc_[child_pos].set_check(query.node_pos());
+    set_base_(query.node_pos(), base);
+    edit_bc_(child_pos).set_check(query.node_pos());
 
     if (WithNLM) {
-      node_links_[query.node_pos()].child = query.label();
-      node_links_[child_pos].sib = query.label();
+      edit_link_(query.node_pos()).child = query.label();
+      edit_link_(child_pos).sib = query.label();
     }
     query.next(child_pos);
   }
@@ -536,31 +1510,364 @@ protected:
     assert(bc_[query.node_pos()].is_fixed());
 
     if (query.is_finished()) {
-      bc_[query.node_pos()].set_value(query.value());
+      edit_bc_(query.node_pos()).set_value(make_terminal_(query.value()));
       return;
     }
 
-    auto tail_pos = tail_size();
-    bc_[query.node_pos()].set_value(tail_pos);
+    auto tail_pos = insert_tail_(query.key(), utils::length(query.key()), query.value());
+    edit_bc_(query.node_pos()).set_value(tail_pos);
+  }
 
-    while (!query.is_finished()) {
-      tail_.push_back(query.label());
-      query.next();
+  // returns the leaf value
+  IndexType insert_tail_(const char* suffix, uint32_t len, ValueType value) {
+    IndexType leaf = 0;
+    if (make_inline_(suffix, len, value, leaf)) {
+      return leaf;
+    }
+
+    auto tail_pos = alloc_tail_(len + VTraits::BYTES);
+    auto entry = tail_.data() + tail_pos;
+    if (shared_tail_) {
+      std::memcpy(entry, &value, VTraits::BYTES);
+      std::memcpy(entry + VTraits::BYTES, suffix, len);
+    } else {
+      std::memcpy(entry, suffix, len);
+      std::memcpy(entry + len, &value, VTraits::BYTES);
+    }
+    return tail_pos;
+  }
+
+  IndexType insert_tail_ref_(IndexType suffix_pos, ValueType value) { // for shared mode
+    assert(shared_tail_);
+
+    if (!VTraits::HAS_VALUE) { // nothing to keep per leaf
+      return suffix_pos;
+    }
+
+    auto len = utils::length(tail_.data() + suffix_pos);
+    if (len <= sizeof(IndexType)) { // not longer than the reference
+      std::string suffix(tail_.data() + suffix_pos, len);
+      return insert_tail_(suffix.data(), len, value);
+    }
+
+    auto tail_pos = alloc_tail_(VTraits::BYTES + sizeof(IndexType));
+    value |= VTraits::TAIL_REF;
+    std::memcpy(tail_.data() + tail_pos, &value, VTraits::BYTES);
+    std::memcpy(tail_.data() + tail_pos + VTraits::BYTES, &suffix_pos, sizeof(IndexType));
+    return tail_pos;
+  }
+
+  const char* tail_suffix_(IndexType tail_pos) const {
+    auto entry = tail_.data() + tail_pos;
+    if (!shared_tail_ || !VTraits::HAS_VALUE) {
+      return entry;
+    }
+    if ((utils::extract_value<Value>(entry) & VTraits::TAIL_REF) == 0) {
+      return entry + VTraits::BYTES;
+    }
+    return tail_.data() + extract_index_(entry + VTraits::BYTES);
+  }
+
+  ValueType tail_value_(IndexType tail_pos, const char* suffix_end) const {
+    if (!shared_tail_) {
+      return utils::extract_value<Value>(suffix_end);
+    }
+    return utils::extract_value<Value>(tail_.data() + tail_pos) & ~VTraits::TAIL_REF;
+  }
+
+  const char* leaf_suffix_(IndexType leaf, char* buf) const { // for non-terminal leaves
+    if (is_inline_(leaf)) {
+      utils::extract_inline(inline_code_(leaf), buf);
+      return buf;
+    }
+    return tail_suffix_(leaf);
+  }
+
+  ValueType leaf_value_(IndexType leaf, const char* suffix_end) const { // for non-terminal leaves
+    return is_inline_(leaf) ? utils::inline_value(inline_code_(leaf))
+                            : tail_value_(leaf, suffix_end);
+  }
+
+  void pack_tail_(bool shared) {
+    struct Suffix {
+      const char* str;
+      uint32_t len; // including the terminator
+      ValueType value;
+      IndexType node_pos;
+    };
+
+    std::vector<Suffix> suffixes;
+    std::vector<std::pair<IndexType, ValueType>> terminals; // with values in TAIL
+    size_t orig_size = 0;
+
+    for (IndexType node_pos = 0; node_pos < bc_size(); ++node_pos) {
+      if (!bc_[node_pos].is_leaf()) {
+        continue;
+      }
+      auto leaf = bc_[node_pos].value();
+      if (is_terminal_(node_pos)) {
+        if (!TERMINALS_FIT && is_inline_(leaf)) {
+          terminals.push_back({node_pos, terminal_value_(leaf)});
+          orig_size += VTraits::BYTES;
+        }
+        continue;
+      }
+      if (is_inline_(leaf)) {
+        continue;
+      }
+      auto str = tail_suffix_(leaf);
+      auto len = utils::length(str);
+      suffixes.push_back(Suffix{str, len, tail_value_(leaf, str + len), node_pos});
+      orig_size += len + VTraits::BYTES;
+    }
+
+    if (shared) { // reverse lexicographical order puts sharable suffixes next to each other
+      std::sort(suffixes.begin(), suffixes.end(), [](const Suffix& lhs, const Suffix& rhs) {
+        auto l = lhs.str + lhs.len - 1, r = rhs.str + rhs.len - 1;
+        while (lhs.str < l && rhs.str < r && *(l - 1) == *(r - 1)) {
+          --l, --r;
+        }
+        if (lhs.str == l || rhs.str == r) {
+          return rhs.str == r && lhs.str != l;
+        }
+        return static_cast<uint8_t>(*(l - 1)) > static_cast<uint8_t>(*(r - 1));
+      });
+    }
+
+    ResourceVector<char> tail(resource());
+    tail.swap(tail_);
+    tail_.reserve(orig_size);
+    tail_holes_.clear();
+    chunk_hashes_[1].clear(); // rewritten whole
+    tail_emps_ = 0;
+    shared_tail_ = shared;
+
+    for (const auto& terminal : terminals) {
+      edit_bc_(terminal.first).set_value(make_terminal_(terminal.second));
+    }
+
+    const Suffix* prev = nullptr;
+    IndexType suffix_pos = 0; // of the previous suffix
+
+    for (const auto& suffix : suffixes) {
+      if (shared && prev != nullptr && suffix.len <= prev->len &&
+          std::memcmp(prev->str + prev->len - suffix.len, suffix.str, suffix.len) == 0) {
+        suffix_pos += prev->len - suffix.len;
+        edit_bc_(suffix.node_pos).set_value(insert_tail_ref_(suffix_pos, suffix.value));
+      } else {
+        auto leaf = insert_tail_(suffix.str, suffix.len, suffix.value);
+        edit_bc_(suffix.node_pos).set_value(leaf);
+        if (is_inline_(leaf)) {
+          prev = nullptr;
+          continue;
+        }
+        suffix_pos = leaf + (shared ? VTraits::BYTES : 0);
+      }
+      prev = &suffix;
+    }
+
+    tail_saved_ = static_cast<IndexType>(orig_size - tail_.size());
+  }
+
+  IndexType alloc_tail_(IndexType len) {
+    auto tail_pos = tail_holes_.allocate(len);
+    if (tail_pos != Traits::NOT_FOUND) {
+      tail_emps_ -= len;
+    } else {
+      if (!has_tail_room_(len)) {
+        throw std::length_error("ddd: TAIL exceeds the positions of leaves");
+      }
+      assert(no_inline_ || tail_.size() + len <= Traits::INLINE_FLAG); // by reserve_tail_()
+      tail_pos = tail_size();
+      tail_.resize(tail_.size() + len);
+    }
+    mark_pages_(chunk_hashes_[1], tail_pos, len); // to be written by the caller
+    return tail_pos;
+  }
+
+  // whether len more bytes keep TAIL positions in the leaf field, without
+  // counting holes. Terminal values moved to TAIL are referred to below
+  // Traits::INLINE_FLAG, so TAIL is kept below it when they can be.
+  bool has_tail_room_(size_t len) const {
+    return tail_.size() + len <= (TERMINALS_FIT ? Traits::INVALID : Traits::INLINE_FLAG);
+  }
+
+  // makes room for len more bytes of TAIL, with expel_inline_() if TAIL can
+  // pass Traits::INLINE_FLAG, which updates call before changing the trie.
+  // Returns false, changing nothing, if TAIL cannot grow so far.
+  bool reserve_tail_(size_t len) {
+    if (!has_tail_room_(len)) {
+      return false;
+    }
+    if (no_inline_ || tail_.size() + len <= Traits::INLINE_FLAG) {
+      return true;
+    }
+    return expel_inline_(len);
+  }
+
+  // moves the suffixes inlined in leaves to TAIL entries and stops inlining,
+  // so that TAIL can take len more bytes past Traits::INLINE_FLAG, keeping
+  // the range of positions of the narrow variant as before inlining. Inlining
+  // goes on only in a trie read with TAIL below the flag again, as a rebuilt
+  // one takes no_inline_ over.
+  bool expel_inline_(size_t len) {
+    std::vector<IndexType> node_poses;
+    size_t expelled = 0;
+    for (IndexType i = 0; i < bc_size(); ++i) {
+      if (bc_[i].is_fixed() && bc_[i].is_leaf() && !is_terminal_(i) && is_inline_(bc_[i].value())) {
+        node_poses.push_back(i);
+        expelled += utils::inline_length(inline_code_(bc_[i].value())) + 1 + VTraits::BYTES;
+      }
+    }
+    if (!has_tail_room_(expelled + len)) {
+      return false;
+    }
+
+    no_inline_ = true;
+    for (auto node_pos : node_poses) {
+      auto code = inline_code_(bc_[node_pos].value());
+      char buf[MAX_INLINE_LENGTH + 1];
+      utils::extract_inline(code, buf);
+      auto leaf = insert_tail_(buf, utils::inline_length(code) + 1, utils::inline_value(code));
+      edit_bc_(node_pos).set_value(leaf);
+    }
+    return true;
+  }
+
+  void free_tail_(IndexType tail_pos, IndexType len) {
+    tail_holes_.release(tail_pos, len);
+    tail_emps_ += len;
+
+    auto end = tail_holes_.trim(tail_size()); // shrink if the hole reaches the end
+    tail_emps_ -= tail_size() - end;
+    tail_.resize(end);
+  }
+
+  // In the shared mode, a suffix entry may be referred to by other leaves, so
+  // its len dead bytes are only counted until the next build reclaims them,
+  // while a reference entry belongs to the leaf and is freed.
+  void drop_shared_tail_(IndexType leaf, IndexType len) {
+    assert(shared_tail_);
+
+    if (!VTraits::HAS_VALUE) { // entries cannot be told from references
+      return;
+    }
+    if ((utils::extract_value<Value>(tail_.data() + leaf) & VTraits::TAIL_REF) != 0) {
+      free_tail_(leaf, VTraits::BYTES + sizeof(IndexType));
+    } else {
+      tail_emps_ += len;
+    }
+  }
+
+  // remakes the lists of holes from the entries the nodes refer to, as the
+  // bytes of TAIL and of the label pool outside them, returning false for an
+  // entry out of the arrays. In the shared mode, dead entries no leaf refers
+  // to any more become holes too, whose bytes are already in tail_emps_; sets
+  // never free entries there, so their TAIL is left without holes. Leaves
+  // are taken as inlining by the size of TAIL, as is_inline_(leaf, size).
+  bool remake_holes_() {
+    no_inline_ = Traits::INLINE_FLAG < tail_.size();
+    if (!has_tail_room_(0)) {
+      return false;
+    }
+    std::vector<bool> tail_used(tail_.size()), label_used(label_pool_.size());
+    auto use = [](std::vector<bool>& used, size_t pos, size_t len) {
+      if (used.size() < pos || used.size() - pos < len) {
+        return false;
+      }
+      std::fill(used.begin() + pos, used.begin() + pos + len, true);
+      return true;
+    };
+    auto suffix_length = [&](size_t pos) -> size_t { // or 0 without the terminator
+      if (tail_.size() <= pos) {
+        return 0;
+      }
+      auto end = std::memchr(tail_.data() + pos, '\0', tail_.size() - pos);
+      return end == nullptr ? 0 : static_cast<const char*>(end) - (tail_.data() + pos) + 1;
+    };
+
+    for (IndexType node_pos = 0; node_pos < bc_size(); ++node_pos) {
+      if (!bc_[node_pos].is_fixed()) {
+        continue;
+      }
+      if (!bc_[node_pos].is_leaf()) {
+        if (is_compressed_(node_pos)) {
+          auto entry_pos = bc_[node_pos].base() & ~Traits::LABEL_FLAG;
+          auto len_pos = entry_pos + sizeof(IndexType);
+          if (label_used.size() <= len_pos
+              || !use(label_used, entry_pos, len_pos + 1 - entry_pos
+                                             + static_cast<uint8_t>(label_pool_[len_pos]))) {
+            return false;
+          }
+        }
+        continue;
+      }
+      auto leaf = bc_[node_pos].value();
+      if (is_terminal_(node_pos)) {
+        if (!TERMINALS_FIT && is_inline_(leaf)
+            && !use(tail_used, leaf & ~Traits::INLINE_FLAG, VTraits::BYTES)) {
+          return false;
+        }
+        continue;
+      }
+      if (Prefix || is_inline_(leaf)) { // a suffix link or no entry
+        continue;
+      }
+      if (!shared_tail_) {
+        auto len = suffix_length(leaf);
+        if (len == 0 || !use(tail_used, leaf, len + VTraits::BYTES)) {
+          return false;
+        }
+        continue;
+      }
+      auto is_ref = false;
+      if (VTraits::HAS_VALUE) { // the value and the reference, if any
+        if (!use(tail_used, leaf, VTraits::BYTES)) {
+          return false;
+        }
+        is_ref = (utils::extract_value<Value>(tail_.data() + leaf) & VTraits::TAIL_REF) != 0;
+        if (is_ref && !use(tail_used, leaf + VTraits::BYTES, sizeof(IndexType))) {
+          return false;
+        }
+      }
+      auto suffix_pos = is_ref ? static_cast<size_t>(tail_suffix_(leaf) - tail_.data())
+                               : leaf + VTraits::BYTES;
+      auto len = suffix_length(suffix_pos);
+      if (len == 0 || !use(tail_used, suffix_pos, len)) {
+        return false;
+      }
     }
 
-    auto value = query.value();
-    for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-      tail_.push_back(static_cast<uint8_t>(value & 0xFF));
-      value >>= 8;
+    auto release = [](TailFreeList<Wide>& holes, const std::vector<bool>& used) {
+      holes.clear();
+      for (size_t pos = 0; pos < used.size();) {
+        if (used[pos]) {
+          ++pos;
+          continue;
+        }
+        auto end = pos;
+        while (end < used.size() && !used[end]) {
+          ++end;
+        }
+        holes.release(static_cast<IndexType>(pos), static_cast<IndexType>(end - pos));
+        pos = end;
+      }
+    };
+    release(label_holes_, label_used);
+    if (!shared_tail_ || VTraits::HAS_VALUE) {
+      release(tail_holes_, tail_used);
+    } else {
+      tail_holes_.clear();
     }
+    return true;
   }
 
-  void delete_sib_(uint32_t node_pos) {
+  void delete_sib_(IndexType node_pos) {
     assert(node_pos < bc_.size());
     assert(bc_[node_pos].is_fixed());
 
     auto parent_pos = bc_[node_pos].check();
-    auto base = bc_[parent_pos].base();
+    auto base = base_(parent_pos);
     auto label = static_cast<uint8_t>(base ^ node_pos);
 
     auto _node_pos = base ^node_links_[parent_pos].child;
@@ -569,9 +1876,9 @@ protected:
     }
 
     if (node_links_[parent_pos].child == node_links_[_node_pos].sib) {
-      node_links_[parent_pos].child = node_links_[node_pos].sib;
+      edit_link_(parent_pos).child = node_links_[node_pos].sib;
     }
-    node_links_[_node_pos].sib = node_links_[node_pos].sib;
+    edit_link_(_node_pos).sib = node_links_[node_pos].sib;
   }
 
   void change_branch_(Query& query) {
@@ -585,85 +1892,168 @@ protected:
       return;
     }
 
-    auto child_pos = bc_[query.node_pos()].base() ^*edge.begin();
+    auto child_pos = base_(query.node_pos()) ^*edge.begin();
     if (!bc_[child_pos].is_leaf()) {
       return;
     }
 
-    auto value = bc_[child_pos].value();
-    unfix_(child_pos, blocks_);
+    auto leaf = bc_[child_pos].value();
+    ValueType value = 0;
+    std::string suffix(1, static_cast<char>(*edge.begin()));
+    uint32_t tail_len = 0;
+    if (*edge.begin() != '\0') {
+      char buf[MAX_INLINE_LENGTH + 1];
+      auto tail = leaf_suffix_(leaf, buf);
+      tail_len = utils::length(tail);
+      suffix.append(tail, tail_len);
+      value = leaf_value_(leaf, tail + tail_len);
+    } else {
+      value = terminal_value_(leaf);
+    }
 
-    size_t num_regress = 0;
-    while (query.node_pos() != ROOT_POS) {
-      auto parent_pos = bc_[query.node_pos()].check();
+    // the chain up to node_pos is folded into the suffix
+    auto node_pos = query.node_pos();
+    uint32_t len = 0;
+    while (node_pos != ROOT_POS) {
+      auto parent_pos = bc_[node_pos].check();
       if (edge_size_(parent_pos, 2) != 1) {
         break;
       }
-      if (WithNLM) {
-        delete_sib_(query.node_pos());
-      }
-      unfix_(query.node_pos(), blocks_);
-      query.prev(parent_pos);
-      ++num_regress;
-    }
-
-    bc_[query.node_pos()].set_value(tail_size());
-    while (0 < num_regress--) {
-      tail_.push_back(*query.key());
-      query.next();
+      auto labels = labels_(node_pos, len);
+      suffix.insert(0, labels, len);
+      suffix.insert(0, 1, static_cast<char>(base_(parent_pos) ^ node_pos));
+      node_pos = parent_pos;
+    }
+    auto labels = labels_(node_pos, len);
+    suffix.insert(0, labels, len);
+    if (!reserve_tail_(suffix.size() + VTraits::BYTES)) { // the chain is left as it is
+      return;
     }
-    tail_.push_back(*edge.begin());
 
     if (*edge.begin() != '\0') {
-      while (tail_[value] != '\0') {
-        tail_.push_back(tail_[value++]);
-        ++tail_emps_;
-      }
-      tail_.push_back(tail_[value++]);
-      ++tail_emps_;
-      for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-        tail_.push_back(tail_[value++]);
-        ++tail_emps_;
+      if (shared_tail_ && !is_inline_(leaf)) {
+        drop_shared_tail_(leaf, tail_len + VTraits::BYTES);
+      } else if (!is_inline_(leaf)) {
+        free_tail_(leaf, tail_len + VTraits::BYTES);
       }
     } else {
-      for (size_t i = 0; i < sizeof(uint32_t); ++i) {
-        tail_.push_back(static_cast<uint8_t>(value & 0xFF));
-        value >>= 8;
+      free_terminal_(leaf);
+    }
+    relink_jump_(child_pos, ROOT_POS);
+    unfix_(child_pos, blocks_);
+
+    for (auto pos = query.node_pos(); pos != node_pos;) {
+      auto parent_pos = bc_[pos].check();
+      decompress_(pos);
+      if (WithNLM) {
+        delete_sib_(pos);
       }
+      relink_jump_(pos, ROOT_POS);
+      unfix_(pos, blocks_);
+      pos = parent_pos;
     }
+    decompress_(node_pos);
+
+    query.set_node_pos(node_pos);
+    auto suffix_len = static_cast<uint32_t>(suffix.size());
+    edit_bc_(node_pos).set_value(insert_tail_(suffix.data(), suffix_len, value));
   }
 
   void rebuild_(DaTrie& rhs_trie) const {
     assert(rhs_trie.is_empty());
+    rhs_trie.no_inline_ = no_inline_;
 
     if (is_empty()) {
       return;
     }
 
-    using NodePair = std::pair<uint32_t, uint32_t>;
+    using NodePair = std::pair<IndexType, IndexType>;
 
-    std::vector<NodePair> np_stack;
-    np_stack.reserve(num_nodes());
-    np_stack.push_back({ROOT_POS, ROOT_POS});
+    struct HotPair { // the later pushed first among equally hot ones, as in DFS
+      uint32_t count;
+      IndexType order;
+      NodePair node_pair;
+
+      bool operator<(const HotPair& rhs) const {
+        return count != rhs.count ? count < rhs.count : order < rhs.order;
+      }
+    };
+
+    // the nodes are laid out hottest first with a profile, or else by layout_
+    auto layout = layout_;
+    std::vector<NodePair> np_stack; // for DFS
+    std::deque<NodePair> np_queue; // for BFS
+    std::priority_queue<HotPair> np_heap; // for profiles
+    std::vector<IndexType> veb_order, rhs_poses; // for VEB, rhs_poses by the old positions
+    size_t num_pending = 0, veb_pos = 0;
+    IndexType num_pushed = 0;
+
+    auto push = [&](const NodePair& node_pair) {
+      ++num_pending;
+      if (!profile_.empty()) {
+        auto count = node_pair.first < profile_.size() ? profile_[node_pair.first] : 0;
+        np_heap.push(HotPair{count, num_pushed++, node_pair});
+      } else if (layout == Layout::BFS) {
+        np_queue.push_back(node_pair);
+      } else if (layout == Layout::VEB) {
+        rhs_poses[node_pair.first] = node_pair.second;
+      } else {
+        np_stack.push_back(node_pair);
+      }
+    };
+    auto pop = [&]() {
+      --num_pending;
+      NodePair node_pair;
+      if (!profile_.empty()) {
+        node_pair = np_heap.top().node_pair;
+        np_heap.pop();
+      } else if (layout == Layout::BFS) {
+        node_pair = np_queue.front();
+        np_queue.pop_front();
+      } else if (layout == Layout::VEB) {
+        while (rhs_poses[veb_order[veb_pos]] == Traits::NOT_FOUND) { // inside collapsed chains
+          ++veb_pos;
+        }
+        node_pair.first = veb_order[veb_pos++];
+        node_pair.second = rhs_poses[node_pair.first];
+      } else {
+        node_pair = np_stack.back();
+        np_stack.pop_back();
+      }
+      return node_pair;
+    };
+
+    if (!profile_.empty()) {
+      layout = Layout::DFS; // not used
+    } else if (layout == Layout::VEB) {
+      veb_order.reserve(num_nodes());
+      veb_order_(ROOT_POS, height_(), veb_order);
+      rhs_poses.resize(bc_size(), Traits::NOT_FOUND);
+    } else if (layout == Layout::DFS) {
+      np_stack.reserve(num_nodes());
+    }
+    push({ROOT_POS, ROOT_POS});
 
     rhs_trie.fix_(ROOT_POS, rhs_trie.blocks_);
-    rhs_trie.bc_[ROOT_POS].set_check(INVALID_VALUE);
+    rhs_trie.edit_bc_(ROOT_POS).set_check(Traits::INVALID);
 
-    while (!np_stack.empty()) {
-      const NodePair node_pair = np_stack.back();
-      np_stack.pop_back();
+    while (num_pending != 0) {
+      const NodePair node_pair = pop();
 
       if (WithNLM) {
-        rhs_trie.node_links_[node_pair.second] = node_links_[node_pair.first];
+        rhs_trie.edit_link_(node_pair.second) = node_links_[node_pair.first];
       }
 
       if (bc_[node_pair.first].is_leaf()) {
         if (is_terminal_(node_pair.first)) {
-          rhs_trie.bc_[node_pair.second].set_value(bc_[node_pair.first].value());
+          auto value = terminal_value_(bc_[node_pair.first].value());
+          rhs_trie.edit_bc_(node_pair.second).set_value(rhs_trie.make_terminal_(value));
         } else {
-          auto tail = tail_.data() + bc_[node_pair.first].value();
+          char buf[MAX_INLINE_LENGTH + 1];
+          auto leaf = bc_[node_pair.first].value();
+          auto tail = leaf_suffix_(leaf, buf);
           Query query(tail);
-          query.set_value(utils::extract_value(tail + utils::length(tail)));
+          query.set_value(leaf_value_(leaf, tail + utils::length(tail)));
           query.set_node_pos(node_pair.second);
           rhs_trie.insert_tail_(query);
         }
@@ -673,16 +2063,104 @@ protected:
       Edge edge;
       edge_(node_pair.first, edge);
 
+      // single-child chains are collapsed into one compressed edge
+      uint32_t len = 0;
+      auto node_labels = labels_(node_pair.first, len);
+      std::string labels(node_labels, len);
+      auto node_pos = node_pair.first;
+      while (edge_compression_ && edge.size() == 1) {
+        auto child_pos = base_(node_pos) ^*edge.begin();
+        if (bc_[child_pos].is_leaf()) {
+          break;
+        }
+        auto child_labels = labels_(child_pos, len);
+        if (MAX_EDGE_LENGTH < labels.size() + 1 + len) {
+          break;
+        }
+        labels += static_cast<char>(*edge.begin());
+        labels.append(child_labels, len);
+        node_pos = child_pos;
+        edge_(node_pos, edge);
+      }
+
+      // or else expanded into single-child nodes again
+      auto rhs_pos = node_pair.second;
+      if (!edge_compression_) {
+        for (auto c : labels) {
+          auto label = static_cast<uint8_t>(c);
+          auto rhs_base = rhs_trie.xcheck_(label, rhs_trie.blocks_);
+          rhs_trie.edit_bc_(rhs_pos).set_base(rhs_base);
+          auto rhs_child_pos = rhs_base ^label;
+          rhs_trie.fix_(rhs_child_pos, rhs_trie.blocks_);
+          rhs_trie.edit_bc_(rhs_child_pos).set_check(rhs_pos);
+          if (WithNLM) {
+            rhs_trie.edit_link_(rhs_pos).child = label;
+            rhs_trie.edit_link_(rhs_child_pos).sib = label;
+          }
+          rhs_pos = rhs_child_pos;
+        }
+        labels.clear();
+      }
+
       auto rhs_base = rhs_trie.xcheck_(edge, rhs_trie.blocks_);
-      rhs_trie.bc_[node_pair.second].set_base(rhs_base);
+      rhs_trie.compress_(rhs_pos, labels.data(), static_cast<uint32_t>(labels.size()), rhs_base);
+      if (WithNLM) {
+        rhs_trie.edit_link_(rhs_pos).child = node_links_[node_pos].child;
+      }
 
       for (auto label : edge) {
         auto rhs_child_pos = rhs_base ^label;
         rhs_trie.fix_(rhs_child_pos, rhs_trie.blocks_);
-        rhs_trie.bc_[rhs_child_pos].set_check(node_pair.second);
-        np_stack.push_back({bc_[node_pair.first].base() ^ label, rhs_child_pos});
+        rhs_trie.edit_bc_(rhs_child_pos).set_check(rhs_pos);
+        push({base_(node_pos) ^ label, rhs_child_pos});
+      }
+    }
+  }
+
+  uint32_t height_() const { // the number of levels of nodes
+    std::vector<std::pair<IndexType, uint32_t>> stack{{ROOT_POS, 1}};
+    uint32_t height = 0;
+    Edge edge;
+    while (!stack.empty()) {
+      auto node = stack.back();
+      stack.pop_back();
+      height = std::max(height, node.second);
+      edge_(node.first, edge);
+      for (auto label : edge) {
+        stack.push_back({base_(node.first) ^ label, node.second + 1});
+      }
+    }
+    return height;
+  }
+
+  // appends the nodes within height levels from node_pos in the van Emde Boas
+  // order, that is, the top half of the levels and then each subtree below them
+  void veb_order_(IndexType node_pos, uint32_t height, std::vector<IndexType>& order) const {
+    if (height == 1) {
+      order.push_back(node_pos);
+      return;
+    }
+    auto top_height = height / 2;
+    veb_order_(node_pos, top_height, order);
+
+    std::vector<IndexType> bottoms; // the roots of the subtrees below the top levels
+    std::vector<std::pair<IndexType, uint32_t>> stack{{node_pos, 0}};
+    Edge edge;
+    while (!stack.empty()) {
+      auto node = stack.back();
+      stack.pop_back();
+      if (node.second == top_height) {
+        bottoms.push_back(node.first);
+        continue;
+      }
+      edge_(node.first, edge);
+      for (auto it = edge.end(); it != edge.begin();) { // to visit in the label order
+        stack.push_back({base_(node.first) ^ *--it, node.second + 1});
       }
     }
+    for (auto bottom : bottoms) {
+      veb_order_(bottom, height - top_height, order);
+    }
   }
 
   void solve_(Query& query) {
@@ -690,10 +2168,10 @@ protected:
     assert(bc_[query.node_pos()].is_fixed());
 
     Edge edges[2] = {};
-    edge_(query.node_pos(), edges[0]);
+    edge_(query.node_pos(), edges[0], 255); // without query.label(), so room for it
 
-    uint32_t _node_pos = 0;
-    auto child_pos = bc_[query.node_pos()].base() ^query.label();
+    IndexType _node_pos = 0;
+    auto child_pos = base_(query.node_pos()) ^query.label();
 
     if (child_pos != 0) {
       _node_pos = bc_[child_pos].check();
@@ -711,7 +2189,7 @@ protected:
     }
   }
 
-  void shelter_(uint32_t base, const Edge& edge, Query& query) {
+  void shelter_(IndexType base, const Edge& edge, Query& query) {
     Edge _edge;
     auto ng_block = base / BLOCK_SIZE;
 
@@ -727,32 +2205,34 @@ protected:
     }
   }
 
-  void move_(uint32_t node_pos, uint32_t base, const Edge& edge, Query& query) {
+  void move_(IndexType node_pos, IndexType base, const Edge& edge, Query& query) {
     assert(node_pos < bc_.size());
     assert(bc_[node_pos].is_fixed());
     assert(0 < edge.size());
 
-    auto orig_base = bc_[node_pos].base();
+    auto orig_base = base_(node_pos);
 
     for (auto label : edge) {
       auto src_node_pos = orig_base ^label;
       auto dst_node_pos = base ^label;
 
       fix_(dst_node_pos, blocks_);
-      bc_[dst_node_pos] = bc_[src_node_pos];
+      edit_bc_(dst_node_pos) = bc_[src_node_pos];
       if (WithNLM) {
-        node_links_[dst_node_pos] = node_links_[src_node_pos];
+        edit_link_(dst_node_pos) = node_links_[src_node_pos];
       }
+      move_count_(src_node_pos, dst_node_pos);
 
       Edge src_edge;
       edge_(src_node_pos, src_edge);
 
-      auto src_base = bc_[src_node_pos].base();
+      auto src_base = base_(src_node_pos);
       for (auto src_label : src_edge) {
         auto src_child_pos = src_base ^src_label;
-        bc_[src_child_pos].set_check(dst_node_pos);
+        edit_bc_(src_child_pos).set_check(dst_node_pos);
       }
 
+      relink_jump_(src_node_pos, dst_node_pos);
       unfix_(src_node_pos, blocks_);
 
       if (src_node_pos == query.node_pos()) {
@@ -760,19 +2240,31 @@ protected:
       }
     }
 
-    bc_[node_pos].set_base(base);
+    set_base_(node_pos, base);
+  }
+
+  // carries the profiled count of a moved node, growing the profile for the
+  // positions added since profiling
+  void move_count_(IndexType src_pos, IndexType dst_pos) {
+    if (profile_.empty() || src_pos >= profile_.size()) {
+      return;
+    }
+    if (dst_pos >= profile_.size()) {
+      profile_.resize(bc_size(), 0);
+    }
+    profile_[dst_pos] = profile_[src_pos];
   }
 
-  uint32_t xcheck_(uint8_t label, const std::vector<Block>& blocks) const {
-    return head_pos_ == NOT_FOUND ? bc_size() ^ label : head_pos_ ^ label;
+  IndexType xcheck_(uint8_t label, const ResourceVector<Block>& blocks) const {
+    return head_pos_ == Traits::NOT_FOUND ? bc_size() ^ label : head_pos_ ^ label;
   }
 
-  uint32_t xcheck_(const Edge& edge, const std::vector<Block>& blocks) const {
+  IndexType xcheck_(const Edge& edge, const ResourceVector<Block>& blocks) const {
     if (edge.size() == 1) {
       return xcheck_(*edge.begin(), blocks);
     }
 
-    if (head_pos_ == NOT_FOUND) {
+    if (head_pos_ == Traits::NOT_FOUND) {
       return bc_size() ^ *edge.begin();
     }
 
@@ -791,9 +2283,9 @@ protected:
     return bc_size() ^ *edge.begin();
   }
 
-  uint32_t xcheck_(const Edge& edge, const uint32_t ng_block,
-                   const std::vector<Block>& blocks) const {
-    if (head_pos_ == NOT_FOUND) {
+  IndexType xcheck_(const Edge& edge, const IndexType ng_block,
+                   const ResourceVector<Block>& blocks) const {
+    if (head_pos_ == Traits::NOT_FOUND) {
       return bc_size() ^ *edge.begin();
     }
 
@@ -815,9 +2307,9 @@ protected:
     return bc_size() ^ *edge.begin();
   }
 
-  uint32_t excheck_(const Edge& edge, const std::vector<Block>& blocks) {
-    if (head_pos_ == NOT_FOUND) {
-      return NOT_FOUND;
+  IndexType excheck_(const Edge& edge, const ResourceVector<Block>& blocks) {
+    if (head_pos_ == Traits::NOT_FOUND) {
+      return Traits::NOT_FOUND;
     }
 
     auto upper_limit = bc_size() - BLOCK_SIZE;
@@ -834,28 +2326,28 @@ protected:
       }
     } while ((node_pos = next_(node_pos)) != head_pos_);
 
-    return NOT_FOUND;
+    return Traits::NOT_FOUND;
   }
 
-  uint32_t xcheck_(uint8_t label, const std::vector<BlockLink>& blocks) const {
-    return head_pos_ == NOT_FOUND ? bc_size() ^ label : blocks[head_pos_].head ^ label;
+  IndexType xcheck_(uint8_t label, const ResourceVector<BlockLink>& blocks) const {
+    return head_pos_ == Traits::NOT_FOUND ? bc_size() ^ label : blocks[head_pos_].head ^ label;
   }
 
-  uint32_t xcheck_(const Edge& edge, const std::vector<BlockLink>& blocks) const {
+  IndexType xcheck_(const Edge& edge, const ResourceVector<BlockLink>& blocks) const {
     assert(0 < edge.size());
 
     if (edge.size() == 1) {
       return xcheck_(*edge.begin(), blocks);
     }
 
-    if (head_pos_ == NOT_FOUND) {
+    if (head_pos_ == Traits::NOT_FOUND) {
       return bc_size() ^ *edge.begin();
     }
 
     auto block_pos = head_pos_;
     do {
       auto base = xcheck_in_block_(edge, block_pos, blocks);
-      if (base != NOT_FOUND) {
+      if (base != Traits::NOT_FOUND) {
         return base;
       }
     } while ((block_pos = blocks[block_pos].next) != head_pos_);
@@ -863,11 +2355,11 @@ protected:
     return bc_size() ^ *edge.begin();
   }
 
-  uint32_t xcheck_(const Edge& edge, const uint32_t ng_block,
-                   const std::vector<BlockLink>& blocks) const {
+  IndexType xcheck_(const Edge& edge, const IndexType ng_block,
+                   const ResourceVector<BlockLink>& blocks) const {
     assert(0 < edge.size());
 
-    if (head_pos_ == NOT_FOUND) {
+    if (head_pos_ == Traits::NOT_FOUND) {
       return bc_size() ^ *edge.begin();
     }
 
@@ -877,7 +2369,7 @@ protected:
         continue;
       }
       auto base = xcheck_in_block_(edge, block_pos, blocks);
-      if (base != NOT_FOUND) {
+      if (base != Traits::NOT_FOUND) {
         return base;
       }
     } while ((block_pos = blocks[block_pos].next) != head_pos_);
@@ -885,12 +2377,12 @@ protected:
     return bc_size() ^ *edge.begin();
   }
 
-  uint32_t xcheck_in_block_(const Edge& edge, uint32_t block_pos,
-                            const std::vector<BlockLink>& blocks) const {
+  IndexType xcheck_in_block_(const Edge& edge, IndexType block_pos,
+                            const ResourceVector<BlockLink>& blocks) const {
     assert(0 < edge.size());
 
     if (blocks[block_pos].num_emps < edge.size()) {
-      return NOT_FOUND;
+      return Traits::NOT_FOUND;
     }
 
     auto head = blocks[block_pos].head;
@@ -903,14 +2395,14 @@ protected:
       }
     } while ((node_pos = next_(node_pos)) != head);
 
-    return NOT_FOUND;
+    return Traits::NOT_FOUND;
   }
 
-  uint32_t excheck_(const Edge& edge, const std::vector<BlockLink>& blocks) {
+  IndexType excheck_(const Edge& edge, const ResourceVector<BlockLink>& blocks) {
     assert(0 < edge.size());
 
-    if (head_pos_ == NOT_FOUND) {
-      return NOT_FOUND;
+    if (head_pos_ == Traits::NOT_FOUND) {
+      return Traits::NOT_FOUND;
     }
 
     auto block_pos = head_pos_;
@@ -921,17 +2413,17 @@ protected:
         continue;
       }
       auto base = excheck_in_block_(edge, block_pos, blocks);
-      if (base != NOT_FOUND) {
+      if (base != Traits::NOT_FOUND) {
         head_pos_ = block_pos; // update for remaining
         return base;
       }
     } while ((block_pos = blocks[block_pos].next) != head_pos_);
 
-    return NOT_FOUND;
+    return Traits::NOT_FOUND;
   }
 
-  uint32_t excheck_in_block_(const Edge& edge, uint32_t block_pos,
-                             const std::vector<BlockLink>& blocks) const {
+  IndexType excheck_in_block_(const Edge& edge, IndexType block_pos,
+                             const ResourceVector<BlockLink>& blocks) const {
     assert(0 < edge.size());
 
     auto head = blocks[block_pos].head;
@@ -944,10 +2436,10 @@ protected:
       }
     } while ((node_pos = next_(node_pos)) != head);
 
-    return NOT_FOUND;
+    return Traits::NOT_FOUND;
   }
 
-  bool is_target_(uint32_t base, const Edge& edge) const {
+  bool is_target_(IndexType base, const Edge& edge) const {
     assert(0 < edge.size());
 
     for (auto label : edge) {
@@ -959,7 +2451,7 @@ protected:
     return true;
   }
 
-  bool is_target_ex_(uint32_t base, const Edge& edge) const {
+  bool is_target_ex_(IndexType base, const Edge& edge) const {
     assert(0 < edge.size());
 
     for (auto label : edge) {
@@ -977,7 +2469,7 @@ protected:
     return true;
   }
 
-  void edge_(uint32_t node_pos, Edge& edge, size_t upper = 256) const {
+  void edge_(IndexType node_pos, Edge& edge, size_t upper = 256) const {
     assert(bc_[node_pos].is_fixed());
 
     edge.clear();
@@ -985,8 +2477,8 @@ protected:
       return;
     }
 
-    auto base = bc_[node_pos].base();
-    if (base == INVALID_VALUE) { // for prefix subtrie
+    auto base = base_(node_pos);
+    if (base == Traits::INVALID) { // for prefix subtrie
       return;
     }
 
@@ -1012,15 +2504,15 @@ protected:
     }
   }
 
-  size_t edge_size_(uint32_t node_pos, size_t upper = 256) const {
+  size_t edge_size_(IndexType node_pos, size_t upper = 256) const {
     assert(bc_[node_pos].is_fixed());
 
     if (bc_[node_pos].is_leaf()) {
       return 0;
     }
 
-    auto base = bc_[node_pos].base();
-    if (base == INVALID_VALUE) { // for prefix subtrie
+    auto base = base_(node_pos);
+    if (base == Traits::INVALID) { // for prefix subtrie
       return 0;
     }
 
@@ -1041,7 +2533,7 @@ protected:
     return size;
   }
 
-  void fix_(uint32_t node_pos, std::vector<Block>& blocks) {
+  void fix_(IndexType node_pos, ResourceVector<Block>& blocks) {
     auto block_pos = node_pos / BLOCK_SIZE;
     while (num_blocks() <= block_pos) {
       push_block_();
@@ -1051,10 +2543,10 @@ protected:
     assert(!bc_[node_pos].is_fixed());
 
     --bc_emps_;
-    --blocks[block_pos].num_emps;
+    --edit_block_(blocks, block_pos).num_emps;
 
     if (bc_emps_ == 0) {
-      head_pos_ = NOT_FOUND;
+      head_pos_ = Traits::NOT_FOUND;
     } else {
       if (node_pos == head_pos_) {
         head_pos_ = next_(head_pos_);
@@ -1064,10 +2556,10 @@ protected:
       set_next_(prev, next);
       set_prev_(next, prev);
     }
-    bc_[node_pos].fix();
+    edit_bc_(node_pos).fix();
   }
 
-  void fix_(uint32_t node_pos, std::vector<BlockLink>& blocks) {
+  void fix_(IndexType node_pos, ResourceVector<BlockLink>& blocks) {
     auto block_pos = node_pos / BLOCK_SIZE;
     while (num_blocks() <= block_pos) {
       push_block_();
@@ -1077,7 +2569,7 @@ protected:
     assert(!bc_[node_pos].is_fixed());
 
     --bc_emps_;
-    --blocks[block_pos].num_emps;
+    --edit_block_(blocks, block_pos).num_emps;
 
     if (blocks[block_pos].num_emps == 0) {
       delete_block_link_(block_pos, blocks_);
@@ -1087,13 +2579,13 @@ protected:
       set_next_(prev, next);
       set_prev_(next, prev);
       if (node_pos == blocks[block_pos].head) {
-        blocks[block_pos].head = next;
+        edit_block_(blocks, block_pos).head = next;
       }
     }
-    bc_[node_pos].fix();
+    edit_bc_(node_pos).fix();
   }
 
-  void unfix_(uint32_t node_pos, std::vector<Block>& blocks) {
+  void unfix_(IndexType node_pos, ResourceVector<Block>& blocks) {
     assert(node_pos < bc_.size());
     assert(bc_[node_pos].is_fixed());
 
@@ -1110,10 +2602,13 @@ protected:
       set_prev_(head_pos_, node_pos);
     }
 
-    bc_[node_pos].unfix();
+    edit_bc_(node_pos).unfix();
+    if (node_pos < profile_.size()) { // not to be taken by the next node here
+      profile_[node_pos] = 0;
+    }
 
     ++bc_emps_;
-    ++blocks[block_pos].num_emps;
+    ++edit_block_(blocks, block_pos).num_emps;
 
     if (block_pos == num_blocks() - 1) {
       while (blocks[block_pos].num_emps == BLOCK_SIZE) {
@@ -1126,7 +2621,7 @@ protected:
     }
   }
 
-  void unfix_(uint32_t node_pos, std::vector<BlockLink>& blocks) {
+  void unfix_(IndexType node_pos, ResourceVector<BlockLink>& blocks) {
     assert(node_pos < bc_.size());
     assert(bc_[node_pos].is_fixed());
 
@@ -1135,7 +2630,7 @@ protected:
     if (blocks[block_pos].num_emps == 0) {
       set_next_(node_pos, node_pos);
       set_prev_(node_pos, node_pos);
-      blocks[block_pos].head = node_pos;
+      edit_block_(blocks, block_pos).head = node_pos;
       insert_block_link_(block_pos, blocks);
     } else {
       auto head = blocks[block_pos].head;
@@ -1145,10 +2640,13 @@ protected:
       set_prev_(head, node_pos);
     }
 
-    bc_[node_pos].unfix();
+    edit_bc_(node_pos).unfix();
+    if (node_pos < profile_.size()) { // not to be taken by the next node here
+      profile_[node_pos] = 0;
+    }
 
     ++bc_emps_;
-    ++blocks[block_pos].num_emps;
+    ++edit_block_(blocks, block_pos).num_emps;
 
     if (block_pos == num_blocks() - 1) {
       while (blocks[block_pos].num_emps == BLOCK_SIZE) {
@@ -1162,7 +2660,17 @@ protected:
   }
 
   void push_block_() {
+    if (Traits::INVALID < bc_.size() + BLOCK_SIZE) {
+      throw std::length_error("ddd: BC exceeds the index field");
+    }
+    if (!label_pool_.empty() && Traits::LABEL_FLAG < bc_.size() + BLOCK_SIZE) {
+      throw std::length_error("ddd: BC too long to flag compressed edges");
+    }
     auto block_pos = num_blocks();
+    // may take the chunks of blocks popped since the last hash_chunks()
+    chunk_hashes_[0].mark(block_pos);
+    chunk_hashes_[2].mark(block_pos / BLOCK_SIZE);
+    chunk_hashes_[3].mark(block_pos);
 
     for (uint32_t i = 0; i < BLOCK_SIZE; ++i) {
       bc_.push_back(Bc{});
@@ -1186,7 +2694,7 @@ protected:
     bc_emps_ += BLOCK_SIZE;
   }
 
-  void push_block_(uint32_t block_pos, std::vector<Block>& blocks) {
+  void push_block_(IndexType block_pos, ResourceVector<Block>& blocks) {
     auto begin = block_pos * BLOCK_SIZE;
     auto end = begin + BLOCK_SIZE;
 
@@ -1202,13 +2710,13 @@ protected:
     }
   }
 
-  void push_block_(uint32_t block_pos, std::vector<BlockLink>& blocks) {
+  void push_block_(IndexType block_pos, ResourceVector<BlockLink>& blocks) {
     auto begin = block_pos * BLOCK_SIZE;
     auto end = begin + BLOCK_SIZE;
     set_next_(end - 1, begin);
     set_prev_(begin, end - 1);
 
-    blocks[block_pos].head = begin;
+    edit_block_(blocks, block_pos).head = begin;
     insert_block_link_(block_pos, blocks);
   }
 
@@ -1231,7 +2739,7 @@ protected:
     bc_emps_ -= BLOCK_SIZE;
   }
 
-  void pop_block_(uint32_t block_pos, std::vector<Block>& blocks) {
+  void pop_block_(IndexType block_pos, ResourceVector<Block>& blocks) {
     auto begin = block_pos * BLOCK_SIZE;
     auto end = begin + BLOCK_SIZE;
 
@@ -1246,31 +2754,31 @@ protected:
     }
   }
 
-  void pop_block_(uint32_t block_pos, std::vector<BlockLink>& blocks) {
+  void pop_block_(IndexType block_pos, ResourceVector<BlockLink>& blocks) {
     delete_block_link_(block_pos, blocks);
   }
 
-  void insert_block_link_(uint32_t block_pos, std::vector<BlockLink>& blocks) {
+  void insert_block_link_(IndexType block_pos, ResourceVector<BlockLink>& blocks) {
     assert(block_pos < blocks.size());
 
-    if (head_pos_ != NOT_FOUND) {
+    if (head_pos_ != Traits::NOT_FOUND) {
       auto tail_pos = blocks[head_pos_].prev;
-      blocks[block_pos].prev = tail_pos;
-      blocks[block_pos].next = head_pos_;
-      blocks[tail_pos].next = block_pos;
-      blocks[head_pos_].prev = block_pos;
+      edit_block_(blocks, block_pos).prev = tail_pos;
+      edit_block_(blocks, block_pos).next = head_pos_;
+      edit_block_(blocks, tail_pos).next = block_pos;
+      edit_block_(blocks, head_pos_).prev = block_pos;
     } else {
-      blocks[block_pos].next = block_pos;
-      blocks[block_pos].prev = block_pos;
+      edit_block_(blocks, block_pos).next = block_pos;
+      edit_block_(blocks, block_pos).prev = block_pos;
       head_pos_ = block_pos;
     }
   }
 
-  void delete_block_link_(uint32_t block_pos, std::vector<BlockLink>& blocks) {
+  void delete_block_link_(IndexType block_pos, ResourceVector<BlockLink>& blocks) {
     assert(block_pos < blocks.size());
 
     if (blocks[block_pos].next == block_pos) {
-      head_pos_ = NOT_FOUND;
+      head_pos_ = Traits::NOT_FOUND;
       return;
     }
 
@@ -1280,8 +2788,8 @@ protected:
 
     auto prev = blocks[block_pos].prev;
     auto next = blocks[block_pos].next;
-    blocks[prev].next = next;
-    blocks[next].prev = prev;
+    edit_block_(blocks, prev).next = next;
+    edit_block_(blocks, next).prev = prev;
   }
 };
 
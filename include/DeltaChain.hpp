@@ -0,0 +1,39 @@
+#ifndef DDD_DELTA_CHAIN_HPP
+#define DDD_DELTA_CHAIN_HPP
+
+#include <fstream>
+
+#include "Dictionary.hpp"
+
+namespace ddd {
+
+// reads a dictionary of T from the file base_name and applies the deltas of
+// delta_names in order, each written against the result of the ones before,
+// making base of the result for further deltas. The base is copied into new
+// arrays, not kept mapped, since the deltas update it in place. Returns null
+// for a broken file or a delta out of order.
+template<class T>
+std::unique_ptr<T> read_delta_chain(const std::string& base_name,
+                                    const std::vector<std::string>& delta_names, DeltaBase& base) {
+  std::ifstream base_ifs{base_name};
+  if (!base_ifs) {
+    return nullptr;
+  }
+  auto dic = make_unique<T>(base_ifs);
+  if (base_ifs.fail()) {
+    return nullptr;
+  }
+  dic->delta_base(base);
+
+  for (auto& delta_name : delta_names) {
+    std::ifstream ifs{delta_name};
+    if (!ifs || !dic->read_delta(ifs, base)) {
+      return nullptr;
+    }
+  }
+  return dic;
+}
+
+} // namespace -- ddd
+
+#endif // DDD_DELTA_CHAIN_HPP
@@ -2,28 +2,179 @@
 #define DDD_DICTIONARY_HPP
 
 #include "DaTrie.hpp"
+#include "FileFormat.hpp"
 
 namespace ddd {
 
-class Dictionary {
+// The interface for dictionaries of values of T, which return
+// ValueTraits<T>::NOT_FOUND for missing keys. Every dictionary implements the
+// pure virtual functions, while the tuning and diagnostic hooks do nothing by
+// default and the other files are made from write().
+template<class T>
+class BasicDictionary {
 public:
-  virtual ~Dictionary() {}
+  virtual ~BasicDictionary() {}
 
   virtual std::string name() const = 0;
 
-  virtual uint32_t search_key(const char* key) const = 0;
-  virtual bool insert_key(const char* key, uint32_t value) = 0;
-  virtual uint32_t delete_key(const char* key) = 0;
-  virtual void enumerate(std::vector<KvPair>& kvs) const = 0;
+  virtual T search_key(const char* key) const = 0;
+  virtual bool insert_key(const char* key, T value) = 0;
+  virtual T delete_key(const char* key) = 0;
+  virtual void enumerate(std::vector<BasicKvPair<T>>& kvs) const = 0;
 
   virtual void pack() = 0;
   virtual void rebuild() = 0;
   virtual void shrink() = 0;
+  virtual void set_shared_tail(bool) {} // suffix sharing in TAIL
+  // counts the nodes visited by every period-th search for the layout of the
+  // next rebuild(), atomically so that searches stay thread-safe; 0 stops counting
+  virtual void set_profiling(uint32_t) {}
+  virtual void set_layout(Layout) {} // the node order of rebuild() without profiles
+  // whether rebuild() collapses single-child chains into compressed edges
+  virtual void set_edge_compression(bool) {}
 
   virtual void stat(Stat& ret) const = 0;
   virtual double ratio_singles() const = 0; // not in constant time
+  virtual void leaf_stat(LeafStat&) const {} // not in constant time
+  virtual void trace_key(const char*, AccessTrace&) const {} // what search_key() reads
 
-  virtual void write(std::ostream& os) const = 0;
+  virtual void write(std::ostream& os) const = 0; // in the container of FileFormat.hpp
+  // copies what write() writes, for the file to be written later by another
+  // thread; by default by parsing what write() writes
+  virtual void snapshot(FileImage& ret) const {
+    std::string bytes;
+    utils::StringOutputBuf obuf(&bytes);
+    std::ostream os(&obuf);
+    write(os);
+    utils::SpanInputBuf ibuf(bytes.data(), bytes.size());
+    std::istream is(&ibuf);
+    utils::read_file(is, 0, ret);
+  }
+  // writes the dictionary rebuilt and compressed for archives, read back by
+  // the constructors reading write(); smaller but slower to write and read,
+  // or write() by default
+  virtual void write_compressed(std::ostream& os) const {
+    write(os);
+  }
+
+  // Deltas hold the blocks of BC and the pages of the other arrays changed
+  // since a base, which is made by delta_base() of the dictionary as written,
+  // and is updated by each delta written or read. By default, no delta is
+  // written or read.
+  virtual void delta_base(DeltaBase& ret) const {
+    ret = DeltaBase{};
+  }
+  virtual void write_delta(DeltaBase&, std::ostream& os) const {
+    os.setstate(std::ios::failbit);
+  }
+  // applies a delta written against base, the dictionary as it is; for
+  // another base or a broken delta, sets the failbit and returns false, when
+  // the dictionary is left as it is unless the delta is broken inside
+  virtual bool read_delta(std::istream& is, DeltaBase&) {
+    is.setstate(std::ios::failbit);
+    return false;
+  }
+};
+
+using Dictionary = BasicDictionary<uint32_t>; // also for sets of ValueTraits<void>
+
+// The base of a dictionary in front of another one, which forwards all but
+// what the derived one overrides
+template<class T>
+class ForwardingDictionary : public BasicDictionary<T> {
+public:
+  explicit ForwardingDictionary(std::unique_ptr<BasicDictionary<T>> dic) : dic_{std::move(dic)} {}
+  virtual ~ForwardingDictionary() {}
+
+  T search_key(const char* key) const {
+    return dic_->search_key(key);
+  }
+
+  bool insert_key(const char* key, T value) {
+    return dic_->insert_key(key, value);
+  }
+
+  T delete_key(const char* key) {
+    return dic_->delete_key(key);
+  }
+
+  void enumerate(std::vector<BasicKvPair<T>>& kvs) const {
+    dic_->enumerate(kvs);
+  }
+
+  void pack() {
+    dic_->pack();
+  }
+
+  void rebuild() {
+    dic_->rebuild();
+  }
+
+  void shrink() {
+    dic_->shrink();
+  }
+
+  void set_shared_tail(bool shared) {
+    dic_->set_shared_tail(shared);
+  }
+
+  void set_profiling(uint32_t period) {
+    dic_->set_profiling(period);
+  }
+
+  void set_layout(Layout layout) {
+    dic_->set_layout(layout);
+  }
+
+  void set_edge_compression(bool enabled) {
+    dic_->set_edge_compression(enabled);
+  }
+
+  void stat(Stat& ret) const {
+    dic_->stat(ret);
+  }
+
+  double ratio_singles() const {
+    return dic_->ratio_singles();
+  }
+
+  void leaf_stat(LeafStat& ret) const {
+    dic_->leaf_stat(ret);
+  }
+
+  void trace_key(const char* key, AccessTrace& trace) const {
+    dic_->trace_key(key, trace);
+  }
+
+  void write(std::ostream& os) const {
+    dic_->write(os);
+  }
+
+  void snapshot(FileImage& ret) const {
+    dic_->snapshot(ret);
+  }
+
+  void write_compressed(std::ostream& os) const {
+    dic_->write_compressed(os);
+  }
+
+  void delta_base(DeltaBase& ret) const {
+    dic_->delta_base(ret);
+  }
+
+  void write_delta(DeltaBase& base, std::ostream& os) const {
+    dic_->write_delta(base, os);
+  }
+
+  bool read_delta(std::istream& is, DeltaBase& base) {
+    return dic_->read_delta(is, base);
+  }
+
+  ForwardingDictionary(const ForwardingDictionary&) = delete;
+  ForwardingDictionary& operator=(const ForwardingDictionary&) = delete;
+
+protected:
+  std::unique_ptr<BasicDictionary<T>> dic_;
 };
 
 } // namespace -- ddd
@@ -1,68 +1,125 @@
 #ifndef DDD_DICTIONARY_MLT_HPP
 #define DDD_DICTIONARY_MLT_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <map>
 #include <thread>
+#include "BloomFilter.hpp"
 #include "Dictionary.hpp"
 
 namespace ddd {
 
-template<bool WithBLM, bool WithNLM>
-class DictionaryMLT : public Dictionary {
+template<bool WithBLM, bool WithNLM, bool Wide = false, class Value = uint32_t>
+class DictionaryMLT : public BasicDictionary<typename ValueTraits<Value>::Type> {
 public:
-  using PrefixTrieType = DaTrie<WithBLM, WithNLM, true>;
-  using SuffixTrieType = DaTrie<WithBLM, WithNLM, false>;
+  using PrefixTrieType = DaTrie<WithBLM, WithNLM, true, Wide, Value>;
+  using SuffixTrieType = DaTrie<WithBLM, WithNLM, false, Wide, Value>;
+  using Query = typename SuffixTrieType::Query;
+  using VTraits = typename SuffixTrieType::VTraits;
+  using ValueType = typename SuffixTrieType::ValueType;
+  using KvPair = typename SuffixTrieType::KvPair;
 
   std::string name() const {
     return "DictionaryMLT";
   }
 
   DictionaryMLT() {
-    prefix_subtrie_ = make_unique<PrefixTrieType>();
+    prefix_subtrie_ = make_unique<PrefixTrieType>(&pool_);
   }
 
   DictionaryMLT(const std::vector<const char*>& prefixes) {
-    prefix_subtrie_ = make_unique<PrefixTrieType>(prefixes);
+    prefix_subtrie_ = make_unique<PrefixTrieType>(prefixes, &pool_);
   }
 
-  DictionaryMLT(std::istream& is) {
-    prefix_subtrie_ = make_unique<PrefixTrieType>(is);
-    size_t num_suffixes = 0;
-    utils::read_value(num_suffixes, is);
-    suffix_subtries_.resize(num_suffixes);
-    for (size_t i = 0; i < num_suffixes; ++i) {
-      bool has_trie{};
-      utils::read_value(has_trie, is);
-      if (has_trie) {
-        suffix_subtries_[i] = make_unique<SuffixTrieType>(is);
-      }
+  // The file, by write() or write_compressed(), has the prefix trie in the
+  // first section and each suffix subtrie in its own. If lazy, only the first
+  // one is read and is is kept to read each subtrie on its first access, so
+  // that is has to outlive the dictionary or load_suffixes(), and searches are
+  // not thread-safe until then. For a file of another dictionary or a broken
+  // one, the failbit of is is set and the dictionary is left empty, or a
+  // lazy load of a broken subtrie throws std::ios_base::failure, leaving the
+  // subtrie unloaded, so that it is never used or written as an empty one.
+  DictionaryMLT(std::istream& is, bool lazy = false) {
+    prefix_subtrie_ = make_unique<PrefixTrieType>(&pool_);
+    if (utils::is_raw_file(is)) {
+      read_raw_(is);
+      return;
+    }
+
+    source_pos_ = is.tellg();
+    auto is_read = read_head_(is);
+    if (is_read && lazy) {
+      source_ = &is;
+      return;
+    }
+    for (uint32_t i = 0; is_read && i < suffix_subtries_.size(); ++i) {
+      is_read = read_suffix_(i, is);
+    }
+    sections_.clear();
+    if (!is_read) {
+      clear_();
+      is.setstate(std::ios::failbit);
+    }
+  }
+
+  // reads the file of is as above but the suffix subtries concurrently by
+  // num_threads threads, which fetch the sections by read(offset, bytes) from
+  // the same file, e.g. by PreadReader, and make the subtries in pools of
+  // their own
+  template<class Reader>
+  DictionaryMLT(std::istream& is, const Reader& read, uint32_t num_threads) {
+    assert(0 < num_threads);
+    prefix_subtrie_ = make_unique<PrefixTrieType>(&pool_);
+    if (utils::is_raw_file(is)) {
+      read_raw_(is);
+      return;
+    }
+
+    source_pos_ = is.tellg();
+    auto is_read = read_head_(is) && read_suffixes_(read, num_threads);
+    sections_.clear();
+    if (!is_read) {
+      clear_();
+      is.setstate(std::ios::failbit);
     }
-    utils::read_value(suffix_head_, is);
-    utils::read_value(num_keys_, is);
   }
 
   ~DictionaryMLT() {}
 
-  uint32_t search_key(const char* key) const {
+  ValueType search_key(const char* key) const {
     Query query(key);
 
     if (!prefix_subtrie_->search_prefix(query)) {
-      return NOT_FOUND;
+      return VTraits::NOT_FOUND;
     }
 
     if (query.is_finished()) {
       return query.value();
     }
 
+    auto& slot = suffix_subtries_[query.value()];
+    if (filter_bits_ != 0 && !slot.filter.may_contain(utils::hash(query.key()))) {
+      return VTraits::NOT_FOUND;
+    }
+
+    auto& subtrie = suffix_(static_cast<uint32_t>(query.value()));
+    if (subtrie.is_empty()) { // failed to load
+      return VTraits::NOT_FOUND;
+    }
     query.set_node_pos(ROOT_POS);
-    if (!suffix_subtries_[query.value()]->search_key(query)) {
-      return NOT_FOUND;
+    if (!subtrie.search_key(query)) {
+      return VTraits::NOT_FOUND;
     }
     return query.value();
   }
 
-  bool insert_key(const char* key, uint32_t value) {
-    assert((value >> 31) == 0);
+  bool insert_key(const char* key, ValueType value) { // value is ignored for sets
+    assert(!VTraits::HAS_VALUE || (value >> VTraits::BITS) == 0);
 
+    if (!VTraits::HAS_VALUE) {
+      value = 0;
+    }
     Query query(key);
 
     if (!prefix_subtrie_->search_prefix(query)) {
@@ -78,25 +135,39 @@ public:
         ++num_keys_;
         return true;
       }
+    } else if (query.is_finished()) { // the key is in the prefix trie
+      return false;
     }
 
-    auto suffix_id = query.value();
+    auto suffix_id = static_cast<uint32_t>(query.value());
+    auto suffix = query.key();
     query.set_node_pos(ROOT_POS);
     query.set_value(value);
 
-    if (!suffix_subtries_[suffix_id]->insert_key(query)) {
+    auto subtrie = &suffix_(suffix_id);
+    if (!subtrie->insert_key(query)) {
       return false;
     }
 
     ++num_keys_;
+    if (filter_bits_ != 0) {
+      auto& filter = suffix_subtries_[suffix_id].filter;
+      filter.add(utils::hash(suffix));
+      if (filter.is_full()) {
+        make_filter_(suffix_id);
+      }
+    }
+    if (split_threshold_ != 0 && split_threshold_ < subtrie->num_nodes()) {
+      split_suffix_(suffix_id, std::string(key, suffix));
+    }
     return true;
   }
 
-  uint32_t delete_key(const char* key) {
+  ValueType delete_key(const char* key) {
     Query query(key);
 
     if (!prefix_subtrie_->search_prefix(query)) {
-      return NOT_FOUND;
+      return VTraits::NOT_FOUND;
     }
 
     if (query.is_finished()) {
@@ -106,23 +177,18 @@ public:
     }
 
     auto leaf_pos = query.node_pos();
-    auto suffix_id = query.value();
+    auto suffix_id = static_cast<uint32_t>(query.value());
 
+    auto& subtrie = suffix_(suffix_id);
     query.set_node_pos(ROOT_POS);
-    if (!suffix_subtries_[suffix_id]->delete_key(query)) {
-      return NOT_FOUND;
+    if (subtrie.is_empty() || !subtrie.delete_key(query)) {
+      return VTraits::NOT_FOUND;
     }
 
-    if (suffix_subtries_[suffix_id]->is_empty()) { // update suffix link
+    if (subtrie.is_empty()) { // update suffix link
       query.set_node_pos(leaf_pos);
       prefix_subtrie_->delete_prefix_leaf(query);
-      suffix_subtries_[suffix_id].reset();
-
-      if (suffix_id + 1 == suffix_subtries_.size()) {
-        suffix_subtries_.pop_back();
-      } else if (suffix_id < suffix_head_) {
-        suffix_head_ = suffix_id;
-      }
+      free_suffix_id_(suffix_id);
     }
 
     --num_keys_;
@@ -134,25 +200,28 @@ public:
     if (prefix_subtrie_->is_empty()) {
       return;
     }
+    load_suffixes();
     kvs.reserve(num_keys_);
 
     std::vector<KvPair> prefix_kvs;
-    prefix_subtrie_->enumerate_prefix(ROOT_POS, std::string{}, prefix_kvs);
-
-    for (const auto& prefix_kv : prefix_kvs) {
-      if ((prefix_kv.value >> 31) == 1) { // is terminal
-        kvs.push_back(KvPair{prefix_kv.key, prefix_kv.value & (1U << 31)});
-      } else {
-        suffix_subtries_[prefix_kv.value]->enumerate(ROOT_POS, prefix_kv.key, kvs);
+    std::vector<bool> terminals;
+    prefix_subtrie_->enumerate_prefix(ROOT_POS, std::string{}, prefix_kvs, terminals);
+
+    for (size_t i = 0; i < prefix_kvs.size(); ++i) {
+      if (terminals[i]) {
+        kvs.push_back(prefix_kvs[i]);
+      } else if (has_suffix_(prefix_kvs[i].value)) {
+        suffix_subtries_[prefix_kvs[i].value].trie->enumerate(ROOT_POS, prefix_kvs[i].key, kvs);
       }
     }
   }
 
   void pack() {
+    load_suffixes();
     auto func = [&](uint32_t id) {
-      if (suffix_subtries_[id]) {
-        suffix_subtries_[id]->pack_bc();
-        suffix_subtries_[id]->pack_tail();
+      if (has_suffix_(id)) {
+        suffix_subtries_[id].trie->pack_bc();
+        suffix_subtries_[id].trie->pack_tail();
       }
     };
 
@@ -166,10 +235,15 @@ public:
     }
   }
 
-  void rebuild() {
+  void rebuild() { // also remakes the filters to forget deleted keys
+    load_suffixes();
     auto func = [&](uint32_t id) {
-      if (suffix_subtries_[id]) {
-        suffix_subtries_[id]->rebuild();
+      if (has_suffix_(id)) {
+        suffix_subtries_[id].trie->set_layout(layout_);
+        suffix_subtries_[id].trie->rebuild();
+        if (filter_bits_ != 0) {
+          make_filter_(id);
+        }
       }
     };
 
@@ -183,15 +257,170 @@ public:
     }
   }
 
+  void set_shared_tail(bool shared) {
+    load_suffixes();
+    shared_tail_ = shared;
+
+    auto func = [&](uint32_t id) {
+      if (suffix_subtries_[id].trie) {
+        suffix_subtries_[id].trie->set_shared_tail(shared);
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.resize(suffix_subtries_.size());
+    for (uint32_t i = 0; i < suffix_subtries_.size(); ++i) {
+      threads[i] = std::thread(func, i);
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+  }
+
+  void set_profiling(uint32_t period) { // of the subtries made so far
+    load_suffixes();
+    for (auto& slot : suffix_subtries_) {
+      if (slot.trie) {
+        slot.trie->set_profiling(period);
+      }
+    }
+  }
+
+  void set_layout(Layout layout) {
+    layout_ = layout;
+  }
+
+  void set_edge_compression(bool enabled) { // also of the subtries made later
+    load_suffixes();
+    edge_compression_ = enabled;
+    for (auto& slot : suffix_subtries_) {
+      if (slot.trie) {
+        slot.trie->set_edge_compression(enabled);
+      }
+    }
+  }
+
   void shrink() {
+    load_suffixes();
     for (size_t i = 0; i < suffix_subtries_.size(); ++i) {
-      if (suffix_subtries_[i]) {
-        suffix_subtries_[i]->shrink();
+      if (has_suffix_(i)) {
+        suffix_subtries_[i].trie->shrink();
+      }
+    }
+  }
+
+  // Attaches a Bloom filter of the suffixes to each suffix subtrie, with
+  // bits_per_key bits per key, so that most misses return without searching
+  // the subtrie. 0 detaches them. Deleted keys stay in the filters until
+  // rebuild(), and the filters are not written.
+  void set_filter_bits(size_t bits_per_key) {
+    load_suffixes();
+    filter_bits_ = bits_per_key;
+    for (uint32_t i = 0; i < suffix_subtries_.size(); ++i) {
+      if (filter_bits_ != 0 && has_suffix_(i)) {
+        make_filter_(i);
+      } else {
+        suffix_subtries_[i].filter.clear();
       }
     }
   }
 
+  // A suffix subtrie growing beyond num_nodes nodes is split by registering
+  // its prefix, so that its keys move to the subtries of one more character.
+  // It is 0, never splitting, by default and is not written.
+  void set_split_threshold(size_t num_nodes) {
+    split_threshold_ = num_nodes;
+  }
+
+  // Drops the registered prefixes whose suffix subtries have num_nodes nodes
+  // at most in total, from the longest, and folds the keys below each of them
+  // into one subtrie. The other subtries are linked again as they are.
+  void merge_subtries(size_t num_nodes) {
+    load_suffixes();
+    std::vector<KvPair> leaves;
+    std::vector<bool> terminals;
+    prefix_subtrie_->enumerate_prefix(ROOT_POS, std::string{}, leaves, terminals);
+
+    std::map<std::string, PrefixNode> nodes; // registered prefixes holding keys
+    std::vector<std::string> parents(leaves.size());
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      auto& key = leaves[i].key;
+      parents[i] = terminals[i] ? key : key.substr(0, key.size() - 1);
+      for (size_t len = 0; len <= parents[i].size(); ++len) {
+        nodes.emplace(parents[i].substr(0, len), PrefixNode{});
+      }
+      auto id = static_cast<uint32_t>(leaves[i].value);
+      nodes[parents[i]].num_nodes += terminals[i] ? 1 : suffix_subtries_[id].trie->num_nodes();
+    }
+
+    if (nodes.empty()) {
+      return;
+    }
+    nodes.begin()->second.is_kept = true; // the root
+
+    bool is_merged = false;
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) { // descendants first
+      auto& prefix = it->first;
+      auto& node = it->second;
+      if (prefix.empty()) {
+        continue;
+      }
+      auto& parent = nodes[prefix.substr(0, prefix.size() - 1)];
+      if (!node.is_kept && node.num_nodes <= num_nodes) {
+        parent.num_nodes += node.num_nodes + 1;
+        is_merged = true;
+      } else {
+        node.is_kept = true;
+        parent.is_kept = true;
+      }
+    }
+    if (!is_merged) {
+      return;
+    }
+
+    // moves out the keys below the dropped prefixes
+    std::vector<KvPair> kvs;
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      if (nodes[parents[i]].is_kept) {
+        continue;
+      }
+      if (terminals[i]) {
+        kvs.push_back(leaves[i]);
+        continue;
+      }
+      auto id = static_cast<uint32_t>(leaves[i].value);
+      SuffixTrieType trie(&pool_);
+      trie.swap(*suffix_subtries_[id].trie);
+      if (!trie.is_empty()) {
+        trie.enumerate(ROOT_POS, leaves[i].key, kvs);
+      }
+      free_suffix_id_(id);
+    }
+
+    auto prefix_subtrie = make_unique<PrefixTrieType>(&pool_);
+    for (auto& node : nodes) {
+      if (node.second.is_kept) {
+        prefix_subtrie->register_prefix(node.first.c_str());
+      }
+    }
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      if (nodes[parents[i]].is_kept) {
+        Query query(leaves[i].key.c_str());
+        prefix_subtrie->search_prefix(query);
+        query.set_value(leaves[i].value);
+        prefix_subtrie->insert_prefix_leaf(query);
+      }
+    }
+    prefix_subtrie_ = std::move(prefix_subtrie);
+
+    num_keys_ -= kvs.size();
+    for (auto& kv : kvs) {
+      insert_key(kv.key.c_str(), kv.value);
+    }
+  }
+
   void stat(Stat& ret) const {
+    load_suffixes();
     ret.num_keys = num_keys_;
     ret.num_tries = 1;
     ret.num_nodes = prefix_subtrie_->num_nodes();
@@ -201,11 +430,16 @@ public:
     ret.tail_size = prefix_subtrie_->tail_size();
     ret.tail_capa = prefix_subtrie_->tail_capa();
     ret.tail_emps = prefix_subtrie_->tail_emps();
+    ret.tail_holes = prefix_subtrie_->tail_holes();
+    ret.tail_saved = prefix_subtrie_->tail_saved();
+    ret.label_size = prefix_subtrie_->label_size();
+    ret.filter_size = 0;
+    ret.hole_size = prefix_subtrie_->hole_size();
     ret.size_in_bytes = prefix_subtrie_->size_in_bytes();
 
     for (size_t i = 0; i < suffix_subtries_.size(); ++i) {
-      auto& subtrie = suffix_subtries_[i];
-      if (subtrie) {
+      auto& subtrie = suffix_subtries_[i].trie;
+      if (has_suffix_(i)) {
         ret.num_nodes += subtrie->num_nodes();
         ret.bc_size += subtrie->bc_size();
         ret.bc_capa += subtrie->bc_capa();
@@ -213,76 +447,558 @@ public:
         ret.tail_size += subtrie->tail_size();
         ret.tail_capa += subtrie->tail_capa();
         ret.tail_emps += subtrie->tail_emps();
+        ret.tail_holes += subtrie->tail_holes();
+        ret.tail_saved += subtrie->tail_saved();
+        ret.label_size += subtrie->label_size();
         ret.size_in_bytes += subtrie->size_in_bytes();
+        ret.filter_size += suffix_subtries_[i].filter.size_in_bytes();
+        ret.hole_size += subtrie->hole_size();
         ++ret.num_tries;
       }
-      ret.size_in_bytes += sizeof(bool);
     }
 
-    ret.size_in_bytes += sizeof(suffix_subtries_.size());
-    ret.size_in_bytes += sizeof(suffix_head_);
-    ret.size_in_bytes += sizeof(num_keys_);
+    ret.size_in_bytes += sizeof(uint64_t); // the number of the subtries
+    ret.size_in_bytes += sizeof(uint64_t); // num_keys_
+    ret.size_in_bytes += sizeof(shared_tail_);
+    ret.size_in_bytes += utils::file_overhead(static_cast<uint32_t>(suffix_subtries_.size() + 1));
   }
 
   double ratio_singles() const { // not in constant time
+    load_suffixes();
     size_t num_singles = prefix_subtrie_->num_singles();
     size_t num_nodes = prefix_subtrie_->num_nodes();
-    for (auto &subtrie : suffix_subtries_) {
-      if (!subtrie) {
+    for (auto &slot : suffix_subtries_) {
+      if (!slot.trie) {
         continue;
       }
-      num_singles += subtrie->num_singles();
-      num_nodes += subtrie->num_nodes();
+      num_singles += slot.trie->num_singles();
+      num_nodes += slot.trie->num_nodes();
     }
     return static_cast<double>(num_singles) / num_nodes;
   }
 
-  void write(std::ostream& os) const {
-    prefix_subtrie_->write(os);
-    auto num_suffixes = suffix_subtries_.size();
-    utils::write_value(num_suffixes, os);
-    for (size_t i = 0; i < num_suffixes; ++i) {
-      if (suffix_subtries_[i]) {
-        utils::write_value(true, os);
-        suffix_subtries_[i]->write(os);
+  void leaf_stat(LeafStat& ret) const { // not in constant time
+    load_suffixes();
+    ret = LeafStat{};
+    prefix_subtrie_->leaf_stat(ret);
+    for (auto &slot : suffix_subtries_) {
+      if (slot.trie) {
+        slot.trie->leaf_stat(ret);
+      }
+    }
+  }
+
+  void trace_key(const char* key, AccessTrace& trace) const { // filters aside
+    Query query(key);
+    if (!prefix_subtrie_->trace_key(query, trace) || query.is_finished()) {
+      return;
+    }
+    auto& slot = suffix_subtries_[query.value()];
+    trace.emplace_back(&slot, sizeof(slot));
+    auto& subtrie = suffix_(static_cast<uint32_t>(query.value()));
+    if (!subtrie.is_empty()) {
+      query.set_node_pos(ROOT_POS);
+      subtrie.trace_key(query, trace);
+    }
+  }
+
+  void write(std::ostream& os) const { // the empty slots in empty sections
+    load_suffixes();
+    auto num_sections = static_cast<uint32_t>(suffix_subtries_.size() + 1);
+    utils::write_file(os, file_type_(), num_sections, [&](uint32_t i, std::ostream& sos) {
+      write_section_(i, sos);
+    });
+  }
+
+  void snapshot(FileImage& ret) const {
+    load_suffixes();
+    auto num_sections = static_cast<uint32_t>(suffix_subtries_.size() + 1);
+    utils::capture_file(file_type_(), num_sections, [&](uint32_t i) {
+      return section_size_(i);
+    }, [&](uint32_t i, std::ostream& sos) {
+      write_section_(i, sos);
+    }, ret);
+  }
+
+  void write_compressed(std::ostream& os) const { // in the sections of write()
+    load_suffixes();
+    auto num_sections = static_cast<uint32_t>(suffix_subtries_.size() + 1);
+    utils::write_file(os, file_type_(FileKind::MLT_COMPRESSED), num_sections,
+                      [&](uint32_t i, std::ostream& sos) {
+      write_section_(i, sos, true);
+    });
+  }
+
+  void delta_base(DeltaBase& ret) const {
+    load_suffixes();
+    ret.tries.assign(suffix_subtries_.size() + 1, TrieHashes{});
+    prefix_subtrie_->hash_chunks(ret.tries[0]);
+    for (uint32_t i = 0; i < suffix_subtries_.size(); ++i) {
+      if (has_suffix_(i)) {
+        suffix_subtries_[i].trie->hash_chunks(ret.tries[i + 1]);
+      }
+    }
+    ret.digest = utils::delta_digest(ret.tries);
+  }
+
+  // The first section has the digests and the counts, and the prefix trie and
+  // each suffix subtrie have their own, empty if unchanged. Otherwise, a
+  // section begins with whether the trie is kept or emptied.
+  void write_delta(DeltaBase& base, std::ostream& os) const {
+    DeltaBase now;
+    delta_base(now);
+    base.tries.resize(now.tries.size()); // slots are never removed
+    auto num_sections = static_cast<uint32_t>(now.tries.size() + 1);
+    utils::write_file(os, file_type_(FileKind::MLT_DELTA), num_sections,
+                      [&](uint32_t i, std::ostream& sos) {
+      if (i == 0) {
+        utils::write_value(base.digest, sos);
+        utils::write_value(now.digest, sos);
+        utils::write_value(static_cast<uint64_t>(suffix_subtries_.size()), sos);
+        utils::write_value(static_cast<uint64_t>(num_keys_), sos);
+        utils::write_value(shared_tail_, sos);
+        return;
+      }
+      if (base.tries[i - 1] == now.tries[i - 1]) {
+        return;
+      }
+      if (i == 1) {
+        utils::write_value(true, sos);
+        prefix_subtrie_->write_delta(base.tries[0], now.tries[0], sos);
+      } else if (has_suffix_(i - 2)) {
+        utils::write_value(true, sos);
+        suffix_subtries_[i - 2].trie->write_delta(base.tries[i - 1], now.tries[i - 1], sos);
       } else {
-        utils::write_value(false, os);
+        utils::write_value(false, sos);
+      }
+    });
+    base = std::move(now);
+  }
+
+  bool read_delta(std::istream& is, DeltaBase& base) {
+    load_suffixes();
+    FileImage image;
+    uint64_t base_digest = 0, digest = 0, num_suffixes = 0, num_keys = 0;
+    bool shared_tail = false;
+    auto is_read = utils::read_file(is, file_type_(FileKind::MLT_DELTA), image)
+                   && !image.sections.empty()
+                   && utils::parse_bytes(image.sections[0], [&](std::istream& sis) {
+                        utils::read_value(base_digest, sis);
+                        utils::read_value(digest, sis);
+                        utils::read_value(num_suffixes, sis);
+                        utils::read_value(num_keys, sis);
+                        utils::read_value(shared_tail, sis);
+                      })
+                   && base_digest == base.digest && suffix_subtries_.size() <= num_suffixes
+                   && image.sections.size() == num_suffixes + 2;
+    if (is_read) {
+      while (suffix_subtries_.size() < num_suffixes) {
+        suffix_subtries_.emplace_back(&pool_);
+      }
+      base.tries.resize(num_suffixes + 1);
+      for (uint32_t i = 0; is_read && i < num_suffixes + 1; ++i) {
+        if (!image.sections[i + 1].empty()) {
+          is_read = read_trie_delta_(i, image.sections[i + 1], base.tries[i]);
+        }
+      }
+      num_keys_ = static_cast<size_t>(num_keys);
+      shared_tail_ = shared_tail;
+      suffix_head_ = NOT_FOUND; // remade as by the readers
+      for (auto i = static_cast<uint32_t>(num_suffixes); i > 0; --i) {
+        if (!has_suffix_(i - 1)) {
+          free_suffix_id_(i - 1);
+        }
+      }
+      base.digest = utils::delta_digest(base.tries);
+      is_read = is_read && base.digest == digest;
+    }
+    if (!is_read) {
+      is.setstate(std::ios::failbit);
+    }
+    return is_read;
+  }
+
+  // reads the suffix subtries left in the file by a lazy reader, which then
+  // no longer uses the stream
+  void load_suffixes() const {
+    if (source_ == nullptr) {
+      return;
+    }
+    for (uint32_t i = 0; i < suffix_subtries_.size(); ++i) {
+      if (!suffix_subtries_[i].trie) {
+        load_suffix_(i);
       }
     }
-    utils::write_value(suffix_head_, os);
-    utils::write_value(num_keys_, os);
+    source_ = nullptr;
+    sections_.clear();
   }
 
   DictionaryMLT(const DictionaryMLT&) = delete;
   DictionaryMLT& operator=(const DictionaryMLT&) = delete;
 
 private:
+  static constexpr size_t MIN_FILTER_KEYS = 64;
+
+  // shared by all the subtries, so it has to be destroyed last, and also
+  // drawn from by lazy loads
+  mutable PoolResource pool_;
+  // of the subtries made by each thread of the concurrent reader, which would
+  // otherwise contend for pool_
+  std::vector<std::unique_ptr<PoolResource>> reader_pools_{};
   std::unique_ptr<PrefixTrieType> prefix_subtrie_{};
-  std::vector<std::unique_ptr<SuffixTrieType>> suffix_subtries_{};
-  uint32_t suffix_head_ = NOT_FOUND; // empty head in suffix_subtries_
+  // An empty slot keeps its emptied trie for reuse and links the next empty
+  // slot, so that ids are allocated and freed in constant time.
+  struct SuffixSlot {
+    explicit SuffixSlot(MemoryResource* resource) : filter(resource) {}
+
+    mutable std::unique_ptr<SuffixTrieType> trie; // loaded on first access if lazy
+    BloomFilter filter;
+    uint32_t next_emp = NOT_FOUND;
+  };
+
+  struct PrefixNode { // for merge_subtries
+    size_t num_nodes = 0; // in the subtries below, if merged
+    bool is_kept = false;
+  };
+
+  std::vector<SuffixSlot> suffix_subtries_{};
+  uint32_t suffix_head_ = NOT_FOUND; // head of the empty slots in suffix_subtries_
   size_t num_keys_ = 0;
+  bool shared_tail_ = false;
+  size_t split_threshold_ = 0;
+  size_t filter_bits_ = 0;
+  Layout layout_ = Layout::DFS;
+  bool edge_compression_ = false;
+  mutable std::istream* source_ = nullptr; // kept by a lazy reader
+  std::streampos source_pos_ = 0; // of the file in source_
+  mutable std::vector<FileSection> sections_; // of the file in source_
+  bool is_compressed_file_ = false; // if the file is by write_compressed()
+
+  static uint32_t file_type_(FileKind kind = FileKind::MLT) {
+    return utils::file_type(kind, WithBLM, WithNLM, Wide, VTraits::BYTES);
+  }
 
-  uint32_t new_suffix_id_() {
-    if (suffix_head_ == NOT_FOUND) {
-      auto suffix_id = static_cast<uint32_t>(suffix_subtries_.size());
-      suffix_subtries_.push_back(make_unique<SuffixTrieType>());
-      return suffix_id;
+  void write_section_(uint32_t i, std::ostream& os, bool compressed = false) const {
+    if (i == 0) {
+      if (compressed) {
+        prefix_subtrie_->write_compressed(os);
+      } else {
+        prefix_subtrie_->write(os);
+      }
+      utils::write_value(static_cast<uint64_t>(suffix_subtries_.size()), os);
+      utils::write_value(static_cast<uint64_t>(num_keys_), os);
+      utils::write_value(shared_tail_, os);
+    } else if (has_suffix_(i - 1)) {
+      if (compressed) {
+        suffix_subtries_[i - 1].trie->write_compressed(os);
+      } else {
+        suffix_subtries_[i - 1].trie->write(os);
+      }
     }
+  }
 
-    auto suffix_id = suffix_head_;
-    suffix_subtries_[suffix_id] = make_unique<SuffixTrieType>();
+  size_t section_size_(uint32_t i) const { // as written by write_section_()
+    if (i == 0) {
+      return prefix_subtrie_->size_in_bytes() + sizeof(uint64_t) * 2 + sizeof(shared_tail_);
+    }
+    return has_suffix_(i - 1) ? suffix_subtries_[i - 1].trie->size_in_bytes() : 0;
+  }
+
+  // reads a trie in a section of the file in sections_
+  template<class Trie>
+  std::unique_ptr<Trie> read_trie_(std::istream& is, MemoryResource* resource) const {
+    if (!is_compressed_file_) {
+      return make_unique<Trie>(is, resource);
+    }
+    auto trie = make_unique<Trie>(resource);
+    trie->read_compressed(is);
+    return trie;
+  }
+
+  bool has_suffix_(size_t id) const {
+    return suffix_subtries_[id].trie && !suffix_subtries_[id].trie->is_empty();
+  }
+
+  // for a linked slot, which a lazy reader may not have loaded yet
+  SuffixTrieType& suffix_(uint32_t id) const {
+    auto& slot = suffix_subtries_[id];
+    if (!slot.trie) {
+      load_suffix_(id);
+    }
+    return *slot.trie;
+  }
+
+  void load_suffix_(uint32_t id) const {
+    assert(source_ != nullptr);
+    if (sections_[id + 1].size == 0) { // an empty slot
+      return;
+    }
+    source_->seekg(source_pos_ + static_cast<std::streamoff>(sections_[id + 1].offset));
+    if (!read_suffix_(id, *source_)) {
+      source_->setstate(std::ios::failbit);
+      throw std::ios_base::failure("ddd: broken suffix subtrie in a lazily read file");
+    }
+  }
+
+  // applies the delta of the prefix trie for 0 or of the suffix subtrie of
+  // id - 1, making hashes of the result
+  bool read_trie_delta_(uint32_t id, const std::string& bytes, TrieHashes& hashes) {
+    return utils::parse_bytes(bytes, [&](std::istream& sis) {
+      bool is_kept = false;
+      utils::read_value(is_kept, sis);
+      if (id == 0) {
+        prefix_subtrie_->read_delta(sis);
+        prefix_subtrie_->hash_chunks(hashes);
+        return;
+      }
+      auto& slot = suffix_subtries_[id - 1];
+      hashes = TrieHashes{};
+      if (!is_kept) {
+        slot.trie.reset();
+        return;
+      }
+      if (!slot.trie) {
+        slot.trie = make_unique<SuffixTrieType>(&pool_);
+        slot.trie->set_edge_compression(edge_compression_);
+      }
+      slot.trie->read_delta(sis);
+      slot.trie->hash_chunks(hashes);
+      if (filter_bits_ != 0) {
+        make_filter_(id - 1);
+      }
+    });
+  }
+
+  // reads the table and the first section, making the slots
+  bool read_head_(std::istream& is) {
+    auto type = utils::read_file_table(is, sections_);
+    is_compressed_file_ = type == file_type_(FileKind::MLT_COMPRESSED);
+    if ((type != file_type_() && !is_compressed_file_) || sections_.empty()) {
+      return false;
+    }
+    uint64_t num_suffixes = 0;
+    auto is_read = utils::read_section(is, sections_[0], [&](std::istream& sis) {
+      prefix_subtrie_ = read_trie_<PrefixTrieType>(sis, &pool_);
+      uint64_t num_keys = 0;
+      utils::read_value(num_suffixes, sis);
+      utils::read_value(num_keys, sis);
+      utils::read_value(shared_tail_, sis);
+      num_keys_ = static_cast<size_t>(num_keys);
+    });
+    if (!is_read || sections_.size() != num_suffixes + 1) {
+      return false;
+    }
+
+    suffix_subtries_.reserve(num_suffixes);
+    for (uint64_t i = 0; i < num_suffixes; ++i) {
+      suffix_subtries_.emplace_back(&pool_);
+    }
+    for (auto i = static_cast<uint32_t>(num_suffixes); i > 0; --i) {
+      if (sections_[i].size == 0) {
+        free_suffix_id_(i - 1);
+      }
+    }
+    return true;
+  }
+
+  // reads the section of the suffix subtrie of id from is, which is at the
+  // section, leaving no subtrie if broken
+  bool read_suffix_(uint32_t id, std::istream& is) const {
+    auto& section = sections_[id + 1];
+    if (section.size == 0) {
+      return true;
+    }
+    auto& slot = suffix_subtries_[id];
+    auto is_read = utils::read_section(is, section, [&](std::istream& sis) {
+      slot.trie = read_trie_<SuffixTrieType>(sis, &pool_);
+    });
+    if (!is_read) {
+      slot.trie.reset();
+    }
+    return is_read;
+  }
+
+  // reads the suffix subtries by read, the largest ones first for balance
+  template<class Reader>
+  bool read_suffixes_(const Reader& read, uint32_t num_threads) {
+    std::vector<uint32_t> ids;
+    for (uint32_t i = 0; i < suffix_subtries_.size(); ++i) {
+      if (sections_[i + 1].size != 0) {
+        ids.push_back(i);
+      }
+    }
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) {
+      return sections_[a + 1].size > sections_[b + 1].size;
+    });
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> is_read{true};
+    auto base = static_cast<uint64_t>(static_cast<std::streamoff>(source_pos_));
+    auto func = [&](MemoryResource* resource) {
+      std::vector<char> bytes;
+      for (auto i = next++; i < ids.size() && is_read; i = next++) {
+        auto& slot = suffix_subtries_[ids[i]];
+        const auto& section = sections_[ids[i] + 1];
+        bytes.resize(static_cast<size_t>(section.size));
+        if (!read(base + section.offset, bytes) ||
+            !utils::parse_section(bytes.data(), section, [&](std::istream& sis) {
+              slot.trie = read_trie_<SuffixTrieType>(sis, resource);
+            })) {
+          is_read = false;
+        }
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.resize(std::min<size_t>(num_threads, ids.size()));
+    for (auto& th : threads) {
+      reader_pools_.push_back(make_unique<PoolResource>());
+      th = std::thread(func, reader_pools_.back().get());
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+    return is_read;
+  }
 
-    for (auto i = suffix_head_ + 1; i < suffix_subtries_.size(); ++i) {
-      if (!suffix_subtries_[i]) {
-        suffix_head_ = i;
-        break;
+  // reads a file written before the container, of the tries in the layout
+  // of DaTrie::read_legacy() and the counts, where the list of empty slots is
+  // remade and the suffixes are not shared
+  void read_raw_(std::istream& is) {
+    auto max_bytes = utils::rest_size(is);
+    prefix_subtrie_->read_legacy(is, max_bytes);
+    uint64_t num_suffixes = 0;
+    utils::read_value(num_suffixes, is);
+    if (max_bytes < num_suffixes) { // a byte each at least
+      is.setstate(std::ios::failbit);
+    }
+    for (uint64_t i = 0; is && i < num_suffixes; ++i) {
+      suffix_subtries_.emplace_back(&pool_);
+      bool has_trie{};
+      utils::read_value(has_trie, is);
+      if (has_trie) {
+        suffix_subtries_[i].trie = make_unique<SuffixTrieType>(&pool_);
+        suffix_subtries_[i].trie->read_legacy(is, max_bytes);
       }
     }
-    if (suffix_head_ == suffix_id) {
-      suffix_head_ = NOT_FOUND;
+    uint32_t suffix_head = NOT_FOUND;
+    uint64_t num_keys = 0;
+    utils::read_value(suffix_head, is);
+    utils::read_value(num_keys, is);
+    if (!is) {
+      clear_();
+      is.setstate(std::ios::failbit);
+      return;
+    }
+    for (auto i = static_cast<uint32_t>(num_suffixes); i > 0; --i) {
+      if (!suffix_subtries_[i - 1].trie) {
+        free_suffix_id_(i - 1);
+      }
     }
+    num_keys_ = static_cast<size_t>(num_keys);
+  }
+
+  void clear_() {
+    prefix_subtrie_ = make_unique<PrefixTrieType>(&pool_);
+    suffix_subtries_.clear();
+    suffix_head_ = NOT_FOUND;
+    num_keys_ = 0;
+    shared_tail_ = false;
+    sections_.clear();
+  }
+
+  uint32_t new_suffix_id_() {
+    auto suffix_id = suffix_head_;
+    if (suffix_id == NOT_FOUND) {
+      suffix_id = static_cast<uint32_t>(suffix_subtries_.size());
+      suffix_subtries_.emplace_back(&pool_);
+    } else {
+      suffix_head_ = suffix_subtries_[suffix_id].next_emp;
+    }
+
+    auto& slot = suffix_subtries_[suffix_id];
+    if (!slot.trie) { // not made yet or read as empty
+      slot.trie = make_unique<SuffixTrieType>(&pool_);
+    }
+    slot.trie->set_shared_tail(shared_tail_);
+    slot.trie->set_edge_compression(edge_compression_);
+    if (filter_bits_ != 0) {
+      slot.filter.init(MIN_FILTER_KEYS, filter_bits_);
+    }
+    slot.next_emp = NOT_FOUND;
     return suffix_id;
   }
+
+  void free_suffix_id_(uint32_t suffix_id) { // the emptied trie is kept for reuse
+    suffix_subtries_[suffix_id].filter.clear();
+    suffix_subtries_[suffix_id].next_emp = suffix_head_;
+    suffix_head_ = suffix_id;
+  }
+
+  void make_filter_(uint32_t suffix_id) { // with room for half as many keys again
+    auto& slot = suffix_subtries_[suffix_id];
+    std::vector<KvPair> kvs;
+    slot.trie->enumerate(ROOT_POS, std::string{}, kvs);
+    slot.filter.init(kvs.size() + kvs.size() / 2 + MIN_FILTER_KEYS, filter_bits_);
+    for (auto& kv : kvs) {
+      slot.filter.add(utils::hash(kv.key.c_str()));
+    }
+  }
+
+  // registers the longest common prefix of the keys of the subtrie at once,
+  // so that keys sharing a long prefix are moved once rather than once per
+  // character, and then splits the new subtries still beyond the threshold
+  void split_suffix_(uint32_t suffix_id, const std::string& prefix) {
+    std::vector<KvPair> kvs;
+    {
+      SuffixTrieType trie(&pool_);
+      trie.swap(*suffix_subtries_[suffix_id].trie);
+      trie.enumerate(ROOT_POS, prefix, kvs);
+    }
+    free_suffix_id_(suffix_id);
+
+    auto& first_key = kvs.front().key;
+    auto split_len = first_key.size();
+    for (auto& kv : kvs) {
+      size_t len = 0;
+      while (len < split_len && first_key[len] == kv.key[len]) {
+        ++len;
+      }
+      split_len = len;
+    }
+    auto split_prefix = first_key.substr(0, split_len);
+
+    Query query(prefix.c_str());
+    prefix_subtrie_->search_prefix(query);
+    assert(query.value() == suffix_id);
+    prefix_subtrie_->delete_prefix_leaf(query);
+    prefix_subtrie_->register_prefix(split_prefix.c_str());
+
+    num_keys_ -= kvs.size();
+    auto split_threshold = split_threshold_;
+    split_threshold_ = 0; // not to split while moving
+    for (auto& kv : kvs) {
+      insert_key(kv.key.c_str(), kv.value);
+    }
+    split_threshold_ = split_threshold;
+
+    bool is_checked[256] = {};
+    for (auto& kv : kvs) { // the subtrie of each next character
+      auto label = static_cast<uint8_t>(kv.key.c_str()[split_len]);
+      if (label == '\0' || is_checked[label]) {
+        continue;
+      }
+      is_checked[label] = true;
+      Query child_query(kv.key.c_str());
+      prefix_subtrie_->search_prefix(child_query);
+      assert(!child_query.is_finished());
+      auto child_id = static_cast<uint32_t>(child_query.value());
+      if (split_threshold_ < suffix_(child_id).num_nodes()) {
+        split_suffix_(child_id, std::string(kv.key.c_str(), child_query.key()));
+      }
+    }
+  }
+
 };
 
 } // namespace -- ddd
@@ -5,39 +5,59 @@
 
 namespace ddd {
 
-template<bool WithBLM, bool WithNLM>
-class DictionarySGL : public Dictionary {
+template<bool WithBLM, bool WithNLM, bool Wide = false, class Value = uint32_t>
+class DictionarySGL : public BasicDictionary<typename ValueTraits<Value>::Type> {
 public:
-  using TrieType = DaTrie<WithBLM, WithNLM, false>;
+  using TrieType = DaTrie<WithBLM, WithNLM, false, Wide, Value>;
+  using Query = typename TrieType::Query;
+  using VTraits = typename TrieType::VTraits;
+  using ValueType = typename TrieType::ValueType;
+  using KvPair = typename TrieType::KvPair;
+  using FrozenType = typename TrieType::FrozenType;
 
   std::string name() const {
     return "DictionarySGL";
   }
 
-  DictionarySGL() {
-    trie_ = make_unique<TrieType>();
+  explicit DictionarySGL(MemoryResource* resource = new_delete_resource()) {
+    trie_ = make_unique<TrieType>(resource);
   }
 
-  DictionarySGL(std::istream& is) {
-    trie_ = make_unique<TrieType>(is);
-    utils::read_value(num_keys_, is);
+  // reads a file by write() or write_compressed(), setting the failbit of is
+  // for a file of another dictionary or a broken one and leaving it empty
+  DictionarySGL(std::istream& is, MemoryResource* resource = new_delete_resource()) {
+    if (utils::is_raw_file(is)) {
+      read_raw_(is, resource);
+      return;
+    }
+    std::vector<FileSection> sections;
+    auto type = utils::read_file_table(is, sections);
+    auto is_compressed = type == file_type_(FileKind::SGL_COMPRESSED);
+    if ((type != file_type_() && !is_compressed) || sections.size() != 1
+        || !utils::read_section(is, sections[0], [&](std::istream& sis) {
+             read_(sis, resource, is_compressed);
+           })) {
+      trie_ = make_unique<TrieType>(resource);
+      num_keys_ = 0;
+      is.setstate(std::ios::failbit);
+    }
   }
 
   ~DictionarySGL() {}
 
-  uint32_t search_key(const char* key) const {
+  ValueType search_key(const char* key) const {
     Query agent(key);
-    if (!trie_->search_key(agent)) {
-      return NOT_FOUND;
+    if (trie_->is_empty() || !trie_->search_key(agent)) {
+      return VTraits::NOT_FOUND;
     }
     return agent.value();
   }
 
-  bool insert_key(const char* key, uint32_t value) {
-    assert((value >> 31) == 0);
+  bool insert_key(const char* key, ValueType value) { // value is ignored for sets
+    assert(!VTraits::HAS_VALUE || (value >> VTraits::BITS) == 0);
 
     Query query(key);
-    query.set_value(value);
+    query.set_value(VTraits::HAS_VALUE ? value : 0);
     if (!trie_->insert_key(query)) {
       return false;
     }
@@ -45,10 +65,10 @@ public:
     return true;
   }
 
-  uint32_t delete_key(const char* key) {
+  ValueType delete_key(const char* key) {
     Query query(key);
-    if (!trie_->delete_key(query)) {
-      return NOT_FOUND;
+    if (trie_->is_empty() || !trie_->delete_key(query)) {
+      return VTraits::NOT_FOUND;
     }
     --num_keys_;
     return query.value();
@@ -76,6 +96,26 @@ public:
     trie_->shrink();
   }
 
+  void set_shared_tail(bool shared) {
+    trie_->set_shared_tail(shared);
+  }
+
+  void set_profiling(uint32_t period) {
+    trie_->set_profiling(period);
+  }
+
+  void set_layout(Layout layout) {
+    trie_->set_layout(layout);
+  }
+
+  void set_edge_compression(bool enabled) {
+    trie_->set_edge_compression(enabled);
+  }
+
+  void set_jump_table(bool enabled) { // not written
+    trie_->set_jump_table(enabled);
+  }
+
   void stat(Stat& ret) const {
     ret.num_keys = num_keys_;
     ret.num_tries = 1;
@@ -86,16 +126,101 @@ public:
     ret.tail_size = trie_->tail_size();
     ret.tail_capa = trie_->tail_capa();
     ret.tail_emps = trie_->tail_emps();
-    ret.size_in_bytes = trie_->size_in_bytes() + sizeof(num_keys_);
+    ret.tail_holes = trie_->tail_holes();
+    ret.tail_saved = trie_->tail_saved();
+    ret.label_size = trie_->label_size();
+    ret.filter_size = 0;
+    ret.hole_size = trie_->hole_size();
+    ret.size_in_bytes = trie_->size_in_bytes() + sizeof(uint64_t) + utils::file_overhead(1);
   }
 
   double ratio_singles() const { // not in constant time
     return static_cast<double>(trie_->num_singles()) / trie_->num_nodes();
   }
 
-  void write(std::ostream& os) const {
-    trie_->write(os);
-    utils::write_value(num_keys_, os);
+  void leaf_stat(LeafStat& ret) const { // not in constant time
+    ret = LeafStat{};
+    trie_->leaf_stat(ret);
+  }
+
+  // makes frozen a read-only copy of the trie as DaTrie::freeze()
+  void freeze(FrozenType& frozen) const {
+    trie_->freeze(frozen);
+  }
+
+  void trace_key(const char* key, AccessTrace& trace) const {
+    Query query(key);
+    trie_->trace_key(query, trace);
+  }
+
+  void write(std::ostream& os) const { // in one section
+    utils::write_file(os, file_type_(), 1, [&](uint32_t, std::ostream& sos) {
+      write_section_(sos);
+    });
+  }
+
+  void snapshot(FileImage& ret) const {
+    utils::capture_file(file_type_(), 1, [&](uint32_t) {
+      return trie_->size_in_bytes() + sizeof(uint64_t);
+    }, [&](uint32_t, std::ostream& sos) {
+      write_section_(sos);
+    }, ret);
+  }
+
+  void write_compressed(std::ostream& os) const {
+    utils::write_file(os, file_type_(FileKind::SGL_COMPRESSED), 1,
+                      [&](uint32_t, std::ostream& sos) {
+      trie_->write_compressed(sos);
+      utils::write_value(static_cast<uint64_t>(num_keys_), sos);
+    });
+  }
+
+  void delta_base(DeltaBase& ret) const {
+    ret.tries.resize(1);
+    trie_->hash_chunks(ret.tries[0]);
+    ret.digest = utils::delta_digest(ret.tries);
+  }
+
+  // in two sections, of the digests and of the trie
+  void write_delta(DeltaBase& base, std::ostream& os) const {
+    DeltaBase now;
+    delta_base(now);
+    base.tries.resize(1);
+    utils::write_file(os, file_type_(FileKind::SGL_DELTA), 2, [&](uint32_t i, std::ostream& sos) {
+      if (i == 0) {
+        utils::write_value(base.digest, sos);
+        utils::write_value(now.digest, sos);
+        utils::write_value(static_cast<uint64_t>(num_keys_), sos);
+      } else {
+        trie_->write_delta(base.tries[0], now.tries[0], sos);
+      }
+    });
+    base = std::move(now);
+  }
+
+  bool read_delta(std::istream& is, DeltaBase& base) {
+    FileImage image;
+    uint64_t base_digest = 0, digest = 0, num_keys = 0;
+    auto is_read = utils::read_file(is, file_type_(FileKind::SGL_DELTA), image)
+                   && image.sections.size() == 2
+                   && utils::parse_bytes(image.sections[0], [&](std::istream& sis) {
+                        utils::read_value(base_digest, sis);
+                        utils::read_value(digest, sis);
+                        utils::read_value(num_keys, sis);
+                      })
+                   && base_digest == base.digest;
+    if (is_read) {
+      is_read = utils::parse_bytes(image.sections[1], [&](std::istream& sis) {
+        trie_->read_delta(sis);
+      });
+      num_keys_ = static_cast<size_t>(num_keys);
+      delta_base(base);
+      is_read = is_read && base.digest == digest;
+    }
+    if (!is_read) {
+      is.setstate(std::ios::failbit);
+    }
+    return is_read;
   }
 
   DictionarySGL(const DictionarySGL&) = delete;
@@ -104,6 +229,40 @@ public:
 private:
   std::unique_ptr<TrieType> trie_;
   size_t num_keys_ = 0;
+
+  void write_section_(std::ostream& os) const {
+    trie_->write(os);
+    utils::write_value(static_cast<uint64_t>(num_keys_), os);
+  }
+
+  static uint32_t file_type_(FileKind kind = FileKind::SGL) {
+    return utils::file_type(kind, WithBLM, WithNLM, Wide, VTraits::BYTES);
+  }
+
+  void read_(std::istream& is, MemoryResource* resource, bool is_compressed = false) {
+    if (is_compressed) {
+      trie_ = make_unique<TrieType>(resource);
+      trie_->read_compressed(is);
+    } else {
+      trie_ = make_unique<TrieType>(is, resource);
+    }
+    uint64_t num_keys = 0;
+    utils::read_value(num_keys, is);
+    num_keys_ = static_cast<size_t>(num_keys);
+  }
+
+  void read_raw_(std::istream& is, MemoryResource* resource) { // written before the container
+    auto max_bytes = utils::rest_size(is);
+    trie_ = make_unique<TrieType>(resource);
+    trie_->read_legacy(is, max_bytes);
+    uint64_t num_keys = 0;
+    utils::read_value(num_keys, is);
+    num_keys_ = static_cast<size_t>(num_keys);
+    if (!is) {
+      trie_ = make_unique<TrieType>(resource);
+      num_keys_ = 0;
+    }
+  }
 };
 
 } // namespace -- ddd
@@ -0,0 +1,415 @@
+#ifndef DDD_FILE_FORMAT_HPP
+#define DDD_FILE_FORMAT_HPP
+
+#include <array>
+#include <streambuf>
+
+#include "Basic.hpp"
+
+namespace ddd {
+
+// The container of written dictionaries: a FileHeader, a table of
+// num_sections FileSections and its CRC, and then the sections in order.
+// Offsets are from the beginning of the header, and lengths are 64-bit. The
+// sections are in the byte order of the writer, which the magic tells.
+constexpr uint32_t FILE_MAGIC = 0x46444444; // "DDDF" in little endian
+constexpr uint32_t FILE_VERSION = 1;
+
+enum class FileKind : uint32_t {
+  SGL = 1,
+  MLT = 2,
+  SGL_DELTA = 3,
+  MLT_DELTA = 4,
+  SGL_COMPRESSED = 5, // by write_compressed()
+  MLT_COMPRESSED = 6,
+  SGL_SHARED = 7, // a frozen trie in shared memory
+};
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t type; // by utils::file_type()
+  uint32_t num_sections;
+};
+
+struct FileSection {
+  uint64_t offset;
+  uint64_t size; // 0 for none
+  uint32_t crc; // CRC-32 of the bytes
+  uint32_t reserved;
+};
+
+// The sections of a file copied in memory, so that the file can be written
+// later by utils::write_image() while the dictionary changes
+struct FileImage {
+  uint32_t type = 0;
+  std::vector<std::string> sections;
+};
+
+// The hashes of the tries of a dictionary as last written, in full or by a
+// delta, against which the next delta is written. The digest of the hashes
+// tells the state, so that a delta is applied only to the state it is from.
+struct DeltaBase {
+  std::vector<TrieHashes> tries; // empty hashes for no trie
+  uint64_t digest = 0;
+};
+
+static_assert(sizeof(FileHeader) == 16 && sizeof(FileSection) == 24, "no padding");
+
+namespace utils {
+
+inline uint32_t crc32(const char* data, size_t size, uint32_t crc = 0) { // IEEE 802.3
+  // by slicing-by-8, where tables[k][b] is the CRC of b followed by k zero bytes
+  static const auto tables = []() {
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t i = 0; i < 256; ++i) {
+      auto c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) != 0 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+      }
+      tables[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (size_t k = 1; k < 8; ++k) {
+        tables[k][i] = tables[0][tables[k - 1][i] & 0xFF] ^ (tables[k - 1][i] >> 8);
+      }
+    }
+    return tables;
+  }();
+
+  crc = ~crc;
+  for (; 8 <= size; data += 8, size -= 8) { // in little endian
+    uint32_t lo = 0, hi = 0;
+    std::memcpy(&lo, data, 4);
+    std::memcpy(&hi, data + 4, 4);
+    lo ^= crc;
+    crc = tables[7][lo & 0xFF] ^ tables[6][(lo >> 8) & 0xFF] ^ tables[5][(lo >> 16) & 0xFF]
+          ^ tables[4][lo >> 24] ^ tables[3][hi & 0xFF] ^ tables[2][(hi >> 8) & 0xFF]
+          ^ tables[1][(hi >> 16) & 0xFF] ^ tables[0][hi >> 24];
+  }
+  for (; size != 0; ++data, --size) {
+    crc = tables[0][(crc ^ static_cast<uint8_t>(*data)) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+// tells the dictionary class, since the sections depend on the parameters
+inline uint32_t file_type(FileKind kind, bool with_blm, bool with_nlm, bool wide,
+                          uint32_t value_bytes) {
+  return static_cast<uint32_t>(kind) | uint32_t{with_blm} << 8 | uint32_t{with_nlm} << 9
+         | uint32_t{wide} << 10 | value_bytes << 12;
+}
+
+inline uint64_t delta_digest(const std::vector<TrieHashes>& tries) {
+  uint64_t ret = tries.size();
+  for (auto& trie : tries) {
+    for (auto& hashes : trie.arrays) {
+      ret = hash_bytes(reinterpret_cast<const char*>(hashes.data()),
+                       sizeof(uint64_t) * hashes.size(), ret);
+    }
+    ret = hash_bytes(reinterpret_cast<const char*>(&trie.rest), sizeof(trie.rest), ret);
+  }
+  return ret;
+}
+
+inline size_t file_overhead(uint32_t num_sections) { // in bytes besides the sections
+  return sizeof(FileHeader) + sizeof(FileSection) * num_sections + sizeof(uint32_t);
+}
+
+// An output buffer passing the bytes on to sink, counting them and their CRC
+class CrcOutputBuf : public std::streambuf {
+public:
+  explicit CrcOutputBuf(std::streambuf* sink) : sink_{sink} {}
+
+  uint64_t size() const { return size_; }
+  uint32_t crc() const { return crc_; }
+
+protected:
+  int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      auto c = traits_type::to_char_type(ch);
+      if (xsputn(&c, 1) != 1) {
+        return traits_type::eof();
+      }
+    }
+    return traits_type::not_eof(ch);
+  }
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    auto num_put = sink_->sputn(s, n);
+    crc_ = crc32(s, static_cast<size_t>(num_put), crc_);
+    size_ += static_cast<uint64_t>(num_put);
+    return num_put;
+  }
+
+private:
+  std::streambuf* sink_ = nullptr;
+  uint64_t size_ = 0;
+  uint32_t crc_ = 0;
+};
+
+// An output buffer appending the bytes to a string, or only counting them
+// for a null one
+class StringOutputBuf : public std::streambuf {
+public:
+  explicit StringOutputBuf(std::string* str) : str_{str} {}
+
+  uint64_t size() const { return size_; }
+
+protected:
+  int_type overflow(int_type ch) override {
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+      auto c = traits_type::to_char_type(ch);
+      xsputn(&c, 1);
+    }
+    return traits_type::not_eof(ch);
+  }
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    if (str_ != nullptr) {
+      str_->append(s, static_cast<size_t>(n));
+    }
+    size_ += static_cast<uint64_t>(n);
+    return n;
+  }
+
+private:
+  std::string* str_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+// An input buffer over bytes in memory
+class SpanInputBuf : public std::streambuf {
+public:
+  SpanInputBuf(const char* bytes, size_t size) {
+    auto begin = const_cast<char*>(bytes); // never written
+    setg(begin, begin, begin + size);
+  }
+};
+
+// An output buffer over bytes in memory, failing past them
+class SpanOutputBuf : public std::streambuf {
+public:
+  SpanOutputBuf(char* bytes, size_t size) {
+    setp(bytes, bytes + size);
+  }
+};
+
+// writes the header and the table of a container, where offsets are filled
+// in from the section sizes
+inline void write_file_table(std::ostream& os, uint32_t type, std::vector<FileSection>& table) {
+  auto num_sections = static_cast<uint32_t>(table.size());
+  uint64_t offset = file_overhead(num_sections);
+  for (auto& section : table) {
+    section.offset = offset;
+    offset += section.size;
+  }
+
+  const FileHeader header{FILE_MAGIC, FILE_VERSION, type, num_sections};
+  auto table_crc = crc32(reinterpret_cast<const char*>(&header), sizeof(header));
+  table_crc = crc32(reinterpret_cast<const char*>(table.data()),
+                    sizeof(FileSection) * num_sections, table_crc);
+  write_value(header, os);
+  os.write(reinterpret_cast<const char*>(table.data()), sizeof(FileSection) * num_sections);
+  write_value(table_crc, os);
+}
+
+// copies the sections written by write_section(i, os) as write_file() into
+// ret, reserving the section_size(i) bytes of each so that it is written once
+template<class S, class F>
+inline void capture_file(uint32_t type, uint32_t num_sections, S section_size, F write_section,
+                         FileImage& ret) {
+  ret.type = type;
+  ret.sections.resize(num_sections);
+  for (uint32_t i = 0; i < num_sections; ++i) {
+    auto& section = ret.sections[i];
+    section.clear();
+    section.reserve(static_cast<size_t>(section_size(i)));
+    StringOutputBuf buf(&section);
+    std::ostream sos(&buf);
+    write_section(i, sos);
+    assert(section.size() == section_size(i));
+  }
+}
+
+// copies the sections as capture_file() for sections whose sizes are not
+// known before they are made
+template<class F>
+inline void capture_file_once(uint32_t type, uint32_t num_sections, F write_section,
+                              FileImage& ret) {
+  ret.type = type;
+  ret.sections.resize(num_sections);
+  for (uint32_t i = 0; i < num_sections; ++i) {
+    ret.sections[i].clear();
+    StringOutputBuf buf(&ret.sections[i]);
+    std::ostream sos(&buf);
+    write_section(i, sos);
+  }
+}
+
+// writes the file of the image as write_file()
+inline void write_image(std::ostream& os, const FileImage& image) {
+  std::vector<FileSection> table(image.sections.size());
+  for (size_t i = 0; i < table.size(); ++i) {
+    table[i].size = image.sections[i].size();
+    table[i].crc = crc32(image.sections[i].data(), image.sections[i].size());
+  }
+  write_file_table(os, image.type, table);
+  for (auto& section : image.sections) {
+    os.write(section.data(), static_cast<std::streamsize>(section.size()));
+  }
+}
+
+// writes the container of num_sections sections, calling write_section(i, os)
+// once for each i. The sections go straight to a seekable os, measured and
+// checksummed on the way, and the table is written over a blank one after
+// them; for another os, they are copied in memory first.
+template<class F>
+inline void write_file(std::ostream& os, uint32_t type, uint32_t num_sections, F write_section) {
+  auto begin = os.tellp();
+  if (begin == std::ostream::pos_type(-1)) {
+    FileImage image;
+    capture_file_once(type, num_sections, write_section, image);
+    write_image(os, image);
+    return;
+  }
+
+  std::vector<FileSection> table(num_sections);
+  write_file_table(os, type, table);
+  for (uint32_t i = 0; os && i < num_sections; ++i) {
+    CrcOutputBuf buf(os.rdbuf());
+    std::ostream cos(&buf);
+    write_section(i, cos);
+    if (!cos) {
+      os.setstate(std::ios::badbit);
+    }
+    table[i].size = buf.size();
+    table[i].crc = buf.crc();
+  }
+
+  auto end = os.tellp();
+  os.seekp(begin);
+  write_file_table(os, type, table);
+  os.seekp(end);
+}
+
+// returns the bytes from the position of is to the end, or 0 if is cannot
+// seek, leaving the position as it is
+inline uint64_t rest_size(std::istream& is) {
+  auto begin = is.tellg();
+  if (begin == std::istream::pos_type(-1)) {
+    return 0;
+  }
+  auto end = is.seekg(0, std::ios::end).tellg();
+  is.seekg(begin);
+  return end == std::istream::pos_type(-1) ? 0 : static_cast<uint64_t>(end - begin);
+}
+
+// tells a file written before the container, which begins with the 64-bit
+// length of BC instead of the magic, by a non-zero multiple of 256 whose
+// elements fit in the file. Other files, as empty or broken ones, ones of the
+// other byte order and ones in streams that cannot seek, are left to
+// read_file_table() to reject.
+inline bool is_raw_file(std::istream& is) {
+  auto size = rest_size(is);
+  if (size < sizeof(uint64_t)) {
+    return false;
+  }
+  auto begin = is.tellg();
+  uint64_t bc_size = 0;
+  read_value(bc_size, is);
+  is.seekg(begin);
+  return bc_size != 0 && bc_size % BLOCK_SIZE == 0
+         && bc_size <= (size - sizeof(uint64_t)) / sizeof(BasicBc<false>); // never wide then
+}
+
+// reads the header and the table of a container, returning its type, or 0
+// for another version or a broken table
+inline uint32_t read_file_table(std::istream& is, std::vector<FileSection>& table) {
+  FileHeader header{};
+  read_value(header, is);
+  if (!is || header.magic != FILE_MAGIC || header.version != FILE_VERSION) {
+    return 0;
+  }
+  table.clear();
+  for (uint32_t i = 0; i < header.num_sections; ++i) { // grown as read, for a broken count
+    FileSection section{};
+    read_value(section, is);
+    if (!is) {
+      return 0;
+    }
+    table.push_back(section);
+  }
+  uint32_t table_crc = 0;
+  read_value(table_crc, is);
+
+  auto crc = crc32(reinterpret_cast<const char*>(&header), sizeof(header));
+  crc = crc32(reinterpret_cast<const char*>(table.data()), sizeof(FileSection) * table.size(), crc);
+  return is && crc == table_crc ? header.type : 0;
+}
+
+// returns false for a container of another type
+inline bool read_file_table(std::istream& is, uint32_t type, std::vector<FileSection>& table) {
+  return read_file_table(is, table) == type;
+}
+
+// parses the bytes by read(is), returning false unless read consumes them all
+template<class F>
+inline bool parse_bytes(const char* bytes, size_t size, F read) {
+  SpanInputBuf buf(bytes, size);
+  std::istream sis(&buf);
+  read(sis);
+  return !sis.fail() && buf.in_avail() == 0;
+}
+
+template<class F>
+inline bool parse_bytes(const std::string& bytes, F read) {
+  return parse_bytes(bytes.data(), bytes.size(), read);
+}
+
+// parses the bytes of a section by read(is) after checking the CRC,
+// returning false for a broken section
+template<class F>
+inline bool parse_section(const char* bytes, const FileSection& section, F read) {
+  if (crc32(bytes, static_cast<size_t>(section.size)) != section.crc) {
+    return false;
+  }
+  return parse_bytes(bytes, static_cast<size_t>(section.size), read);
+}
+
+// reads a whole container of type, or of any type for 0, into ret and checks
+// all the sections, for parsing only sound files
+inline bool read_file(std::istream& is, uint32_t type, FileImage& ret) {
+  std::vector<FileSection> table;
+  auto file_type = read_file_table(is, table);
+  if (file_type == 0 || (type != 0 && file_type != type)) {
+    return false;
+  }
+  ret.type = file_type;
+  ret.sections.resize(table.size());
+  for (size_t i = 0; i < table.size(); ++i) {
+    auto& bytes = ret.sections[i];
+    bytes.resize(static_cast<size_t>(table[i].size));
+    if (!bytes.empty() && !is.read(&bytes[0], static_cast<std::streamsize>(bytes.size()))) {
+      return false;
+    }
+    if (crc32(bytes.data(), bytes.size()) != table[i].crc) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// reads a section from is at the section and parses it as parse_section()
+template<class F>
+inline bool read_section(std::istream& is, const FileSection& section, F read) {
+  std::vector<char> bytes(static_cast<size_t>(section.size));
+  if (!bytes.empty() && !is.read(bytes.data(), static_cast<std::streamsize>(bytes.size()))) {
+    return false;
+  }
+  return parse_section(bytes.data(), section, read);
+}
+
+} // namespace -- utils
+
+} // namespace -- ddd
+
+#endif // DDD_FILE_FORMAT_HPP
@@ -0,0 +1,583 @@
+#ifndef DDD_FROZEN_DA_TRIE_HPP
+#define DDD_FROZEN_DA_TRIE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include "MemoryResource.hpp"
+
+namespace ddd {
+
+template<bool WithBLM, bool WithNLM, bool Prefix, bool Wide, class Value>
+class DaTrie;
+
+// A read-only form of DaTrie made by DaTrie::freeze() and turned back by
+// DaTrie::thaw(). A unit keeps the base (or value) field and the leaf flag
+// in 4 bytes (6 if Wide), followed by the label from the parent in place of
+// the check, and there is no metadata for updates. Since every internal node
+// has its own base, a unit at base ^ label is a child iff its label is label,
+// and empty units and the root get labels no such base maps to. Leaves, TAIL
+// and compressed edges are in the formats of DaTrie, and TAIL is packed in
+// the shared mode for keys.
+template<bool Prefix, bool Wide = false, class Value = uint32_t>
+class FrozenDaTrie {
+public:
+  using Traits = IndexTraits<Wide>;
+  using IndexType = typename Traits::Type;
+  using VTraits = ValueTraits<Value>;
+  using ValueType = typename VTraits::Type;
+  using KvPair = BasicKvPair<ValueType>;
+  using Query = BasicQuery<Wide, Value>;
+
+  explicit FrozenDaTrie(MemoryResource* resource = new_delete_resource())
+    : units_vec_(resource), tail_vec_(resource), label_vec_(resource) {}
+
+  FrozenDaTrie(std::istream& is, MemoryResource* resource = new_delete_resource())
+    : units_vec_(resource), tail_vec_(resource), label_vec_(resource) {
+    utils::read_vector(units_vec_, is);
+    utils::read_vector(tail_vec_, is);
+    utils::read_vector(label_vec_, is);
+    utils::read_value(num_nodes_, is);
+    utils::read_value(shared_tail_, is);
+    view_vecs_();
+  }
+
+  ~FrozenDaTrie() {}
+
+  bool search_key(Query& query) const {
+    assert(query.node_pos() < units_.size());
+    assert(!Prefix);
+
+    while (!units_[query.node_pos()].is_leaf()) {
+      auto base = units_[query.node_pos()].base();
+      if ((base & Traits::LABEL_FLAG) != 0 && !label_pool_.empty()) {
+        auto entry = label_pool_.data() + (base & ~Traits::LABEL_FLAG);
+        auto len = static_cast<uint8_t>(entry[sizeof(IndexType)]);
+        auto labels = entry + sizeof(IndexType) + 1;
+        for (uint32_t i = 0; i < len; ++i) {
+          if (query.label() != static_cast<uint8_t>(labels[i])) {
+            return false;
+          }
+          query.next();
+        }
+        base = Source::extract_index_(entry);
+      }
+      auto child_pos = base ^query.label();
+      if (units_[child_pos].label() != query.label()) {
+        return false;
+      }
+      query.next(child_pos);
+    }
+    auto value = units_[query.node_pos()].value();
+    if (query.is_finished()) {
+      query.set_value(terminal_value_(value));
+      return true;
+    }
+
+    if (Source::is_inline_(value, tail_.size())) {
+      auto code = Source::inline_code_(value);
+      if (!utils::match_inline(query.key(), code)) {
+        return false;
+      }
+      query.set_value(utils::inline_value(code));
+      return true;
+    }
+
+    uint32_t len = 0;
+    auto tail = tail_suffix_(value);
+    if (!utils::match(query.key(), tail, len)) {
+      return false;
+    }
+    query.set_value(tail_value_(value, tail + len));
+    return true;
+  }
+
+  // for prefix trie
+  bool search_prefix(Query& query) const {
+    assert(query.node_pos() < units_.size());
+    assert(Prefix);
+
+    while (!units_[query.node_pos()].is_leaf()) {
+      auto base = units_[query.node_pos()].base();
+      if (base == Traits::INVALID) {
+        return false;
+      }
+      auto child_pos = base ^query.label();
+      if (units_[child_pos].label() != query.label()) {
+        return false;
+      }
+      query.next(child_pos);
+    }
+
+    auto leaf = units_[query.node_pos()].value();
+    query.set_value(is_terminal_(query.node_pos()) ? terminal_value_(leaf)
+                                                   : static_cast<ValueType>(leaf));
+    return true;
+  }
+
+  void enumerate(IndexType node_pos, const std::string& prefix, std::vector<KvPair>& kvs) const {
+    assert(node_pos < units_.size());
+    assert(!Prefix);
+
+    if (units_[node_pos].is_leaf()) {
+      auto leaf = units_[node_pos].value();
+      KvPair kv;
+      kv.key = prefix;
+      if (is_terminal_(node_pos)) {
+        kv.value = terminal_value_(leaf);
+      } else {
+        char buf[MAX_INLINE_LENGTH + 1];
+        const char* tail = buf;
+        if (Source::is_inline_(leaf, tail_.size())) {
+          utils::extract_inline(Source::inline_code_(leaf), buf);
+        } else {
+          tail = tail_suffix_(leaf);
+        }
+        while (*tail != '\0') {
+          kv.key += *tail++;
+        }
+        kv.key += *tail++;
+        kv.value = Source::is_inline_(leaf, tail_.size())
+                   ? utils::inline_value(Source::inline_code_(leaf)) : tail_value_(leaf, tail);
+      }
+      kvs.push_back(kv);
+      return;
+    }
+
+    uint32_t len = 0;
+    auto labels = labels_(node_pos, len);
+    const auto _prefix = prefix + std::string(labels, len);
+
+    auto base = base_(node_pos);
+    if (units_[base].label() == '\0') {
+      enumerate(base, _prefix, kvs);
+    }
+    for (uint32_t label = 1; label < 256; ++label) {
+      auto child_pos = base ^label;
+      if (units_[child_pos].label() == label) {
+        enumerate(child_pos, _prefix + static_cast<char>(label), kvs);
+      }
+    }
+  }
+
+  // for prefix trie, terminals[i] tells if kvs[i] is a key or a suffix link
+  void enumerate_prefix(IndexType node_pos, const std::string& prefix,
+                        std::vector<KvPair>& kvs, std::vector<bool>& terminals) const {
+    assert(node_pos < units_.size());
+    assert(Prefix);
+
+    if (units_[node_pos].is_leaf()) {
+      auto leaf = units_[node_pos].value();
+      if (is_terminal_(node_pos)) {
+        kvs.push_back(KvPair{prefix, terminal_value_(leaf)});
+        terminals.push_back(true);
+      } else {
+        kvs.push_back(KvPair{prefix, static_cast<ValueType>(leaf)});
+        terminals.push_back(false);
+      }
+      return;
+    }
+
+    auto base = units_[node_pos].base();
+    if (base == Traits::INVALID) { // a registered prefix without keys
+      return;
+    }
+    if (units_[base].label() == '\0') {
+      enumerate_prefix(base, prefix, kvs, terminals);
+    }
+    for (uint32_t label = 1; label < 256; ++label) {
+      auto child_pos = base ^label;
+      if (units_[child_pos].label() == label) {
+        enumerate_prefix(child_pos, prefix + static_cast<char>(label), kvs, terminals);
+      }
+    }
+  }
+
+  bool is_empty() const {
+    return units_.empty();
+  }
+
+  MemoryResource* resource() const {
+    return units_vec_.get_allocator().resource();
+  }
+
+  IndexType num_nodes() const {
+    return num_nodes_;
+  }
+
+  IndexType bc_size() const {
+    return static_cast<IndexType>(units_.size());
+  }
+
+  IndexType tail_size() const {
+    return static_cast<IndexType>(tail_.size());
+  }
+
+  IndexType label_size() const {
+    return static_cast<IndexType>(label_pool_.size());
+  }
+
+  size_t size_in_bytes() const { // as written
+    size_t size = 0;
+    size += units_.size_in_bytes();
+    size += tail_.size_in_bytes();
+    size += label_pool_.size_in_bytes();
+    size += sizeof(num_nodes_);
+    size += sizeof(shared_tail_);
+    return size;
+  }
+
+  void write(std::ostream& os) const {
+    units_.write(os);
+    tail_.write(os);
+    label_pool_.write(os);
+    utils::write_value(num_nodes_, os);
+    utils::write_value(shared_tail_, os);
+  }
+
+  // makes the trie search the bytes written by write() in place, which have
+  // to outlive the trie, for sharing them such as in a mapped file. Returns
+  // false for broken bytes, leaving the trie empty.
+  bool view(const char* bytes, size_t size) {
+    FrozenDaTrie trie(resource());
+    auto end = bytes + size;
+    if (!trie.units_.view(bytes, end) || !trie.tail_.view(bytes, end)
+        || !trie.label_pool_.view(bytes, end)
+        || static_cast<size_t>(end - bytes) != sizeof(num_nodes_) + sizeof(shared_tail_)) {
+      FrozenDaTrie empty(resource());
+      swap(empty);
+      return false;
+    }
+    std::memcpy(&trie.num_nodes_, bytes, sizeof(num_nodes_));
+    std::memcpy(&trie.shared_tail_, bytes + sizeof(num_nodes_), sizeof(shared_tail_));
+    swap(trie);
+    return true;
+  }
+
+  void swap(FrozenDaTrie& rhs) {
+    units_vec_.swap(rhs.units_vec_);
+    tail_vec_.swap(rhs.tail_vec_);
+    label_vec_.swap(rhs.label_vec_);
+    std::swap(units_, rhs.units_);
+    std::swap(tail_, rhs.tail_);
+    std::swap(label_pool_, rhs.label_pool_);
+    std::swap(num_nodes_, rhs.num_nodes_);
+    std::swap(shared_tail_, rhs.shared_tail_);
+  }
+
+  FrozenDaTrie(const FrozenDaTrie&) = delete;
+  FrozenDaTrie& operator=(const FrozenDaTrie&) = delete;
+
+private:
+  template<bool, bool, bool, bool, class> friend class DaTrie;
+
+  using Source = DaTrie<false, false, Prefix, Wide, Value>; // for the leaf formats
+
+  class Unit {
+  public:
+    IndexType base() const { return field_() & ~LEAF_FLAG; }
+    IndexType value() const { return field_() & ~LEAF_FLAG; }
+    bool is_leaf() const { return (field_() & LEAF_FLAG) != 0; }
+    uint8_t label() const { return static_cast<uint8_t>(bytes_[FIELD_BYTES]); }
+
+    void set_base(IndexType base) { set_field_(base); }
+    void set_value(IndexType value) { set_field_(value | LEAF_FLAG); }
+    void set_label(uint8_t label) { bytes_[FIELD_BYTES] = static_cast<char>(label); }
+
+  private:
+    static constexpr uint32_t FIELD_BYTES = (Traits::BITS + 1) / 8;
+    static constexpr IndexType LEAF_FLAG = IndexType{1} << Traits::BITS;
+
+    char bytes_[FIELD_BYTES + 1] = {};
+
+    IndexType field_() const {
+      IndexType field = 0;
+      std::memcpy(&field, bytes_, FIELD_BYTES);
+      return field;
+    }
+    void set_field_(IndexType field) { std::memcpy(bytes_, &field, FIELD_BYTES); }
+  };
+
+  static_assert(sizeof(Unit) == (Wide ? 7 : 5), "a unit has to be packed");
+
+  // An array searched, in the vector of the trie or in the bytes viewed
+  template<class T>
+  class ArrayView {
+  public:
+    const T& operator[](size_t pos) const { return data_[pos]; }
+    const T* data() const { return data_; }
+    const T* begin() const { return data_; }
+    const T* end() const { return data_ + size_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    template<class Vector>
+    void assign(const Vector& vec) {
+      data_ = vec.data();
+      size_ = vec.size();
+    }
+    // views an array in the format of utils::write_vector() at bytes, which
+    // is moved past it
+    bool view(const char*& bytes, const char* end) {
+      uint64_t size = 0;
+      if (static_cast<size_t>(end - bytes) < sizeof(size)) {
+        return false;
+      }
+      std::memcpy(&size, bytes, sizeof(size));
+      bytes += sizeof(size);
+      if (static_cast<uint64_t>(end - bytes) / sizeof(T) < size) {
+        return false;
+      }
+      data_ = reinterpret_cast<const T*>(bytes);
+      size_ = static_cast<size_t>(size);
+      bytes += sizeof(T) * size_;
+      return true;
+    }
+
+    size_t size_in_bytes() const {
+      return sizeof(T) * size_ + sizeof(uint64_t);
+    }
+    void write(std::ostream& os) const {
+      utils::write_value(static_cast<uint64_t>(size_), os);
+      os.write(reinterpret_cast<const char*>(data_), sizeof(T) * size_);
+    }
+
+  private:
+    const T* data_ = nullptr;
+    size_t size_ = 0;
+  };
+
+  ResourceVector<Unit> units_vec_; // empty if viewing bytes
+  ResourceVector<char> tail_vec_;
+  ResourceVector<char> label_vec_;
+  ArrayView<Unit> units_;
+  ArrayView<char> tail_;
+  ArrayView<char> label_pool_; // for compressed edges
+  IndexType num_nodes_ = 0;
+  bool shared_tail_ = false;
+
+  static constexpr uint32_t NUM_OPEN_BLOCKS = 16; // searched for bases while building
+
+  bool is_terminal_(IndexType node_pos) const {
+    return units_[node_pos].is_leaf() && node_pos != ROOT_POS && units_[node_pos].label() == '\0';
+  }
+
+  IndexType base_(IndexType node_pos) const {
+    auto base = units_[node_pos].base();
+    if (Prefix || label_pool_.empty() || (base & Traits::LABEL_FLAG) == 0) {
+      return base;
+    }
+    return Source::extract_index_(label_pool_.data() + (base & ~Traits::LABEL_FLAG));
+  }
+
+  const char* labels_(IndexType node_pos, uint32_t& len) const {
+    auto base = units_[node_pos].base();
+    if (Prefix || label_pool_.empty() || (base & Traits::LABEL_FLAG) == 0) {
+      len = 0;
+      return "";
+    }
+    auto entry = label_pool_.data() + (base & ~Traits::LABEL_FLAG);
+    len = static_cast<uint8_t>(entry[sizeof(IndexType)]);
+    return entry + sizeof(IndexType) + 1;
+  }
+
+  void edge_(IndexType node_pos, Edge& edge) const { // in the label order
+    edge.clear();
+    auto base = base_(node_pos);
+    if (units_[node_pos].is_leaf() || base == Traits::INVALID) {
+      return;
+    }
+    for (uint32_t label = 0; label < 256; ++label) {
+      if (units_[base ^ label].label() == label) {
+        edge.push(static_cast<uint8_t>(label));
+      }
+    }
+  }
+
+  ValueType terminal_value_(IndexType leaf) const {
+    if (Source::TERMINALS_FIT || !Source::is_inline_(leaf, tail_.size())) {
+      return static_cast<ValueType>(leaf);
+    }
+    return utils::extract_value<Value>(tail_.data() + (leaf & ~Traits::INLINE_FLAG));
+  }
+
+  const char* tail_suffix_(IndexType tail_pos) const {
+    auto entry = tail_.data() + tail_pos;
+    if (!shared_tail_ || !VTraits::HAS_VALUE) {
+      return entry;
+    }
+    if ((utils::extract_value<Value>(entry) & VTraits::TAIL_REF) == 0) {
+      return entry + VTraits::BYTES;
+    }
+    return tail_.data() + Source::extract_index_(entry + VTraits::BYTES);
+  }
+
+  ValueType tail_value_(IndexType tail_pos, const char* suffix_end) const {
+    if (!shared_tail_) {
+      return utils::extract_value<Value>(suffix_end);
+    }
+    return utils::extract_value<Value>(tail_.data() + tail_pos) & ~VTraits::TAIL_REF;
+  }
+
+  void view_vecs_() { // points the arrays at the owned vectors
+    units_.assign(units_vec_);
+    tail_.assign(tail_vec_);
+    label_pool_.assign(label_vec_);
+  }
+
+  // copies trie node by node in DFS, placing the children of each internal
+  // node at the first base in the open blocks that no other node has
+  template<class Trie>
+  void build_(const Trie& trie) {
+    FrozenDaTrie frozen(resource());
+    frozen.tail_vec_.assign(trie.tail_.begin(), trie.tail_.end());
+    frozen.shared_tail_ = trie.shared_tail_;
+
+    if (!trie.is_empty()) {
+      frozen.build_units_(trie);
+    }
+    frozen.view_vecs_();
+    swap(frozen);
+  }
+
+  template<class Trie>
+  void build_units_(const Trie& trie) {
+    std::vector<bool> is_used, is_base;
+    std::vector<IndexType> nexts, prevs; // of the circular list of empty units in the open blocks
+    IndexType head = Traits::NOT_FOUND;
+    IndexType num_closed = 0; // blocks
+
+    auto unlink = [&](IndexType pos) {
+      if (nexts[pos] == pos) {
+        head = Traits::NOT_FOUND;
+        return;
+      }
+      if (head == pos) {
+        head = nexts[pos];
+      }
+      nexts[prevs[pos]] = nexts[pos];
+      prevs[nexts[pos]] = prevs[pos];
+    };
+    auto push_block = [&]() {
+      auto begin = static_cast<IndexType>(units_vec_.size()), end = begin + BLOCK_SIZE;
+      if (Traits::INVALID < end) {
+        throw std::length_error("ddd: units exceed the index field");
+      }
+      if (!trie.label_pool_.empty() && Traits::LABEL_FLAG < end) {
+        throw std::length_error("ddd: units too many to flag compressed edges");
+      }
+      units_vec_.resize(end);
+      is_used.resize(end, false);
+      is_base.resize(end, false);
+      nexts.resize(end);
+      prevs.resize(end);
+      for (auto pos = begin; pos < end; ++pos) {
+        nexts[pos] = pos + 1;
+        prevs[pos] = pos - 1;
+      }
+      if (head == Traits::NOT_FOUND) {
+        head = begin;
+      } else {
+        prevs[begin] = prevs[head];
+        nexts[prevs[head]] = begin;
+      }
+      nexts[end - 1] = head;
+      prevs[head] = end - 1;
+
+      while (NUM_OPEN_BLOCKS < end / BLOCK_SIZE - num_closed) {
+        for (auto pos = num_closed * BLOCK_SIZE; pos < (num_closed + 1) * BLOCK_SIZE; ++pos) {
+          if (!is_used[pos]) {
+            unlink(pos);
+          }
+        }
+        ++num_closed;
+      }
+    };
+    auto find_base = [&](const Edge& edge) {
+      if (head != Traits::NOT_FOUND) {
+        auto pos = head;
+        do {
+          auto base = pos ^*edge.begin();
+          if (!is_base[base] && std::none_of(edge.begin() + 1, edge.end(), [&](uint8_t label) {
+            return is_used[base ^ label];
+          })) {
+            return base;
+          }
+          pos = nexts[pos];
+        } while (pos != head);
+      }
+      auto base = static_cast<IndexType>(units_vec_.size());
+      push_block();
+      return base;
+    };
+
+    push_block();
+    is_used[ROOT_POS] = true;
+    unlink(ROOT_POS);
+
+    std::vector<std::pair<IndexType, IndexType>> np_stack{{ROOT_POS, ROOT_POS}};
+    Edge edge;
+
+    while (!np_stack.empty()) {
+      auto node_pair = np_stack.back();
+      np_stack.pop_back();
+      ++num_nodes_;
+
+      if (trie.bc_[node_pair.first].is_leaf()) {
+        units_vec_[node_pair.second].set_value(trie.bc_[node_pair.first].value());
+        continue;
+      }
+      trie.edge_(node_pair.first, edge);
+      if (edge.size() == 0) { // a registered prefix without keys
+        units_vec_[node_pair.second].set_base(Traits::INVALID);
+        continue;
+      }
+
+      auto base = find_base(edge);
+      is_base[base] = true;
+
+      uint32_t len = 0;
+      auto labels = trie.labels_(node_pair.first, len);
+      if (len == 0) {
+        units_vec_[node_pair.second].set_base(base);
+      } else {
+        auto entry_pos = static_cast<IndexType>(label_vec_.size());
+        label_vec_.resize(label_vec_.size() + sizeof(IndexType) + 1 + len);
+        auto entry = label_vec_.data() + entry_pos;
+        std::memcpy(entry, &base, sizeof(IndexType));
+        entry[sizeof(IndexType)] = static_cast<char>(len);
+        std::memcpy(entry + sizeof(IndexType) + 1, labels, len);
+        units_vec_[node_pair.second].set_base(Traits::LABEL_FLAG | entry_pos);
+      }
+
+      auto trie_base = trie.base_(node_pair.first);
+      for (auto label : edge) {
+        auto child_pos = base ^label;
+        is_used[child_pos] = true;
+        unlink(child_pos);
+        units_vec_[child_pos].set_label(label);
+        np_stack.push_back({trie_base ^ label, child_pos});
+      }
+    }
+
+    // A block with an empty unit or the root has at most 255 bases, because
+    // the children of different bases are different units in the block.
+    for (IndexType pos = 0; pos < units_vec_.size(); ++pos) {
+      if (is_used[pos] && pos != ROOT_POS) {
+        continue;
+      }
+      uint32_t label = 0;
+      while (is_base[pos ^ label]) {
+        ++label;
+      }
+      assert(label < 256);
+      units_vec_[pos].set_label(static_cast<uint8_t>(label));
+    }
+    units_vec_.shrink_to_fit();
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_FROZEN_DA_TRIE_HPP
@@ -0,0 +1,250 @@
+#ifndef DDD_LOGGED_DICTIONARY_HPP
+#define DDD_LOGGED_DICTIONARY_HPP
+
+#include <algorithm>
+
+#include "SnapshotWriter.hpp"
+
+namespace ddd {
+
+// When the log of a LoggedDictionary is synced
+enum class LogSync {
+  EVERY_OP, // before each insert_key and delete_key returns
+  EVERY_GROUP, // every group of operations and on commit()
+  NEVER, // left to the OS, though written every group and on commit()
+};
+
+// A write-ahead log in front of a dictionary. Each successful insert_key and
+// delete_key appends a record to the log file, a group of records at a time,
+// so that the changes since the last snapshot survive a crash. A record is a
+// CRC-32 of the rest, the key length, the operation, the key and the value,
+// and the log ends at the first broken record, which a crash may have torn.
+//
+// checkpoint() snapshots the dictionary on a background thread and moves the
+// log to <log>.old, which is removed once the snapshot is written. Recovery
+// reads the last snapshot and passes it to the constructor, which replays
+// <log>.old and <log> in batches. Replaying operations already in the
+// snapshot is harmless, since the last operation on each key decides it.
+template<class T>
+class LoggedDictionary : public ForwardingDictionary<T> {
+public:
+  static constexpr size_t REPLAY_BATCH_SIZE = size_t{1} << 16; // operations
+
+  LoggedDictionary(std::unique_ptr<BasicDictionary<T>> dic, const std::string& log_name,
+                   LogSync sync = LogSync::EVERY_GROUP, size_t group_size = 64)
+    : ForwardingDictionary<T>{std::move(dic)}, log_name_{log_name}, old_name_{log_name + ".old"}, sync_{sync},
+      group_size_{std::max<size_t>(group_size, 1)} {
+    has_old_ = replay_(old_name_) != 0;
+    auto valid_size = replay_(log_name_);
+    // drops a torn record so that appended ones follow the valid ones
+    fd_ = ::open(log_name_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    is_ok_ = fd_ != -1 && ::ftruncate(fd_, static_cast<off_t>(valid_size)) == 0;
+  }
+
+  ~LoggedDictionary() {
+    commit();
+    wait_checkpoint();
+    if (fd_ != -1) {
+      ::close(fd_);
+    }
+  }
+
+  std::string name() const {
+    return "Logged" + dic_->name();
+  }
+
+  bool insert_key(const char* key, T value) {
+    if (!dic_->insert_key(key, value)) {
+      return false;
+    }
+    log_(OP_INSERT, key, value);
+    return true;
+  }
+
+  T delete_key(const char* key) {
+    auto value = dic_->delete_key(key);
+    if (value != ValueTraits<T>::NOT_FOUND) {
+      log_(OP_DELETE, key, value);
+    }
+    return value;
+  }
+
+  bool read_delta(std::istream& is, DeltaBase& base) { // not logged, so checkpoint() after
+    return dic_->read_delta(is, base);
+  }
+
+  // writes the records of the group so far, synced unless LogSync::NEVER, and
+  // returns false if writing the log has ever failed
+  bool commit() {
+    flush_(sync_ != LogSync::NEVER);
+    return is_ok_;
+  }
+
+  // snapshots the dictionary to file_name on a background thread and starts
+  // a new log, after waiting for the last checkpoint
+  void checkpoint(const std::string& file_name) {
+    flush_(true);
+    wait_checkpoint();
+
+    if (!has_old_) {
+      is_ok_ = std::rename(log_name_.c_str(), old_name_.c_str()) == 0 && is_ok_;
+    } else { // the old log is still needed since the last snapshot failed
+      is_ok_ = append_log_() && is_ok_;
+    }
+    ::close(fd_);
+    fd_ = ::open(log_name_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    is_ok_ = fd_ != -1 && utils::sync_dir(log_name_) && is_ok_;
+    has_old_ = true;
+
+    writer_.start(*dic_, file_name);
+    is_checkpointing_ = true;
+  }
+
+  // waits for the last checkpoint, returning whether its snapshot was written,
+  // and then the old log is removed
+  bool wait_checkpoint() {
+    if (!is_checkpointing_) {
+      return !has_old_;
+    }
+    is_checkpointing_ = false;
+    if (!writer_.wait()) {
+      return false;
+    }
+    std::remove(old_name_.c_str());
+    has_old_ = false;
+    return true;
+  }
+
+  LoggedDictionary(const LoggedDictionary&) = delete;
+  LoggedDictionary& operator=(const LoggedDictionary&) = delete;
+
+private:
+  static constexpr uint8_t OP_INSERT = 'I';
+  static constexpr uint8_t OP_DELETE = 'D';
+  static constexpr size_t HEADER_SIZE = sizeof(uint32_t) * 2 + 1; // CRC, length and operation
+
+  struct Op {
+    uint8_t type;
+    std::string key;
+    T value;
+  };
+
+  using ForwardingDictionary<T>::dic_;
+
+  std::string log_name_;
+  std::string old_name_;
+  LogSync sync_ = LogSync::EVERY_GROUP;
+  size_t group_size_ = 0;
+  int fd_ = -1;
+  bool is_ok_ = true;
+  std::string group_; // records not written yet
+  size_t num_grouped_ = 0;
+  SnapshotWriter writer_;
+  bool is_checkpointing_ = false;
+  bool has_old_ = false; // if the old log is not in a snapshot yet
+
+  void log_(uint8_t type, const char* key, T value) {
+    auto len = static_cast<uint32_t>(std::strlen(key));
+    auto begin = group_.size();
+    group_.resize(begin + HEADER_SIZE + len + sizeof(T));
+    auto rec = &group_[begin];
+    std::memcpy(rec + 4, &len, 4);
+    rec[8] = static_cast<char>(type);
+    std::memcpy(rec + HEADER_SIZE, key, len);
+    std::memcpy(rec + HEADER_SIZE + len, &value, sizeof(T));
+    auto crc = utils::crc32(rec + 4, HEADER_SIZE - 4 + len + sizeof(T));
+    std::memcpy(rec, &crc, 4);
+
+    if (sync_ == LogSync::EVERY_OP || group_size_ <= ++num_grouped_) {
+      flush_(sync_ != LogSync::NEVER);
+    }
+  }
+
+  void flush_(bool sync) {
+    if (!group_.empty()) {
+      is_ok_ = fd_ != -1 && utils::write_fd(fd_, group_.data(), group_.size()) && is_ok_;
+      group_.clear();
+      num_grouped_ = 0;
+    }
+    if (sync && fd_ != -1) {
+      is_ok_ = ::fsync(fd_) == 0 && is_ok_;
+    }
+  }
+
+  bool append_log_() const { // to the old log
+    std::ifstream ifs{log_name_, std::ios::binary};
+    auto fd = ::open(old_name_.c_str(), O_WRONLY | O_APPEND);
+    if (fd == -1) {
+      return false;
+    }
+    std::vector<char> buf(size_t{1} << 20);
+    auto is_appended = true;
+    while (is_appended && ifs.read(buf.data(), static_cast<std::streamsize>(buf.size())).gcount() != 0) {
+      is_appended = utils::write_fd(fd, buf.data(), static_cast<size_t>(ifs.gcount()));
+    }
+    is_appended = is_appended && ::fsync(fd) == 0;
+    ::close(fd);
+    return is_appended;
+  }
+
+  // applies the valid records of the log in batches sorted by key, in which
+  // the operations on each key keep their order, and returns the valid size
+  uint64_t replay_(const std::string& file_name) {
+    std::ifstream ifs{file_name, std::ios::binary};
+    if (!ifs) {
+      return 0;
+    }
+    ifs.seekg(0, std::ios::end);
+    const auto file_size = static_cast<uint64_t>(ifs.tellg());
+    ifs.seekg(0);
+
+    uint64_t valid_size = 0;
+    std::vector<Op> ops;
+    std::vector<char> rec;
+    while (true) {
+      char header[HEADER_SIZE];
+      if (!ifs.read(header, HEADER_SIZE)) {
+        break;
+      }
+      uint32_t crc = 0, len = 0;
+      std::memcpy(&crc, header, 4);
+      std::memcpy(&len, header + 4, 4);
+      if (file_size - valid_size - HEADER_SIZE < uint64_t{len} + sizeof(T)) { // a torn or broken length
+        break;
+      }
+      rec.resize(HEADER_SIZE - 4 + len + sizeof(T));
+      std::memcpy(rec.data(), header + 4, HEADER_SIZE - 4);
+      if (!ifs.read(rec.data() + HEADER_SIZE - 4, len + sizeof(T))
+          || utils::crc32(rec.data(), rec.size()) != crc) {
+        break;
+      }
+      Op op{static_cast<uint8_t>(header[8]), std::string(rec.data() + HEADER_SIZE - 4, len), T{}};
+      std::memcpy(&op.value, rec.data() + HEADER_SIZE - 4 + len, sizeof(T));
+      ops.push_back(std::move(op));
+      valid_size += 4 + rec.size();
+      if (ops.size() == REPLAY_BATCH_SIZE) {
+        apply_(ops);
+      }
+    }
+    apply_(ops);
+    return valid_size;
+  }
+
+  void apply_(std::vector<Op>& ops) {
+    std::stable_sort(ops.begin(), ops.end(), [](const Op& a, const Op& b) {
+      return a.key < b.key;
+    });
+    for (auto& op : ops) {
+      if (op.type == OP_INSERT) {
+        dic_->insert_key(op.key.c_str(), op.value);
+      } else {
+        dic_->delete_key(op.key.c_str());
+      }
+    }
+    ops.clear();
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_LOGGED_DICTIONARY_HPP
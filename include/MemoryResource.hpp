@@ -0,0 +1,222 @@
+#ifndef DDD_MEMORY_RESOURCE_HPP
+#define DDD_MEMORY_RESOURCE_HPP
+
+#include <cassert>
+#include <mutex>
+#include <new>
+#include <type_traits>
+
+#include "Basic.hpp"
+
+namespace ddd {
+
+// A C++11 counterpart of std::pmr::memory_resource. Blocks are aligned for
+// any fundamental type, which covers every array of DaTrie.
+class MemoryResource {
+public:
+  virtual ~MemoryResource() {}
+
+  void* allocate(size_t bytes) {
+    return do_allocate(bytes);
+  }
+
+  void deallocate(void* ptr, size_t bytes) {
+    do_deallocate(ptr, bytes);
+  }
+
+protected:
+  virtual void* do_allocate(size_t bytes) = 0;
+  virtual void do_deallocate(void* ptr, size_t bytes) = 0;
+};
+
+class NewDeleteResource : public MemoryResource {
+protected:
+  void* do_allocate(size_t bytes) {
+    return ::operator new(bytes);
+  }
+
+  void do_deallocate(void* ptr, size_t) {
+    ::operator delete(ptr);
+  }
+};
+
+inline MemoryResource* new_delete_resource() {
+  static NewDeleteResource resource;
+  return &resource;
+}
+
+// Carves blocks out of large chunks and keeps freed blocks in a free list per
+// size class for reuse. Classes are 16 bytes apart up to 128 bytes and then
+// four per doubling, so a block wastes at most a quarter of its size. Chunks
+// are returned only on destruction. Blocks larger than MAX_BLOCK_SIZE, mostly
+// growing arrays, come from upstream, which can coalesce them once freed.
+// It is thread-safe so that subtries can be rebuilt in parallel.
+class PoolResource : public MemoryResource {
+public:
+  static constexpr size_t MIN_BLOCK_SIZE = 16;
+  static constexpr size_t MAX_BLOCK_SIZE = size_t{1} << 12;
+  static constexpr size_t CHUNK_SIZE = size_t{1} << 20;
+
+  PoolResource(MemoryResource* upstream = new_delete_resource()) : upstream_{upstream} {}
+
+  ~PoolResource() {
+    while (chunks_ != nullptr) {
+      auto next = chunks_->next;
+      upstream_->deallocate(chunks_, CHUNK_SIZE);
+      chunks_ = next;
+    }
+  }
+
+  size_t num_chunks() const {
+    std::lock_guard<std::mutex> lock{mutex_};
+    return num_chunks_;
+  }
+
+  PoolResource(const PoolResource&) = delete;
+  PoolResource& operator=(const PoolResource&) = delete;
+
+protected:
+  void* do_allocate(size_t bytes) {
+    if (MAX_BLOCK_SIZE < bytes) {
+      return upstream_->allocate(bytes);
+    }
+
+    auto cls = class_(bytes);
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    if (free_lists_[cls] != nullptr) {
+      auto block = free_lists_[cls];
+      free_lists_[cls] = block->next;
+      return block;
+    }
+
+    auto size = size_(cls);
+    if (static_cast<size_t>(chunk_end_ - chunk_pos_) < size) {
+      push_chunk_();
+    }
+    auto block = chunk_pos_;
+    chunk_pos_ += size;
+    return block;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes) {
+    if (MAX_BLOCK_SIZE < bytes) {
+      upstream_->deallocate(ptr, bytes);
+      return;
+    }
+
+    auto cls = class_(bytes);
+    std::lock_guard<std::mutex> lock{mutex_};
+
+    auto block = static_cast<Link*>(ptr);
+    block->next = free_lists_[cls];
+    free_lists_[cls] = block;
+  }
+
+private:
+  struct Link {
+    Link* next;
+  };
+
+  static constexpr uint32_t NUM_CLASSES = 28; // from MIN_BLOCK_SIZE to MAX_BLOCK_SIZE
+
+  MemoryResource* upstream_;
+  Link* free_lists_[NUM_CLASSES] = {};
+  Link* chunks_ = nullptr; // linked through their first bytes
+  char* chunk_pos_ = nullptr;
+  char* chunk_end_ = nullptr;
+  size_t num_chunks_ = 0;
+  mutable std::mutex mutex_;
+
+  static uint32_t class_(size_t bytes) { // of the smallest block not less than bytes
+    assert(0 < bytes && bytes <= MAX_BLOCK_SIZE);
+    if (bytes <= 128) {
+      return static_cast<uint32_t>((bytes - 1) / MIN_BLOCK_SIZE);
+    }
+    auto log = 63 - static_cast<uint32_t>(__builtin_clzll(bytes - 1));
+    return 4 * log - 24 + static_cast<uint32_t>((bytes - 1) >> (log - 2));
+  }
+
+  static size_t size_(uint32_t cls) {
+    if (cls < 8) {
+      return MIN_BLOCK_SIZE * (cls + 1);
+    }
+    auto log = 7 + (cls - 8) / 4;
+    return size_t{(cls - 8) % 4 + 5} << (log - 2);
+  }
+
+  void push_chunk_() {
+    // the rest of the current chunk goes to the free lists
+    while (MIN_BLOCK_SIZE <= static_cast<size_t>(chunk_end_ - chunk_pos_)) {
+      auto rest = static_cast<size_t>(chunk_end_ - chunk_pos_);
+      if (MAX_BLOCK_SIZE < rest) {
+        rest = MAX_BLOCK_SIZE;
+      }
+      auto cls = class_(rest);
+      if (rest < size_(cls)) {
+        --cls;
+      }
+      auto block = reinterpret_cast<Link*>(chunk_pos_);
+      block->next = free_lists_[cls];
+      free_lists_[cls] = block;
+      chunk_pos_ += size_(cls);
+    }
+
+    auto chunk = static_cast<char*>(upstream_->allocate(CHUNK_SIZE));
+    auto link = reinterpret_cast<Link*>(chunk);
+    link->next = chunks_;
+    chunks_ = link;
+    ++num_chunks_;
+
+    chunk_pos_ = chunk + MIN_BLOCK_SIZE; // after the link
+    chunk_end_ = chunk + CHUNK_SIZE;
+  }
+};
+
+// An allocator drawing from a MemoryResource. The resource moves along with
+// the contents when containers are swapped or move-assigned.
+template<class T>
+class ResourceAllocator {
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ResourceAllocator(MemoryResource* resource = new_delete_resource()) : resource_{resource} {}
+
+  template<class U>
+  ResourceAllocator(const ResourceAllocator<U>& rhs) : resource_{rhs.resource()} {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(resource_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t n) {
+    resource_->deallocate(ptr, n * sizeof(T));
+  }
+
+  MemoryResource* resource() const {
+    return resource_;
+  }
+
+private:
+  MemoryResource* resource_;
+};
+
+template<class T, class U>
+inline bool operator==(const ResourceAllocator<T>& lhs, const ResourceAllocator<U>& rhs) {
+  return lhs.resource() == rhs.resource();
+}
+
+template<class T, class U>
+inline bool operator!=(const ResourceAllocator<T>& lhs, const ResourceAllocator<U>& rhs) {
+  return lhs.resource() != rhs.resource();
+}
+
+template<class T>
+using ResourceVector = std::vector<T, ResourceAllocator<T>>;
+
+} // namespace -- ddd
+
+#endif // DDD_MEMORY_RESOURCE_HPP
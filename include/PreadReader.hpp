@@ -0,0 +1,43 @@
+#ifndef DDD_PREAD_READER_HPP
+#define DDD_PREAD_READER_HPP
+
+#include <cerrno>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Dictionary.hpp"
+
+namespace ddd {
+
+// Reads bytes of a file by pread(2), which threads can do at once on the
+// same descriptor, for the concurrent reader of DictionaryMLT. fd has to
+// stay open while it is used.
+class PreadReader {
+public:
+  explicit PreadReader(int fd) : fd_{fd} {}
+
+  // fills bytes from offset, returning false on an error or the end of file
+  bool operator()(uint64_t offset, std::vector<char>& bytes) const {
+    size_t done = 0;
+    while (done < bytes.size()) {
+      auto ret = ::pread(fd_, bytes.data() + done, bytes.size() - done,
+                         static_cast<off_t>(offset + done));
+      if (ret <= 0) {
+        if (ret < 0 && errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      done += static_cast<size_t>(ret);
+    }
+    return true;
+  }
+
+private:
+  int fd_ = -1;
+};
+
+} // namespace -- ddd
+
+#endif // DDD_PREAD_READER_HPP
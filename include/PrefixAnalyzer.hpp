@@ -0,0 +1,176 @@
+#ifndef DDD_PREFIX_ANALYZER_HPP
+#define DDD_PREFIX_ANALYZER_HPP
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <random>
+
+#include "Dictionary.hpp"
+
+namespace ddd {
+
+// Chooses pre-registered prefixes of DictionaryMLT from a sample of keys.
+// In DictionaryMLT, a key goes to the subtrie of its shortest prefix that is
+// not a path of the prefix trie, so registering a prefix splits its subtrie
+// into the subtries of one more character. The analyzer splits the largest
+// subtrie while its estimated number of keys exceeds max_keys.
+class PrefixAnalyzer {
+public:
+  explicit PrefixAnalyzer(size_t max_keys, size_t max_samples = size_t{1} << 16)
+    : max_keys_{max_keys}, max_samples_{max_samples} {
+    assert(0 < max_keys_ && 0 < max_samples_);
+  }
+
+  ~PrefixAnalyzer() {}
+
+  void add_key(const char* key) { // by reservoir sampling
+    ++num_keys_;
+    if (samples_.size() < max_samples_) {
+      samples_.push_back(key);
+      return;
+    }
+    auto i = std::uniform_int_distribution<size_t>{0, num_keys_ - 1}(engine_);
+    if (i < max_samples_) {
+      samples_[i] = key;
+    }
+  }
+
+  template<class T>
+  void add_keys(const BasicDictionary<T>& dic) {
+    std::vector<BasicKvPair<T>> kvs;
+    dic.enumerate(kvs);
+    for (auto& kv : kvs) {
+      add_key(kv.key.c_str());
+    }
+  }
+
+  void analyze() {
+    prefixes_.clear();
+    subtrie_sizes_.clear();
+    num_terminals_ = 0;
+    if (samples_.empty()) {
+      return;
+    }
+
+    std::sort(samples_.begin(), samples_.end());
+    scale_ = static_cast<double>(num_keys_) / samples_.size();
+
+    std::priority_queue<Group> groups;
+    std::vector<bool> is_maximal; // of the split groups, indexed by group id
+    std::vector<size_t> parents;
+
+    auto push_children = [&](const Group& group) {
+      auto depth = group.depth;
+      auto begin = group.begin;
+      while (begin < group.end && samples_[begin].size() == depth) {
+        ++num_terminals_; // stored in the prefix trie
+        ++begin;
+      }
+      while (begin < group.end) {
+        auto label = samples_[begin][depth];
+        auto end = begin + 1;
+        while (end < group.end && samples_[end][depth] == label) {
+          ++end;
+        }
+        groups.push(Group{begin, end, depth + 1, is_maximal.size()});
+        is_maximal.push_back(false);
+        parents.push_back(group.id);
+        begin = end;
+      }
+    };
+
+    is_maximal.push_back(true);
+    parents.push_back(NOT_FOUND);
+    push_children(Group{0, samples_.size(), 0, 0});
+
+    // a single sample tells nothing about the structure below it
+    while (!groups.empty() && max_keys_ < estimate_(groups.top().size())
+           && 1 < groups.top().size()) {
+      auto group = groups.top();
+      groups.pop();
+      is_maximal[group.id] = true;
+      is_maximal[parents[group.id]] = false; // registered along with the longer one
+      prefixes_.emplace(group.id, samples_[group.begin].substr(0, group.depth));
+      push_children(group);
+    }
+
+    while (!groups.empty()) {
+      subtrie_sizes_.push_back(estimate_(groups.top().size()));
+      groups.pop();
+    }
+    num_terminals_ = estimate_(num_terminals_);
+
+    for (auto it = prefixes_.begin(); it != prefixes_.end();) {
+      if (is_maximal[it->first]) {
+        ++it;
+      } else {
+        it = prefixes_.erase(it);
+      }
+    }
+  }
+
+  // pre-registered prefixes for DictionaryMLT, valid while the analyzer lives
+  std::vector<const char*> prefixes() const {
+    std::vector<const char*> ret;
+    ret.reserve(prefixes_.size());
+    for (auto& prefix : prefixes_) {
+      ret.push_back(prefix.second.c_str());
+    }
+    return ret;
+  }
+
+  // the estimated number of keys in each subtrie in descending order
+  const std::vector<size_t>& subtrie_sizes() const {
+    return subtrie_sizes_;
+  }
+
+  size_t num_terminals() const { // estimated keys stored in the prefix trie
+    return num_terminals_;
+  }
+
+  size_t num_keys() const {
+    return num_keys_;
+  }
+
+  size_t num_samples() const {
+    return samples_.size();
+  }
+
+  PrefixAnalyzer(const PrefixAnalyzer&) = delete;
+  PrefixAnalyzer& operator=(const PrefixAnalyzer&) = delete;
+
+private:
+  struct Group { // samples_[begin, end) sharing the prefix of depth characters
+    size_t begin;
+    size_t end;
+    size_t depth;
+    size_t id;
+
+    size_t size() const {
+      return end - begin;
+    }
+
+    bool operator<(const Group& rhs) const {
+      return size() < rhs.size();
+    }
+  };
+
+  size_t max_keys_;
+  size_t max_samples_;
+  size_t num_keys_ = 0;
+  double scale_ = 1.0;
+  std::vector<std::string> samples_;
+  std::mt19937 engine_;
+  std::map<size_t, std::string> prefixes_; // group id -> prefix
+  std::vector<size_t> subtrie_sizes_;
+  size_t num_terminals_ = 0;
+
+  size_t estimate_(size_t num_samples) const {
+    return static_cast<size_t>(num_samples * scale_ + 0.5);
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_PREFIX_ANALYZER_HPP
@@ -0,0 +1,416 @@
+#ifndef DDD_REPLICATED_DICTIONARY_HPP
+#define DDD_REPLICATED_DICTIONARY_HPP
+
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "Dictionary.hpp"
+
+namespace ddd {
+
+namespace utils {
+
+// appends the CPUs of a list such as "0-3,8,10-11" to ret
+inline void parse_cpulist(const std::string& list, std::vector<uint32_t>& ret) {
+  std::istringstream iss{list};
+  std::string range;
+  while (std::getline(iss, range, ',')) {
+    char* end = nullptr;
+    auto first = std::strtoul(range.c_str(), &end, 10);
+    if (end == range.c_str()) { // such as an empty list
+      continue;
+    }
+    auto last = *end == '-' ? std::strtoul(end + 1, nullptr, 10) : first;
+    for (auto cpu = first; cpu <= last; ++cpu) {
+      ret.push_back(static_cast<uint32_t>(cpu));
+    }
+  }
+}
+
+// gives the CPUs of each NUMA node with CPUs, in the order of node IDs, or a
+// single node without CPUs, meaning all of them, when the system tells none
+inline void numa_nodes(std::vector<std::vector<uint32_t>>& ret) {
+  static const std::string dir_name = "/sys/devices/system/node";
+  std::vector<uint32_t> ids;
+  if (auto dir = ::opendir(dir_name.c_str())) {
+    while (auto entry = ::readdir(dir)) {
+      std::string name = entry->d_name;
+      if (name.size() > 4 && name.compare(0, 4, "node") == 0
+          && name.find_first_not_of("0123456789", 4) == std::string::npos) {
+        ids.push_back(static_cast<uint32_t>(std::stoul(name.substr(4))));
+      }
+    }
+    ::closedir(dir);
+  }
+  std::sort(ids.begin(), ids.end());
+
+  ret.clear();
+  for (auto id : ids) {
+    std::ifstream ifs{dir_name + "/node" + std::to_string(id) + "/cpulist"};
+    std::string list;
+    std::vector<uint32_t> cpus;
+    if (std::getline(ifs, list)) {
+      parse_cpulist(list, cpus);
+    }
+    if (!cpus.empty()) { // not a node of only memory
+      ret.push_back(std::move(cpus));
+    }
+  }
+  if (ret.empty()) {
+    ret.resize(1);
+  }
+}
+
+// binds the calling thread to the CPUs, or leaves it for none
+inline bool bind_thread(const std::vector<uint32_t>& cpus) {
+  if (cpus.empty()) {
+    return true;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) == 0;
+}
+
+// A thread bound to CPUs, running the tasks given by post() one at a time,
+// so that a task on a node does not pay for starting a thread
+class BoundWorker {
+public:
+  explicit BoundWorker(const std::vector<uint32_t>& cpus) {
+    thread_ = std::thread([this, cpus] {
+      bind_thread(cpus);
+      run_();
+    });
+  }
+
+  ~BoundWorker() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      is_stopped_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // starts task on the thread, which has to be waited for before the next
+  void post(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(is_done_);
+    task_ = std::move(task);
+    is_done_ = false;
+    cv_.notify_all();
+  }
+
+  // waits for the task, rethrowing what it threw
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return is_done_; });
+    if (error_) {
+      auto error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+
+  BoundWorker(const BoundWorker&) = delete;
+  BoundWorker& operator=(const BoundWorker&) = delete;
+
+private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::function<void()> task_;
+  std::exception_ptr error_;
+  bool is_done_ = true;
+  bool is_stopped_ = false;
+  std::thread thread_;
+
+  void run_() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this] { return !is_done_ || is_stopped_; });
+      if (is_done_) { // stopped
+        return;
+      }
+      auto task = std::move(task_);
+      task_ = nullptr;
+      lock.unlock();
+      std::exception_ptr error;
+      try {
+        task();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+      error_ = error;
+      is_done_ = true;
+      cv_.notify_all();
+    }
+  }
+};
+
+} // namespace -- utils
+
+// A replica of a dictionary per NUMA node, for read-mostly dictionaries that
+// threads on every node search. Each replica is read by a thread bound to its
+// node, so that the node first touches and thus holds the memory, and each
+// search goes to the replica of the node running the caller. Updates,
+// rebuild(), pack() and shrink() run on the threads of the nodes again, kept
+// bound to them, so that the arrays they grow or make stay local. What a
+// replica throws reaches the caller, as does std::runtime_error when the
+// replicas give different results for an update. Profiles are recorded per replica, so
+// each one is rebuilt by the searches of its node. The searches are
+// thread-safe, profiled or not, but not during the other operations.
+template<class T>
+class ReplicatedDictionary : public BasicDictionary<T> {
+public:
+  // reads a dictionary from a file written by BasicDictionary::write()
+  using ReadFunc = std::function<std::unique_ptr<BasicDictionary<T>>(std::istream&)>;
+
+  // replicates dic on each NUMA node by read
+  ReplicatedDictionary(std::unique_ptr<BasicDictionary<T>> dic, ReadFunc read)
+    : read_{std::move(read)} {
+    utils::numa_nodes(nodes_);
+    init_(std::move(dic));
+  }
+
+  // replicates dic on each of nodes, given as lists of CPUs
+  ReplicatedDictionary(std::unique_ptr<BasicDictionary<T>> dic, ReadFunc read,
+                       const std::vector<std::vector<uint32_t>>& nodes)
+    : read_{std::move(read)}, nodes_{nodes} {
+    assert(!nodes_.empty());
+    init_(std::move(dic));
+  }
+
+  ~ReplicatedDictionary() {}
+
+  std::string name() const {
+    return "Replicated" + replicas_[0]->name();
+  }
+
+  T search_key(const char* key) const {
+    return replicas_[local_replica()]->search_key(key);
+  }
+
+  bool insert_key(const char* key, T value) {
+    std::vector<char> rets(replicas_.size());
+    on_nodes_([&](size_t i) { rets[i] = replicas_[i]->insert_key(key, value); });
+    check_agreed_(rets);
+    return rets[0] != 0;
+  }
+
+  T delete_key(const char* key) {
+    std::vector<T> rets(replicas_.size());
+    on_nodes_([&](size_t i) { rets[i] = replicas_[i]->delete_key(key); });
+    check_agreed_(rets);
+    return rets[0];
+  }
+
+  void enumerate(std::vector<BasicKvPair<T>>& kvs) const {
+    replicas_[0]->enumerate(kvs);
+  }
+
+  void pack() {
+    on_nodes_([this](size_t i) { replicas_[i]->pack(); });
+  }
+
+  void rebuild() {
+    on_nodes_([this](size_t i) { replicas_[i]->rebuild(); });
+  }
+
+  void shrink() {
+    on_nodes_([this](size_t i) { replicas_[i]->shrink(); });
+  }
+
+  void set_shared_tail(bool shared) {
+    for (auto& replica : replicas_) {
+      replica->set_shared_tail(shared);
+    }
+  }
+
+  void set_profiling(uint32_t period) {
+    for (auto& replica : replicas_) {
+      replica->set_profiling(period);
+    }
+  }
+
+  void set_layout(Layout layout) {
+    for (auto& replica : replicas_) {
+      replica->set_layout(layout);
+    }
+  }
+
+  void set_edge_compression(bool enabled) {
+    for (auto& replica : replicas_) {
+      replica->set_edge_compression(enabled);
+    }
+  }
+
+  void stat(Stat& ret) const { // of a replica
+    replicas_[0]->stat(ret);
+  }
+
+  double ratio_singles() const {
+    return replicas_[0]->ratio_singles();
+  }
+
+  void leaf_stat(LeafStat& ret) const {
+    replicas_[0]->leaf_stat(ret);
+  }
+
+  void trace_key(const char* key, AccessTrace& trace) const {
+    replicas_[local_replica()]->trace_key(key, trace);
+  }
+
+  void write(std::ostream& os) const {
+    replicas_[0]->write(os);
+  }
+
+  void snapshot(FileImage& ret) const {
+    replicas_[0]->snapshot(ret);
+  }
+
+  void write_compressed(std::ostream& os) const {
+    replicas_[0]->write_compressed(os);
+  }
+
+  void delta_base(DeltaBase& ret) const {
+    replicas_[0]->delta_base(ret);
+  }
+
+  void write_delta(DeltaBase& base, std::ostream& os) const {
+    replicas_[0]->write_delta(base, os);
+  }
+
+  // applies the delta to a copy of a replica, which replaces all of them
+  // only if it applies, so that a failed delta leaves the replicas and base
+  // as before
+  bool read_delta(std::istream& is, DeltaBase& base) {
+    auto dic = read_image_(write_image_(*replicas_[0]));
+    auto new_base = base;
+    if (!dic->read_delta(is, new_base)) {
+      return false;
+    }
+    replicate_(*dic);
+    base = std::move(new_base);
+    return true;
+  }
+
+  size_t num_replicas() const {
+    return replicas_.size();
+  }
+
+  const BasicDictionary<T>& replica(size_t i) const {
+    return *replicas_[i];
+  }
+
+  // the replica of the node running the calling thread
+  size_t local_replica() const {
+    auto cpu = ::sched_getcpu();
+    if (cpu < 0 || replica_of_cpu_.size() <= static_cast<size_t>(cpu)) {
+      return 0;
+    }
+    return replica_of_cpu_[cpu];
+  }
+
+  ReplicatedDictionary(const ReplicatedDictionary&) = delete;
+  ReplicatedDictionary& operator=(const ReplicatedDictionary&) = delete;
+
+private:
+  ReadFunc read_;
+  std::vector<std::vector<uint32_t>> nodes_; // CPUs of each replica
+  std::vector<std::unique_ptr<BasicDictionary<T>>> replicas_;
+  std::vector<uint32_t> replica_of_cpu_;
+  std::vector<std::unique_ptr<utils::BoundWorker>> workers_; // of each node
+
+  void init_(std::unique_ptr<BasicDictionary<T>> dic) {
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      for (auto cpu : nodes_[i]) {
+        if (replica_of_cpu_.size() <= cpu) {
+          replica_of_cpu_.resize(cpu + 1, 0);
+        }
+        replica_of_cpu_[cpu] = static_cast<uint32_t>(i);
+      }
+    }
+    for (auto& cpus : nodes_) {
+      workers_.push_back(make_unique<utils::BoundWorker>(cpus));
+    }
+    replicas_.resize(nodes_.size());
+    replicate_(*dic);
+  }
+
+  // replaces the replicas by copies of dic, throwing std::runtime_error if
+  // read_ cannot read one back, which keeps all the old ones
+  void replicate_(const BasicDictionary<T>& dic) {
+    auto file = write_image_(dic);
+    std::vector<std::unique_ptr<BasicDictionary<T>>> replicas(nodes_.size());
+    on_nodes_([&](size_t i) { replicas[i] = read_image_(file); });
+    replicas_.swap(replicas);
+  }
+
+  static std::string write_image_(const BasicDictionary<T>& dic) {
+    std::string file;
+    FileImage image;
+    dic.snapshot(image);
+    utils::StringOutputBuf buf(&file);
+    std::ostream os(&buf);
+    utils::write_image(os, image);
+    return file;
+  }
+
+  std::unique_ptr<BasicDictionary<T>> read_image_(const std::string& file) const {
+    utils::SpanInputBuf buf(file.data(), file.size());
+    std::istream is(&buf);
+    auto dic = read_(is);
+    if (!dic || is.fail()) {
+      throw std::runtime_error("ddd: a replica cannot be read back");
+    }
+    return dic;
+  }
+
+  template<class U>
+  static void check_agreed_(const std::vector<U>& rets) {
+    if (std::count(rets.begin(), rets.end(), rets[0]) != static_cast<ptrdiff_t>(rets.size())) {
+      throw std::runtime_error("ddd: replicas disagree on an update");
+    }
+  }
+
+  // runs func(i) for each replica i by the worker of its node, all at once,
+  // rethrowing the first exception after all of them finish
+  template<class F>
+  void on_nodes_(F func) {
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      workers_[i]->post([&func, i] { func(i); });
+    }
+    std::exception_ptr error;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      try {
+        workers_[i]->wait();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_REPLICATED_DICTIONARY_HPP
@@ -0,0 +1,334 @@
+#ifndef DDD_SHARED_DICTIONARY_HPP
+#define DDD_SHARED_DICTIONARY_HPP
+
+#include <atomic>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DictionarySGL.hpp"
+
+namespace ddd {
+
+// Dictionaries in POSIX shared memory, published by a single writer process
+// and searched in place by reader processes, which share one copy. The writer
+// updates its own DictionarySGL and publishes a frozen copy of it as a new
+// generation, in the segment <name>.<generation> never changed after, and
+// then the generation number in the segment <name>. Publishing unlinks the
+// last generation, whose memory is freed once no reader maps it.
+constexpr uint32_t SHARED_MAGIC = 0x53444444; // "DDDS" in little endian
+constexpr uint32_t SHARED_VERSION = 1;
+
+struct SharedHeader { // the segment <name>
+  uint32_t magic;
+  uint32_t version;
+  uint32_t type; // by utils::file_type()
+  uint32_t reserved;
+  std::atomic<uint64_t> generation; // the last published, 0 for none
+};
+
+struct SharedGeneration { // followed by the frozen trie as written
+  uint32_t magic;
+  uint32_t version;
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t generation;
+  uint64_t num_keys;
+  uint64_t size; // of the frozen trie
+};
+
+static_assert(sizeof(SharedHeader) == 24 && sizeof(SharedGeneration) == 40, "no padding");
+
+namespace utils {
+
+inline std::string generation_name(const std::string& name, uint64_t generation) {
+  return name + "." + std::to_string(generation);
+}
+
+// A POSIX shared-memory segment mapped in memory
+class SharedSegment {
+public:
+  SharedSegment() {}
+
+  ~SharedSegment() {
+    unmap();
+  }
+
+  // creates the segment of size bytes for writing, which has to be new if
+  // exclusive and otherwise keeps its bytes
+  bool create(const std::string& name, size_t size, bool exclusive) {
+    unmap();
+    auto fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | (exclusive ? O_EXCL : 0), 0644);
+    if (fd == -1) {
+      return false;
+    }
+    auto is_mapped = ::ftruncate(fd, static_cast<off_t>(size)) == 0
+                     && map_(fd, size, PROT_READ | PROT_WRITE);
+    ::close(fd);
+    return is_mapped;
+  }
+
+  bool open(const std::string& name) { // the whole segment for reading
+    unmap();
+    auto fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd == -1) {
+      return false;
+    }
+    struct stat st{};
+    auto is_mapped = ::fstat(fd, &st) == 0 && map_(fd, static_cast<size_t>(st.st_size), PROT_READ);
+    ::close(fd);
+    return is_mapped;
+  }
+
+  void unmap() {
+    if (data_ != nullptr) {
+      ::munmap(data_, size_);
+      data_ = nullptr;
+      size_ = 0;
+    }
+  }
+
+  char* data() const {
+    return data_;
+  }
+  size_t size() const {
+    return size_;
+  }
+
+  void swap(SharedSegment& rhs) {
+    std::swap(data_, rhs.data_);
+    std::swap(size_, rhs.size_);
+  }
+
+  SharedSegment(const SharedSegment&) = delete;
+  SharedSegment& operator=(const SharedSegment&) = delete;
+
+private:
+  char* data_ = nullptr;
+  size_t size_ = 0;
+
+  bool map_(int fd, size_t size, int prot) {
+    if (size == 0) {
+      return false;
+    }
+    auto addr = ::mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      return false;
+    }
+    data_ = static_cast<char*>(addr);
+    size_ = size;
+    return true;
+  }
+};
+
+} // namespace -- utils
+
+// The writer side, publishing generations of a dictionary under name, such
+// as "/dic", after the last one there
+template<bool Wide = false, class Value = uint32_t>
+class SharedPublisher {
+public:
+  using FrozenType = FrozenDaTrie<false, Wide, Value>;
+
+  explicit SharedPublisher(const std::string& name) : name_{name} {
+    if (!header_seg_.create(name_, sizeof(SharedHeader), false)) {
+      return;
+    }
+    auto header = header_();
+    if (header->magic == SHARED_MAGIC && header->version == SHARED_VERSION
+        && header->type == type_()) {
+      generation_ = header->generation.load(std::memory_order_acquire);
+      return;
+    }
+    new(header) SharedHeader{SHARED_MAGIC, SHARED_VERSION, type_(), 0, {0}};
+  }
+
+  ~SharedPublisher() {}
+
+  bool is_open() const {
+    return header_seg_.data() != nullptr;
+  }
+
+  uint64_t generation() const { // the last published
+    return generation_;
+  }
+
+  // publishes a frozen copy of dic as the next generation, returning false
+  // on an error, when the last generation stays
+  template<bool WithBLM, bool WithNLM>
+  bool publish(const DictionarySGL<WithBLM, WithNLM, Wide, Value>& dic) {
+    FrozenType frozen;
+    dic.freeze(frozen);
+    Stat stat{};
+    dic.stat(stat);
+    return publish(frozen, stat.num_keys);
+  }
+
+  bool publish(const FrozenType& frozen, size_t num_keys) {
+    if (!is_open()) {
+      return false;
+    }
+    const auto generation = generation_ + 1;
+    const auto seg_name = utils::generation_name(name_, generation);
+    ::shm_unlink(seg_name.c_str()); // left by a writer that failed to publish it
+
+    const SharedGeneration head{SHARED_MAGIC, SHARED_VERSION, type_(), 0, generation,
+                                num_keys, frozen.size_in_bytes()};
+    utils::SharedSegment seg;
+    if (!seg.create(seg_name, sizeof(head) + head.size, true)) {
+      return false;
+    }
+    std::memcpy(seg.data(), &head, sizeof(head));
+    utils::SpanOutputBuf buf(seg.data() + sizeof(head), static_cast<size_t>(head.size));
+    std::ostream os(&buf);
+    frozen.write(os);
+    seg.unmap();
+    if (!os) {
+      ::shm_unlink(seg_name.c_str());
+      return false;
+    }
+
+    header_()->generation.store(generation, std::memory_order_release);
+    if (generation_ != 0) {
+      ::shm_unlink(utils::generation_name(name_, generation_).c_str());
+    }
+    generation_ = generation;
+    return true;
+  }
+
+  // unlinks the segments, while the readers mapping them keep them
+  void unlink() {
+    if (generation_ != 0) {
+      ::shm_unlink(utils::generation_name(name_, generation_).c_str());
+    }
+    ::shm_unlink(name_.c_str());
+  }
+
+  SharedPublisher(const SharedPublisher&) = delete;
+  SharedPublisher& operator=(const SharedPublisher&) = delete;
+
+private:
+  std::string name_;
+  utils::SharedSegment header_seg_;
+  uint64_t generation_ = 0;
+
+  static uint32_t type_() {
+    return utils::file_type(FileKind::SGL_SHARED, false, false, Wide, ValueTraits<Value>::BYTES);
+  }
+
+  SharedHeader* header_() const {
+    return reinterpret_cast<SharedHeader*>(header_seg_.data());
+  }
+};
+
+// The reader side, searching the generation mapped until refresh(). The
+// searches are thread-safe but not during refresh().
+template<bool Wide = false, class Value = uint32_t>
+class SharedReader {
+public:
+  using FrozenType = FrozenDaTrie<false, Wide, Value>;
+  using Query = typename FrozenType::Query;
+  using VTraits = typename FrozenType::VTraits;
+  using ValueType = typename FrozenType::ValueType;
+
+  // maps the last generation under name if published
+  explicit SharedReader(const std::string& name) : name_{name} {
+    if (!header_seg_.open(name_) || header_seg_.size() < sizeof(SharedHeader)
+        || header_()->magic != SHARED_MAGIC || header_()->version != SHARED_VERSION
+        || header_()->type != type_()) {
+      header_seg_.unmap();
+      return;
+    }
+    refresh();
+  }
+
+  ~SharedReader() {}
+
+  bool is_open() const {
+    return header_seg_.data() != nullptr;
+  }
+
+  uint64_t generation() const { // mapped, 0 for none
+    return generation_;
+  }
+
+  size_t num_keys() const {
+    return num_keys_;
+  }
+
+  ValueType search_key(const char* key) const {
+    Query query(key);
+    if (trie_.is_empty() || !trie_.search_key(query)) {
+      return VTraits::NOT_FOUND;
+    }
+    return query.value();
+  }
+
+  // maps the last published generation if newer, returning whether any
+  // generation is mapped
+  bool refresh() {
+    if (!is_open()) {
+      return false;
+    }
+    while (true) {
+      auto generation = header_()->generation.load(std::memory_order_acquire);
+      if (generation == generation_) {
+        return generation_ != 0;
+      }
+      if (map_(generation)) {
+        return true;
+      }
+      // unless a newer one was published and unlinked it meanwhile, broken
+      if (header_()->generation.load(std::memory_order_acquire) == generation) {
+        return generation_ != 0;
+      }
+    }
+  }
+
+  SharedReader(const SharedReader&) = delete;
+  SharedReader& operator=(const SharedReader&) = delete;
+
+private:
+  std::string name_;
+  utils::SharedSegment header_seg_;
+  utils::SharedSegment seg_; // of the generation
+  FrozenType trie_;
+  uint64_t generation_ = 0;
+  size_t num_keys_ = 0;
+
+  static uint32_t type_() {
+    return utils::file_type(FileKind::SGL_SHARED, false, false, Wide, ValueTraits<Value>::BYTES);
+  }
+
+  const SharedHeader* header_() const {
+    return reinterpret_cast<const SharedHeader*>(header_seg_.data());
+  }
+
+  bool map_(uint64_t generation) {
+    utils::SharedSegment seg;
+    if (!seg.open(utils::generation_name(name_, generation))
+        || seg.size() < sizeof(SharedGeneration)) {
+      return false;
+    }
+    SharedGeneration head{};
+    std::memcpy(&head, seg.data(), sizeof(head));
+    FrozenType trie;
+    if (head.magic != SHARED_MAGIC || head.version != SHARED_VERSION || head.type != type_()
+        || head.generation != generation || seg.size() - sizeof(head) < head.size
+        || !trie.view(seg.data() + sizeof(head), static_cast<size_t>(head.size))) {
+      return false;
+    }
+    trie_.swap(trie);
+    seg_.swap(seg); // the last one is unmapped
+    generation_ = generation;
+    num_keys_ = static_cast<size_t>(head.num_keys);
+    return true;
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_SHARED_DICTIONARY_HPP
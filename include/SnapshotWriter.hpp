@@ -0,0 +1,139 @@
+#ifndef DDD_SNAPSHOT_WRITER_HPP
+#define DDD_SNAPSHOT_WRITER_HPP
+
+#include <cstdio>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Dictionary.hpp"
+
+namespace ddd {
+
+namespace utils {
+
+// writes all the bytes to fd, returning false on an error
+inline bool write_fd(int fd, const char* data, size_t size) {
+  while (size != 0) {
+    auto ret = ::write(fd, data, size);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    data += ret;
+    size -= static_cast<size_t>(ret);
+  }
+  return true;
+}
+
+// syncs the directory of file_name, for a creation or rename to persist
+inline bool sync_dir(const std::string& file_name) {
+  auto pos = file_name.find_last_of('/');
+  auto dir_name = pos == std::string::npos ? std::string{"."} : file_name.substr(0, pos + 1);
+  auto fd = ::open(dir_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  auto is_synced = ::fsync(fd) == 0;
+  ::close(fd);
+  return is_synced;
+}
+
+} // namespace -- utils
+
+// Writes snapshots of a dictionary on a background thread. snapshot() only
+// copies the arrays of the dictionary, so the caller has to exclude writers
+// just for the copy, and the dictionary changes freely while the copy is
+// written. A snapshot goes to a temporary file, which is synced and then
+// renamed to the file name, so that the file always holds a whole snapshot.
+class SnapshotWriter {
+public:
+  SnapshotWriter() {}
+
+  ~SnapshotWriter() {
+    wait();
+  }
+
+  // copies dic and starts writing the copy to file_name, after the last one
+  template<class T>
+  void start(const BasicDictionary<T>& dic, const std::string& file_name) {
+    FileImage image;
+    dic.snapshot(image);
+    start(std::move(image), file_name);
+  }
+
+  void start(FileImage&& image, const std::string& file_name) {
+    wait();
+    image_ = std::move(image);
+    file_name_ = file_name;
+    thread_ = std::thread([this]() {
+      is_written_ = write_();
+      image_ = FileImage{}; // frees the copy
+    });
+  }
+
+  // waits for the last snapshot, returning whether it was written and synced
+  bool wait() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    return is_written_;
+  }
+
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+private:
+  FileImage image_;
+  std::string file_name_;
+  std::thread thread_;
+  bool is_written_ = true;
+
+  // An output buffer writing through to a file descriptor
+  class FdOutputBuf : public std::streambuf {
+  public:
+    explicit FdOutputBuf(int fd) : fd_{fd} {}
+
+  protected:
+    int_type overflow(int_type ch) override {
+      if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        auto c = traits_type::to_char_type(ch);
+        if (xsputn(&c, 1) != 1) {
+          return traits_type::eof();
+        }
+      }
+      return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+      return utils::write_fd(fd_, s, static_cast<size_t>(n)) ? n : 0;
+    }
+
+  private:
+    int fd_ = -1;
+  };
+
+  bool write_() const {
+    auto tmp_name = file_name_ + ".tmp";
+    auto fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+      return false;
+    }
+    FdOutputBuf buf(fd);
+    std::ostream os(&buf);
+    utils::write_image(os, image_);
+    auto is_written = os.good() && ::fsync(fd) == 0;
+    is_written = ::close(fd) == 0 && is_written;
+    if (!is_written || std::rename(tmp_name.c_str(), file_name_.c_str()) != 0) {
+      std::remove(tmp_name.c_str());
+      return false;
+    }
+    return utils::sync_dir(file_name_);
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_SNAPSHOT_WRITER_HPP
@@ -0,0 +1,172 @@
+#ifndef DDD_TAIL_FREE_LIST_HPP
+#define DDD_TAIL_FREE_LIST_HPP
+
+#include <cassert>
+#include <iterator>
+#include <map>
+#include <set>
+
+#include "MemoryResource.hpp"
+
+namespace ddd {
+
+template<bool Wide>
+struct TailHole {
+  using IndexType = typename IndexTraits<Wide>::Type;
+
+  IndexType pos;
+  IndexType len;
+};
+
+// Best-fit free list of the holes in TAIL.
+// The holes are kept in two balanced trees, one by position for coalescing
+// adjacent holes on release, and one by (length, position), where the best
+// fit is the first hole not shorter than the request. Every update costs
+// O(log n) for n holes, which a trie under churn counts in the hundreds of
+// thousands. The trees are made on the first release, so that a trie
+// without holes pays only for a pointer.
+template<bool Wide>
+class TailFreeList {
+public:
+  using IndexType = typename IndexTraits<Wide>::Type;
+
+  explicit TailFreeList(MemoryResource* resource = new_delete_resource())
+    : resource_{resource} {}
+
+  ~TailFreeList() {
+    if (lists_ != nullptr) {
+      lists_->~Lists();
+      resource_->deallocate(lists_, sizeof(Lists));
+    }
+  }
+
+  IndexType allocate(IndexType len) { // returns NOT_FOUND if no hole fits
+    assert(0 < len);
+
+    if (num_holes() == 0) {
+      return IndexTraits<Wide>::NOT_FOUND;
+    }
+    auto it = lists_->by_len.lower_bound(TailHole<Wide>{0, len});
+    if (it == lists_->by_len.end()) {
+      return IndexTraits<Wide>::NOT_FOUND;
+    }
+
+    auto hole = *it;
+    erase_(hole);
+    if (len < hole.len) {
+      insert_(TailHole<Wide>{hole.pos + len, hole.len - len});
+    }
+    return hole.pos;
+  }
+
+  void release(IndexType pos, IndexType len) {
+    assert(0 < len);
+
+    auto& by_pos = lists_ref_().by_pos;
+    TailHole<Wide> hole{pos, len};
+    auto next = by_pos.lower_bound(pos);
+    if (next != by_pos.begin()) {
+      auto prev = std::prev(next);
+      assert(prev->first + prev->second <= pos);
+      if (prev->first + prev->second == pos) {
+        hole.pos = prev->first;
+        hole.len += prev->second;
+        erase_(TailHole<Wide>{prev->first, prev->second});
+      }
+    }
+    if (next != by_pos.end() && next->first == pos + len) {
+      hole.len += next->second;
+      erase_(TailHole<Wide>{next->first, next->second});
+    }
+
+    insert_(hole);
+  }
+
+  IndexType trim(IndexType end) { // removes the hole ending at end and returns the new end
+    if (num_holes() == 0) {
+      return end;
+    }
+    auto last = *lists_->by_pos.rbegin();
+    if (last.first + last.second != end) {
+      return end;
+    }
+    erase_(TailHole<Wide>{last.first, last.second});
+    return last.first;
+  }
+
+  void clear() {
+    if (lists_ == nullptr) {
+      return;
+    }
+    lists_->by_pos.clear();
+    lists_->by_len.clear();
+  }
+
+  size_t num_holes() const {
+    return lists_ == nullptr ? 0 : lists_->by_pos.size();
+  }
+
+  size_t size_in_bytes() const { // in memory, not written
+    if (lists_ == nullptr) {
+      return 0;
+    }
+    // a tree node holds a color and three links besides the value
+    auto node_size = [](size_t value_size) {
+      return sizeof(void*) * 4 + value_size;
+    };
+    return sizeof(Lists) + num_holes() * (node_size(sizeof(typename PosTree::value_type))
+                                          + node_size(sizeof(TailHole<Wide>)));
+  }
+
+  void swap(TailFreeList& rhs) {
+    std::swap(resource_, rhs.resource_);
+    std::swap(lists_, rhs.lists_);
+  }
+
+  TailFreeList(const TailFreeList&) = delete;
+  TailFreeList& operator=(const TailFreeList&) = delete;
+
+private:
+  struct ByLen {
+    bool operator()(const TailHole<Wide>& lhs, const TailHole<Wide>& rhs) const {
+      return lhs.len != rhs.len ? lhs.len < rhs.len : lhs.pos < rhs.pos;
+    }
+  };
+
+  using PosTree = std::map<IndexType, IndexType, std::less<IndexType>,
+                           ResourceAllocator<std::pair<const IndexType, IndexType>>>;
+  using LenTree = std::set<TailHole<Wide>, ByLen, ResourceAllocator<TailHole<Wide>>>;
+
+  struct Lists {
+    explicit Lists(MemoryResource* resource)
+      : by_pos(std::less<IndexType>(), resource), by_len(ByLen(), resource) {}
+
+    PosTree by_pos; // pos -> len
+    LenTree by_len; // by (len, pos)
+  };
+
+  MemoryResource* resource_;
+  Lists* lists_ = nullptr;
+
+  Lists& lists_ref_() {
+    if (lists_ == nullptr) {
+      lists_ = new (resource_->allocate(sizeof(Lists))) Lists(resource_);
+    }
+    return *lists_;
+  }
+
+  void insert_(const TailHole<Wide>& hole) {
+    lists_ref_().by_pos.emplace(hole.pos, hole.len);
+    lists_->by_len.insert(hole);
+  }
+
+  void erase_(TailHole<Wide> hole) { // by value, as it may refer to a node
+    assert(lists_->by_pos.count(hole.pos) == 1 && lists_->by_len.count(hole) == 1);
+    lists_->by_pos.erase(hole.pos);
+    lists_->by_len.erase(hole);
+  }
+};
+
+} // namespace -- ddd
+
+#endif // DDD_TAIL_FREE_LIST_HPP